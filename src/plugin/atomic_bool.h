@@ -6,17 +6,69 @@
 
 #if (__STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__))
 #include <stdatomic.h>
+
+typedef _Atomic(void *) atomic_ptr;
+#define atomic_exchange_ptr(a, b) atomic_exchange(a, b)
+#define atomic_exchange_uint(a, b) atomic_exchange(a, b)
 #else
 // defined(_MSC_VER) TODO: use msvc atomics?
 typedef volatile bool atomic_bool;
+typedef volatile unsigned int atomic_uint;
 
 #define atomic_store(a, b) *(a) = (b)
+#define atomic_load(a) (*(a))
 
 inline static bool atomic_exchange(atomic_bool *a, bool b) {
     bool old = *a;
     *a = b;
     return old;
 }
+
+typedef void *volatile atomic_ptr;
+
+inline static unsigned int atomic_exchange_uint(atomic_uint *a,
+                                               unsigned int b)
+{
+    unsigned int old = *a;
+    *a = b;
+    return old;
+}
+
+inline static unsigned int atomic_fetch_add(atomic_uint *a, unsigned int b) {
+    unsigned int old = *a;
+    *a = old + b;
+    return old;
+}
+
+inline static unsigned int atomic_fetch_sub(atomic_uint *a, unsigned int b) {
+    unsigned int old = *a;
+    *a = old - b;
+    return old;
+}
+
+inline static bool atomic_compare_exchange_weak(atomic_uint *a,
+                                                unsigned int *expected,
+                                                unsigned int desired)
+{
+    if (*a != *expected) {
+        *expected = *a;
+        return false;
+    }
+
+    *a = desired;
+    return true;
+}
+
+// msvc does not reorder volatile accesses
+#define memory_order_acquire 0
+#define memory_order_release 0
+#define atomic_thread_fence(order) ((void)(order))
+
+inline static void* atomic_exchange_ptr(atomic_ptr *a, void *b) {
+    void *old = *a;
+    *a = b;
+    return old;
+}
 #endif
 
 #endif
\ No newline at end of file
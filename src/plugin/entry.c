@@ -16,6 +16,7 @@
 #include <plugin_gui.h>
 #include "system.h"
 #include "plugin_impl.h"
+#include "multi_impl.h"
 
 static const clap_plugin_descriptor_t s_synth_plug_desc = {
    .clap_version = CLAP_VERSION_INIT,
@@ -35,6 +36,34 @@ static const clap_plugin_descriptor_t s_synth_plug_desc = {
    }
 };
 
+// preset bank shipped next to the plugin binary, set on entry init
+#define FACTORY_BANK_NAME "factory." PRESET_BANK_EXTENSION
+static char *s_factory_bank_path = NULL;
+
+// main thread only
+static const preset_bank_s* factory_bank(void) {
+   if (!s_factory_bank_path) return NULL;
+   return preset_bank_get(s_factory_bank_path);
+}
+
+static const clap_plugin_descriptor_t s_multi_plug_desc = {
+   .clap_version = CLAP_VERSION_INIT,
+   .id = "us.pkhead.beepbox.multi",
+   .name = "BeepBox Multi",
+   .vendor = "pkhead",
+   .url = "https://github.com/pkhead/beepbox-plug",
+   .manual_url = "",
+   .support_url = "",
+   .version = PLUGIN_VERSION,
+   .description = "Multi-timbral BeepBox synthesizers",
+   .features = (const char *[]){
+      CLAP_PLUGIN_FEATURE_INSTRUMENT,
+      CLAP_PLUGIN_FEATURE_SYNTHESIZER,
+      CLAP_PLUGIN_FEATURE_STEREO,
+      NULL
+   }
+};
+
 
 
 
@@ -107,6 +136,58 @@ static const clap_plugin_latency_t s_plugin_latency = {
    .get = plugin_latency_get,
 };
 
+/////////////////
+// clap_render //
+/////////////////
+
+static bool plugin_render_has_hard_realtime_requirement(const clap_plugin_t *plugin) {
+   return false;
+}
+
+static bool plugin_render_set(const clap_plugin_t *plugin, clap_plugin_render_mode mode) {
+   plugin_set_render_mode(plugin->plugin_data, mode == CLAP_RENDER_OFFLINE);
+   return true;
+}
+
+static const clap_plugin_render_t s_plugin_render = {
+   .has_hard_realtime_requirement = plugin_render_has_hard_realtime_requirement,
+   .set = plugin_render_set,
+};
+
+//////////////////////
+// clap_preset_load //
+//////////////////////
+
+// presets are addressed by the path of their bank and their name
+static bool plugin_preset_load_from_location(const clap_plugin_t *plugin, uint32_t location_kind, const char *location, const char *load_key) {
+   plugin_s *plug = plugin->plugin_data;
+   if (location_kind != CLAP_PRESET_DISCOVERY_LOCATION_FILE || !location || !load_key)
+      return false;
+
+   const char *error = NULL;
+   const preset_bank_s *bank = preset_bank_get(location);
+   uint32_t index = PRESET_BANK_NONE;
+
+   if (!bank)
+      error = "Could not open preset bank";
+   else if ((index = preset_bank_find(bank, load_key)) == PRESET_BANK_NONE)
+      error = "Preset not found";
+   else if (!plugin_load_preset(plug, bank, index))
+      error = "Could not load preset";
+
+   if (error) {
+      if (plug->host_preset_load)
+         plug->host_preset_load->on_error(plug->host, location_kind, location, load_key, 0, error);
+      return false;
+   }
+
+   return true;
+}
+
+static const clap_plugin_preset_load_t s_plugin_preset_load = {
+   .from_location = plugin_preset_load_from_location,
+};
+
 ////////////////
 // clap_state //
 ////////////////
@@ -176,6 +257,9 @@ static void clap_plugin_params_flush(const clap_plugin_t *plugin, const clap_inp
       const clap_event_header_t *hdr = in->get(in, i);
       plugin_process_event(plug, hdr, out);
    }
+
+   // there is no block end to publish the changes at when not processing
+   instr_publish_snapshot(&plug->instrument);
 }
 
 
@@ -209,6 +293,33 @@ static void gui_show_context_menu(int x, int y, uint32_t param, void *userdata)
    }
 }
 
+// called from the gui thread, which may not be the main thread. the preset
+// is loaded in load_pending_preset.
+static void gui_load_preset(uint32_t index, void *userdata) {
+   plugin_s *plug = (plugin_s*) userdata;
+
+   atomic_store(&plug->pending_preset, index + 1);
+   plug->host->request_callback(plug->host);
+}
+
+static void load_pending_preset(plugin_s *plug) {
+   const unsigned int pending = atomic_exchange_uint(&plug->pending_preset, 0);
+   if (pending == 0) return;
+
+   const uint32_t index = pending - 1;
+   const preset_bank_s *bank = factory_bank();
+   if (!bank || index >= preset_bank_count(bank) ||
+       !plugin_load_preset(plug, bank, index))
+      return;
+
+   // keep the preset browser of the host in sync
+   if (plug->host_preset_load) {
+      preset_info_s info;
+      preset_bank_info(bank, index, &info);
+      plug->host_preset_load->loaded(plug->host, CLAP_PRESET_DISCOVERY_LOCATION_FILE, s_factory_bank_path, info.name);
+   }
+}
+
 bool plugin_gui_is_api_supported(const clap_plugin_t *plugin, const char *api, bool is_floating) {
    return gui_is_api_supported(api, is_floating);
 }
@@ -227,6 +338,9 @@ bool plugin_gui_create(const clap_plugin_t *plugin, const char *api, bool is_flo
       .is_floating = is_floating,
       .instrument = &plug->instrument,
       .show_context_menu = gui_show_context_menu,
+      .presets = factory_bank(),
+      .load_preset = gui_load_preset,
+      .arena = plug->arena,
       .userdata = plug
    });
 
@@ -384,34 +498,6 @@ static const clap_plugin_track_info_t s_plugin_track_info = {
 // clap_plugin //
 /////////////////
 
-static void bpbx_log_cb(bpbxsyn_log_severity_e severity, const char *msg, void *userdata) {
-   plugin_s *plug = (plugin_s*)userdata;
-   clap_log_severity clap_sev = CLAP_LOG_INFO;
-   switch (severity) {
-      case BPBXSYN_LOG_DEBUG:
-         clap_sev = CLAP_LOG_DEBUG;
-         break;
-
-      case BPBXSYN_LOG_INFO:
-         clap_sev = CLAP_LOG_INFO;
-         break;
-
-      case BPBXSYN_LOG_WARNING:
-         clap_sev = CLAP_LOG_WARNING;
-         break;
-
-      case BPBXSYN_LOG_ERROR:
-         clap_sev = CLAP_LOG_ERROR;
-         break;
-
-      case BPBXSYN_LOG_FATAL:
-         clap_sev = CLAP_LOG_FATAL;
-         break;
-   }
-
-   plug->host_log->log(plug->host, clap_sev, msg);
-}
-
 static bool clap_plugin_init(const clap_plugin_t *plugin) {
    plugin_s *plug = plugin->plugin_data;
    return plugin_init(plug);
@@ -436,7 +522,9 @@ static bool plugin_start_processing(const struct clap_plugin *plugin) {
    return true;
 }
 
-static void plugin_stop_processing(const struct clap_plugin *plugin) {}
+static void clap_plugin_stop_processing(const struct clap_plugin *plugin) {
+   plugin_stop_processing(plugin->plugin_data);
+}
 
 static void plugin_reset(const struct clap_plugin *plugin) {}
 
@@ -469,12 +557,19 @@ static const void *plugin_get_extension(const struct clap_plugin *plugin, const
    if (!strcmp(id, CLAP_EXT_CONTEXT_MENU))
       return &s_plugin_context_menu;
 
+   if (!strcmp(id, CLAP_EXT_RENDER))
+      return &s_plugin_render;
+
+   if (!strcmp(id, CLAP_EXT_PRESET_LOAD) || !strcmp(id, CLAP_EXT_PRESET_LOAD_COMPAT))
+      return &s_plugin_preset_load;
+
    return NULL;
 }
 
-static void plugin_on_main_thread(const struct clap_plugin *plugin) {
-   plugin_s *p = plugin->plugin_data;
-   instr_on_main_thread(&p->instrument);
+static void clap_plugin_on_main_thread(const struct clap_plugin *plugin) {
+   plugin_s *plug = plugin->plugin_data;
+   load_pending_preset(plug);
+   plugin_on_main_thread(plug);
 }
 
 clap_plugin_t *clap_plugin_create(const clap_host_t *host) {
@@ -488,11 +583,11 @@ clap_plugin_t *clap_plugin_create(const clap_host_t *host) {
       .plugin.activate = clap_plugin_activate,
       .plugin.deactivate = clap_plugin_deactivate,
       .plugin.start_processing = plugin_start_processing,
-      .plugin.stop_processing = plugin_stop_processing,
+      .plugin.stop_processing = clap_plugin_stop_processing,
       .plugin.reset = plugin_reset,
       .plugin.process = clap_plugin_process,
       .plugin.get_extension = plugin_get_extension,
-      .plugin.on_main_thread = plugin_on_main_thread,
+      .plugin.on_main_thread = clap_plugin_on_main_thread,
    };
 
    // Don't call into the host here
@@ -500,6 +595,227 @@ clap_plugin_t *clap_plugin_create(const clap_host_t *host) {
    return &p->plugin;
 }
 
+///////////////////////////////
+// multi-timbral clap_plugin //
+///////////////////////////////
+
+static uint32_t multi_audio_ports_count(const clap_plugin_t *plugin, bool is_input) {
+   // no inputs, main output followed by one output per slot
+   if (is_input) return 0;
+   return 1 + MULTI_SLOT_COUNT;
+}
+
+static bool multi_audio_ports_get(const clap_plugin_t *plugin, uint32_t index, bool is_input, clap_audio_port_info_t *info) {
+   if (is_input || index > MULTI_SLOT_COUNT)
+      return false;
+
+   info->id = index;
+   if (index == 0) {
+      snprintf(info->name, sizeof(info->name), "%s", "Audio Output");
+      info->flags = CLAP_AUDIO_PORT_IS_MAIN;
+   } else {
+      snprintf(info->name, sizeof(info->name), "Slot %u", index);
+      info->flags = 0;
+   }
+   info->channel_count = 2;
+   info->port_type = CLAP_PORT_STEREO;
+   info->in_place_pair = CLAP_INVALID_ID;
+   return true;
+}
+
+static const clap_plugin_audio_ports_t s_multi_audio_ports = {
+   .count = multi_audio_ports_count,
+   .get = multi_audio_ports_get,
+};
+
+static uint32_t multi_note_ports_count(const clap_plugin_t *plugin, bool is_input) {
+   // port 0 routes by channel, the others go to one slot each
+   if (!is_input) return 0;
+   return 1 + MULTI_SLOT_COUNT;
+}
+
+static bool multi_note_ports_get(const clap_plugin_t *plugin, uint32_t index, bool is_input, clap_note_port_info_t *info) {
+   if (!is_input || index > MULTI_SLOT_COUNT)
+      return false;
+
+   info->id = index;
+   if (index == 0) {
+      snprintf(info->name, sizeof(info->name), "%s", "All channels");
+   } else {
+      snprintf(info->name, sizeof(info->name), "Slot %u", index);
+   }
+
+   info->supported_dialects =
+      CLAP_NOTE_DIALECT_CLAP | CLAP_NOTE_DIALECT_MIDI;
+   info->preferred_dialect = CLAP_NOTE_DIALECT_CLAP;
+   return true;
+}
+
+static const clap_plugin_note_ports_t s_multi_note_ports = {
+   .count = multi_note_ports_count,
+   .get = multi_note_ports_get,
+};
+
+static bool multi_render_set(const clap_plugin_t *plugin, clap_plugin_render_mode mode) {
+   multi_set_render_mode(plugin->plugin_data, mode == CLAP_RENDER_OFFLINE);
+   return true;
+}
+
+static const clap_plugin_render_t s_multi_render = {
+   .has_hard_realtime_requirement = plugin_render_has_hard_realtime_requirement,
+   .set = multi_render_set,
+};
+
+static bool clap_multi_state_save(const clap_plugin_t *plugin,
+                                  const clap_ostream_t *stream)
+{
+   return multi_state_save(plugin->plugin_data, stream);
+}
+
+static bool clap_multi_state_load(const clap_plugin_t *plugin,
+                                  const clap_istream_t *stream)
+{
+   return multi_state_load(plugin->plugin_data, stream);
+}
+
+static const clap_plugin_state_t s_multi_state = {
+   .save = clap_multi_state_save,
+   .load = clap_multi_state_load,
+};
+
+static uint32_t clap_multi_params_count(const clap_plugin_t *plugin) {
+   return multi_params_count(plugin->plugin_data);
+}
+
+static bool clap_multi_params_get_info(const clap_plugin_t *plugin,
+                                       uint32_t param_index,
+                                       clap_param_info_t *param_info)
+{
+   return multi_params_get_info(plugin->plugin_data, param_index, param_info);
+}
+
+static bool clap_multi_params_get_value(const clap_plugin_t *plugin,
+                                        clap_id param_id, double *out_value)
+{
+   return multi_params_get_value(plugin->plugin_data, param_id, out_value);
+}
+
+static bool clap_multi_params_value_to_text(const clap_plugin_t *plugin,
+                                            clap_id param_id, double value,
+                                            char *out_buffer,
+                                            uint32_t out_buffer_capacity)
+{
+   return multi_params_value_to_text(plugin->plugin_data, param_id, value, out_buffer, out_buffer_capacity);
+}
+
+static bool clap_multi_params_text_to_value(const clap_plugin_t *plugin,
+                                            clap_id param_id,
+                                            const char *param_value_text,
+                                            double *out_value)
+{
+   return multi_params_text_to_value(plugin->plugin_data, param_id, param_value_text, out_value);
+}
+
+static void clap_multi_params_flush(const clap_plugin_t *plugin, const clap_input_events_t *in, const clap_output_events_t *out) {
+   multi_s *multi = plugin->plugin_data;
+   uint32_t size = in->size(in);
+
+   for (uint32_t i = 0; i < size; ++i) {
+      const clap_event_header_t *hdr = in->get(in, i);
+      multi_process_event(multi, hdr, out);
+   }
+
+   // there is no block end to publish the changes at when not processing
+   for (int i = 0; i < MULTI_SLOT_COUNT; ++i)
+      instr_publish_snapshot(&multi->slots[i].instrument);
+}
+
+static const clap_plugin_params_t s_multi_params = {
+   .count = clap_multi_params_count,
+   .get_info = clap_multi_params_get_info,
+   .get_value = clap_multi_params_get_value,
+   .value_to_text = clap_multi_params_value_to_text,
+   .text_to_value = clap_multi_params_text_to_value,
+   .flush = clap_multi_params_flush
+};
+
+static bool clap_multi_init(const clap_plugin_t *plugin) {
+   return multi_init(plugin->plugin_data);
+}
+
+static void clap_multi_destroy(const clap_plugin_t *plugin) {
+   multi_s *multi = plugin->plugin_data;
+   multi_destroy(multi);
+   free(multi);
+}
+
+static bool clap_multi_activate(const struct clap_plugin *plugin, double sample_rate, uint32_t min_frames_count, uint32_t max_frames_count) {
+   return multi_activate(plugin->plugin_data, sample_rate, min_frames_count, max_frames_count);
+}
+
+static void clap_multi_deactivate(const struct clap_plugin *plugin) {
+   multi_deactivate(plugin->plugin_data);
+}
+
+static void clap_multi_stop_processing(const struct clap_plugin *plugin) {
+   multi_stop_processing(plugin->plugin_data);
+}
+
+static clap_process_status clap_multi_process(const clap_plugin_t *plugin, const clap_process_t *process) {
+   return multi_process(plugin->plugin_data, process);
+}
+
+static const void *multi_get_extension(const struct clap_plugin *plugin, const char *id) {
+   if (!strcmp(id, CLAP_EXT_LATENCY))
+      return &s_plugin_latency;
+
+   if (!strcmp(id, CLAP_EXT_AUDIO_PORTS))
+      return &s_multi_audio_ports;
+
+   if (!strcmp(id, CLAP_EXT_NOTE_PORTS))
+      return &s_multi_note_ports;
+
+   if (!strcmp(id, CLAP_EXT_STATE))
+      return &s_multi_state;
+
+   if (!strcmp(id, CLAP_EXT_PARAMS))
+      return &s_multi_params;
+
+   if (!strcmp(id, CLAP_EXT_RENDER))
+      return &s_multi_render;
+
+   return NULL;
+}
+
+static void clap_multi_on_main_thread(const struct clap_plugin *plugin) {
+   multi_on_main_thread(plugin->plugin_data);
+}
+
+clap_plugin_t *clap_multi_create(const clap_host_t *host) {
+   multi_s *m = malloc(sizeof(multi_s));
+   if (!m) return NULL;
+
+   *m = (multi_s) {
+      .host = host,
+      .plugin.desc = &s_multi_plug_desc,
+      .plugin.plugin_data = m,
+      .plugin.init = clap_multi_init,
+      .plugin.destroy = clap_multi_destroy,
+      .plugin.activate = clap_multi_activate,
+      .plugin.deactivate = clap_multi_deactivate,
+      .plugin.start_processing = plugin_start_processing,
+      .plugin.stop_processing = clap_multi_stop_processing,
+      .plugin.reset = plugin_reset,
+      .plugin.process = clap_multi_process,
+      .plugin.get_extension = multi_get_extension,
+      .plugin.on_main_thread = clap_multi_on_main_thread,
+   };
+
+   // Don't call into the host here
+   multi_create(m);
+   return &m->plugin;
+}
+
 /////////////////////////
 // clap_plugin_factory //
 /////////////////////////
@@ -512,6 +828,10 @@ static struct {
       .desc = &s_synth_plug_desc,
       .create = clap_plugin_create,
    },
+   {
+      .desc = &s_multi_plug_desc,
+      .create = clap_multi_create,
+   },
 };
 
 static uint32_t plugin_factory_get_plugin_count(const struct clap_plugin_factory *factory) {
@@ -544,17 +864,147 @@ static const clap_plugin_factory_t s_plugin_factory = {
    .create_plugin = plugin_factory_create_plugin,
 };
 
+///////////////////////////////////
+// clap_preset_discovery_factory //
+///////////////////////////////////
+
+static const clap_preset_discovery_provider_descriptor_t s_preset_provider_desc = {
+   .clap_version = CLAP_VERSION_INIT,
+   .id = "us.pkhead.beepbox.presets",
+   .name = "BeepBox preset banks",
+   .vendor = "pkhead",
+};
+
+static bool preset_provider_init(const clap_preset_discovery_provider_t *provider) {
+   const clap_preset_discovery_indexer_t *indexer = provider->provider_data;
+
+   const clap_preset_discovery_filetype_t filetype = {
+      .name = "BeepBox preset bank",
+      .description = "Bank of BeepBox instrument presets",
+      .file_extension = PRESET_BANK_EXTENSION,
+   };
+
+   if (!indexer->declare_filetype(indexer, &filetype))
+      return false;
+
+   if (s_factory_bank_path) {
+      const clap_preset_discovery_location_t location = {
+         .flags = CLAP_PRESET_DISCOVERY_IS_FACTORY_CONTENT,
+         .name = "BeepBox Factory",
+         .kind = CLAP_PRESET_DISCOVERY_LOCATION_FILE,
+         .location = s_factory_bank_path,
+      };
+
+      indexer->declare_location(indexer, &location);
+   }
+
+   return true;
+}
+
+static void preset_provider_destroy(const clap_preset_discovery_provider_t *provider) {
+   free((void*)provider);
+}
+
+static bool preset_provider_get_metadata(const clap_preset_discovery_provider_t *provider, uint32_t location_kind, const char *location, const clap_preset_discovery_metadata_receiver_t *receiver) {
+   if (location_kind != CLAP_PRESET_DISCOVERY_LOCATION_FILE || !location)
+      return false;
+
+   // the indexer is not bound to the main thread, so the bank is mapped
+   // just for the crawl instead of going through the shared banks
+   preset_bank_s *bank = preset_bank_open(location);
+   if (!bank) {
+      receiver->on_error(receiver, 0, "Not a valid BeepBox preset bank");
+      return false;
+   }
+
+   const clap_universal_plugin_id_t plugin_id = {
+      .abi = "clap",
+      .id = s_synth_plug_desc.id,
+   };
+
+   const uint32_t count = preset_bank_count(bank);
+   for (uint32_t i = 0; i < count; ++i) {
+      preset_info_s info;
+      preset_bank_info(bank, i, &info);
+
+      // the name doubles as the load key
+      if (!receiver->begin_preset(receiver, info.name, info.name))
+         break;
+
+      receiver->add_plugin_id(receiver, &plugin_id);
+      if (info.category[0])
+         receiver->add_feature(receiver, info.category);
+   }
+
+   preset_bank_close(bank);
+   return true;
+}
+
+static const void *preset_provider_get_extension(const clap_preset_discovery_provider_t *provider, const char *id) {
+   return NULL;
+}
+
+static uint32_t preset_discovery_count(const clap_preset_discovery_factory_t *factory) {
+   return 1;
+}
+
+static const clap_preset_discovery_provider_descriptor_t *
+preset_discovery_get_descriptor(const clap_preset_discovery_factory_t *factory, uint32_t index) {
+   return index == 0 ? &s_preset_provider_desc : NULL;
+}
+
+static const clap_preset_discovery_provider_t *
+preset_discovery_create(const clap_preset_discovery_factory_t *factory, const clap_preset_discovery_indexer_t *indexer, const char *provider_id) {
+   if (strcmp(provider_id, s_preset_provider_desc.id))
+      return NULL;
+
+   clap_preset_discovery_provider_t *provider = malloc(sizeof(clap_preset_discovery_provider_t));
+   if (!provider) return NULL;
+
+   *provider = (clap_preset_discovery_provider_t) {
+      .desc = &s_preset_provider_desc,
+      .provider_data = (void*)indexer,
+      .init = preset_provider_init,
+      .destroy = preset_provider_destroy,
+      .get_metadata = preset_provider_get_metadata,
+      .get_extension = preset_provider_get_extension,
+   };
+
+   return provider;
+}
+
+static const clap_preset_discovery_factory_t s_preset_discovery_factory = {
+   .count = preset_discovery_count,
+   .get_descriptor = preset_discovery_get_descriptor,
+   .create = preset_discovery_create,
+};
+
 ////////////////
 // clap_entry //
 ////////////////
 
 static bool entry_init(const char *plugin_path) {
-   // perform the plugin initialization
+   // the factory bank sits in the same directory as the plugin
+   const char *sep = strrchr(plugin_path, '/');
+#ifdef _WIN32
+   const char *win_sep = strrchr(plugin_path, '\\');
+   if (!sep || (win_sep && win_sep > sep))
+      sep = win_sep;
+#endif
+
+   const size_t dir_len = sep ? (size_t)(sep - plugin_path) + 1 : 0;
+   s_factory_bank_path = malloc(dir_len + sizeof(FACTORY_BANK_NAME));
+   if (s_factory_bank_path) {
+      memcpy(s_factory_bank_path, plugin_path, dir_len);
+      memcpy(s_factory_bank_path + dir_len, FACTORY_BANK_NAME, sizeof(FACTORY_BANK_NAME));
+   }
+
    return true;
 }
 
 static void entry_deinit(void) {
-   // perform the plugin de-initialization
+   free(s_factory_bank_path);
+   s_factory_bank_path = NULL;
 }
 
 #ifdef CLAP_HAS_THREAD
@@ -627,6 +1077,11 @@ static const void *entry_get_factory(const char *factory_id) {
 
    if (!strcmp(factory_id, CLAP_PLUGIN_FACTORY_ID))
       return &s_plugin_factory;
+
+   if (!strcmp(factory_id, CLAP_PRESET_DISCOVERY_FACTORY_ID) ||
+       !strcmp(factory_id, CLAP_PRESET_DISCOVERY_FACTORY_ID_COMPAT))
+      return &s_preset_discovery_factory;
+
    return NULL;
 }
 
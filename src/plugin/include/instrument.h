@@ -54,36 +54,134 @@ typedef enum {
 
 typedef struct instrument instrument_s;
 
-bool instr_init(instrument_s *instr, bpbxsyn_context_s *ctx, bpbxsyn_synth_type_e type);
+typedef enum {
+    // do not create echo and reverb modules, for instruments whose output
+    // is sent to a shared effect bus instead
+    INSTR_INIT_NO_SEND_EFFECTS = 1,
+} instr_init_flags_e;
+
+bool instr_init(instrument_s *instr, bpbxsyn_context_s *ctx,
+                bpbxsyn_synth_type_e type, uint32_t flags);
 void instr_destroy(instrument_s *instr);
 void instr_process(instrument_s *instr, float **output, uint32_t frame_count,
                    uint32_t start_frame, const clap_output_events_t *out_events);
-void instr_on_main_thread(instrument_s *instr);
+void instr_process_transport(instrument_s *instr,
+                             const clap_event_transport_t *ev);
 bpbxsyn_synth_s* instr_get_synth(const instrument_s *instr);
 
 bool instr_activate(instrument_s *instr, bpbxsyn_context_s *ctx,
                     double sample_rate, uint32_t max_frames_count);
 bool instr_deactivate(instrument_s *instr);
 
+// called from the on_main_thread callback of the plugin. creates the synth
+// for a pending synth type change and the waiting modules of lazy effects.
+// retired synths and effects are destroyed by the main queue of the plugin.
+// returns the param rescan the host should be asked for.
+clap_param_rescan_flags instr_on_main_thread(instrument_s *instr);
+
+// called from stop_processing. puts the modules of disabled effects back to
+// wait until they are enabled again.
+void instr_stop_processing(instrument_s *instr);
+
+// called from the render extension of the plugin
+void instr_set_render_mode(instrument_s *instr, bool offline);
+
+// true while the audio of a swapped-out synth is still being faded out
+bool instr_is_swapping_synth(const instrument_s *instr);
+
 void instr_set_effect_active(instrument_s *instr, bpbxsyn_effect_type_e effect,
                              bool value);
+
+// set the modulation amount of a param, which is added to its value
+// without changing it. the modulated value takes effect at the next tick.
+// returns false if the param cannot be modulated, or if too many params
+// are modulated at once.
+bool instr_mod_param(instrument_s *instr, instr_param_id id, double amount);
+
+// synth and effect params, except for enums, accept modulation
+bool instr_param_is_modulatable(instr_param_id id,
+                                const bpbxsyn_param_info_s *info);
 // bool instr_is_module_active(const instrument_s *instr, instr_module_e module);
 
+// returns false for the modules left out by INSTR_INIT_NO_SEND_EFFECTS
+bool instr_has_module(const instrument_s *instr, instr_module_e module);
+
 void instr_begin_note(instrument_s *instr, int16_t key, double velocity,
                       int32_t note_id, int16_t port_index, int16_t channel);
 
 void instr_end_notes(instrument_s *instr, int16_t key, int32_t note_id,
                      int16_t port_index, int16_t channel);
 
+// the params and envelopes of an instrument are published as a snapshot by
+// the thread that owns the instrument, at the end of every block in which
+// they changed. other threads read them from there instead of from the
+// synth, which may be changed or replaced while they read it.
+typedef struct instr_snapshot instr_snapshot_s;
+
+// called by the owner of the instrument after changing it outside of
+// instr_process, such as in params.flush. does nothing if nothing changed.
+void instr_publish_snapshot(instrument_s *instr);
+
+// copy of the newest snapshot, safe from any thread
+instr_snapshot_s* instr_snapshot_new(void);
+void instr_snapshot_free(instr_snapshot_s *snapshot);
+void instr_read_snapshot(const instrument_s *instr, instr_snapshot_s *snapshot);
+
+bpbxsyn_synth_type_e instr_snapshot_type(const instr_snapshot_s *snapshot);
+
+// params are listed like with instr_get_param_id, for the synth type of
+// the snapshot
+uint32_t instr_snapshot_params_count(const instr_snapshot_s *snapshot);
+instr_param_id instr_snapshot_param(const instr_snapshot_s *snapshot,
+                                    uint32_t index, bool *is_inactive,
+                                    double *value);
+
+const bpbxsyn_envelope_s* instr_snapshot_envelopes(
+    const instr_snapshot_s *snapshot, uint32_t *count);
+
+// like instr_get_param, but reads the newest snapshot. safe from any thread.
+bool instr_get_published_param(const instrument_s *instr, instr_param_id id,
+                               double *value);
+
 uint32_t instr_params_count(const instrument_s *instr);
 instr_param_id instr_get_param_id(const instrument_s *instr, uint32_t index,
                                   bool *is_inactive);
 
 bool instr_set_param(instrument_s *instr, instr_param_id id, double *value);
+
+typedef struct {
+    instr_param_id id;
+
+    // info of the param if already known, or NULL
+    const bpbxsyn_param_info_s *info;
+    double value;
+} instr_param_value_s;
+
+// set several params at once. values are written back like with
+// instr_set_param. returns false if any of the params could not be set, but
+// still applies the rest.
+bool instr_set_params(instrument_s *instr, instr_param_value_s *params,
+                      uint32_t count);
+
+#define INSTR_MAX_LINKED_PARAMS 4
+
+// params that follow a param that was set to the given value, which the
+// plugin sets as well so that the host knows they changed. changing the
+// vibrato preset sets the vibrato params, and changing a vibrato param sets
+// the preset to custom. returns the amount of params written to out.
+uint32_t instr_linked_params(const instrument_s *instr, instr_param_id id,
+                             double value,
+                             instr_param_value_s out[INSTR_MAX_LINKED_PARAMS]);
+
+// clap severity of a message logged by the synth library
+clap_log_severity instr_log_severity(bpbxsyn_log_severity_e severity);
+
 bool instr_get_param(const instrument_s *instr, instr_param_id id, double *value);
 
 const bpbxsyn_param_info_s* instr_get_param_info(const instrument_s *instr,
                                                  instr_param_id id);
+const bpbxsyn_param_info_s* instr_type_param_info(bpbxsyn_synth_type_e type,
+                                                  instr_param_id id);
 
 // calculate type index of a given synth. type index uses different values than the values
 // for the type enums.
@@ -100,6 +198,29 @@ void instr_local_id(instr_param_id global_index, instr_module_e *out_target,
 
 #define instr_synth_param(index) (instr_global_id(INSTR_MODULE_SYNTH, index))
 
+// params specific to one synth type have the synth type plus one in bits
+// 20-23 of their id, so that every param keeps its id when the synth type
+// changes. the params of other types are reported to the host as hidden.
+//
+// ids without the tag refer to the param of the current synth type. the gui
+// uses those, and the plugin converts them with instr_typed_param_id.
+#define INSTR_SYNTH_TYPE_SHIFT 20
+#define INSTR_SYNTH_TYPE_MASK (0xFu << INSTR_SYNTH_TYPE_SHIFT)
+
+#define instr_typed_synth_param(type, index) \
+    (instr_synth_param(index) | (((uint32_t)(type) + 1) << INSTR_SYNTH_TYPE_SHIFT))
+#define instr_untyped_param_id(id) ((id) & ~INSTR_SYNTH_TYPE_MASK)
+
+// returns the synth type a param id is tagged with, or -1 if it has no tag
+static inline int instr_param_synth_type(instr_param_id id) {
+    return (int)((id & INSTR_SYNTH_TYPE_MASK) >> INSTR_SYNTH_TYPE_SHIFT) - 1;
+}
+
+// tag an untagged param id of a synth param specific to the current synth
+// type. other ids are returned as-is.
+instr_param_id instr_typed_param_id(const instrument_s *instr,
+                                    instr_param_id id);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,68 @@
+// lock-free ring of log messages, delivered to the host logger on the main
+// thread. any thread may push to it, including the audio thread and the
+// worker threads of the multi plugin, as pushing never blocks, formats a
+// string or calls into the host. messages that do not fit are dropped and
+// counted, and the count is reported on the next flush.
+#ifndef _bpbxclap_log_ring_h_
+#define _bpbxclap_log_ring_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <clap/clap.h>
+
+// messages are stored as an id and their arguments, and only formatted
+// when they are delivered
+typedef enum {
+    // text that was already formatted elsewhere, such as by the synth
+    LOG_MSG_TEXT,
+
+    // bytes in use, peak bytes, reserved bytes and allocation count of the
+    // synth allocator
+    LOG_MSG_SYNTH_MEMORY,
+
+    LOG_MSG_COUNT
+} log_msg_e;
+
+#define LOG_RING_MAX_ARGS 4
+
+// longer text is truncated
+#define LOG_RING_TEXT_SIZE 256
+
+typedef union {
+    int64_t i;
+    uint64_t u;
+    double f;
+} log_arg_u;
+
+typedef struct log_ring log_ring_s;
+
+typedef void (*log_ring_deliver_f)(const clap_host_t *host,
+                                   clap_log_severity severity,
+                                   const char *msg);
+
+log_ring_s* log_ring_new(void);
+void log_ring_free(log_ring_s *ring);
+
+// args holds as many values as the message takes. text is copied and may
+// be NULL. returns false if the ring was full.
+bool log_ring_push(log_ring_s *ring, clap_log_severity severity,
+                   log_msg_e msg, const log_arg_u *args, const char *text);
+
+// push, then ask the host for a main thread callback to flush the ring
+bool log_ring_defer(log_ring_s *ring, const clap_host_t *host,
+                    clap_log_severity severity, log_msg_e msg,
+                    const log_arg_u *args, const char *text);
+
+// format and deliver every pushed message. called from the main thread.
+void log_ring_flush(log_ring_s *ring, const clap_host_t *host,
+                    log_ring_deliver_f deliver);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+// read-only preset banks. a bank is a single file holding any number of
+// presets, which is memory-mapped as a whole and never parsed beyond
+// checking its tables when it is opened.
+//
+// file layout, all integers little-endian:
+//     header:
+//         char magic[8]            "BPBXBANK"
+//         u32 format_version       PRESET_BANK_FORMAT_VER
+//         u32 save_version         state revision of the preset data
+//         u32 preset_count
+//         u32 strings_offset       nul-terminated utf-8 strings
+//         u32 strings_size
+//         u32 reserved
+//     records[preset_count]:
+//         u32 name                 offset into strings
+//         u32 category             offset into strings
+//         u32 data_offset          offset from the start of the file
+//         u32 data_size
+//         u8  synth_type
+//         u8  reserved[7]
+//     u32 by_name[preset_count]      record indices sorted by name
+//     u32 by_category[preset_count]  sorted by category, then by name
+//     u32 by_type[preset_count]      sorted by synth type, then by name
+//
+// preset data is what instr_state_save writes for an instrument. names are
+// compared byte-wise and are unique within a bank, as they are the keys
+// presets are loaded by.
+#ifndef _bpbxclap_preset_bank_h_
+#define _bpbxclap_preset_bank_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cbeepsynth/synth/include/beepbox_synth.h>
+
+#define PRESET_BANK_FORMAT_VER 1
+#define PRESET_BANK_EXTENSION "bpbxbank"
+
+// returned by lookups that found nothing
+#define PRESET_BANK_NONE UINT32_MAX
+
+typedef struct preset_bank preset_bank_s;
+
+typedef struct {
+    const char *name;
+    const char *category; // may be NULL
+    bpbxsyn_synth_type_e type;
+    const void *data;
+    size_t size;
+} preset_bank_entry_s;
+
+typedef struct {
+    const char *name;
+    const char *category;
+    bpbxsyn_synth_type_e type;
+} preset_info_s;
+
+// map the bank at the given utf-8 path. returns NULL if it could not be
+// opened or is malformed.
+preset_bank_s* preset_bank_open(const char *path);
+void preset_bank_close(preset_bank_s *bank);
+
+// banks opened through here stay mapped and are shared until
+// preset_bank_close_all. main thread only.
+preset_bank_s* preset_bank_get(const char *path);
+void preset_bank_close_all(void);
+
+uint32_t preset_bank_count(const preset_bank_s *bank);
+void preset_bank_info(const preset_bank_s *bank, uint32_t index,
+                      preset_info_s *info);
+
+// state data of a preset, pointing into the mapped file
+void preset_bank_data(const preset_bank_s *bank, uint32_t index,
+                      const void **data, size_t *size,
+                      uint32_t *save_version);
+
+// index of the preset with the given name
+uint32_t preset_bank_find(const preset_bank_s *bank, const char *name);
+
+// the i-th preset in category order
+uint32_t preset_bank_by_category(const preset_bank_s *bank, uint32_t i);
+
+// presets of the given synth type are at positions [first, first + count)
+// of the type order
+uint32_t preset_bank_type_range(const preset_bank_s *bank,
+                                bpbxsyn_synth_type_e type, uint32_t *first);
+uint32_t preset_bank_by_type(const preset_bank_s *bank, uint32_t i);
+
+// write a bank holding the given presets, in any order, to the given utf-8
+// path. returns false if two presets share a name, if the bank would not
+// fit in 4 GiB, or if the file could not be written.
+bool preset_bank_write(const char *path, const preset_bank_entry_s *presets,
+                       uint32_t count, uint32_t save_version);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
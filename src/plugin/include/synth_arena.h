@@ -0,0 +1,60 @@
+// per-instance allocator for the bpbxsyn context. small objects, such as
+// synths, effects and envelopes, are carved out of 64 KiB chunks by size
+// class and recycled through free lists. larger blocks, such as delay
+// lines, get an allocation of their own that is released right away when
+// freed. every block is aligned to a cache line.
+//
+// bpbxsyn objects are normally only created and destroyed on the main
+// thread: the audio thread hands what it retires back to the main thread,
+// and the editor asks the main thread to load presets. when the host
+// renders offline, the audio thread creates and destroys them itself
+// instead of waiting for the main thread, so the arena is guarded by a spin
+// lock, which is only contended then. the statistics may be read from any
+// thread.
+#ifndef _bpbxclap_synth_arena_h_
+#define _bpbxclap_synth_arena_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cbeepsynth/synth/include/beepbox_synth.h>
+
+#define SYNTH_ARENA_ALIGNMENT 64
+
+typedef struct synth_arena synth_arena_s;
+
+synth_arena_s* synth_arena_new(void);
+
+// releases every chunk. all blocks must have been freed, and the context
+// using the arena destroyed.
+void synth_arena_free(synth_arena_s *arena);
+
+// allocator for bpbxsyn_context_new
+bpbxsyn_allocator_s synth_arena_allocator(synth_arena_s *arena);
+
+// statistics are only kept when built with PLUGIN_ALLOC_STATS
+#ifdef PLUGIN_ALLOC_STATS
+typedef struct {
+    // bytes of the blocks in use, rounded up to their size class
+    size_t current_bytes;
+    size_t peak_bytes;
+
+    // bytes taken from the system, including unused parts of chunks
+    size_t reserved_bytes;
+
+    // allocations made over the lifetime of the arena
+    uint64_t alloc_count;
+} synth_arena_stats_s;
+
+void synth_arena_get_stats(const synth_arena_s *arena,
+                           synth_arena_stats_s *stats);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
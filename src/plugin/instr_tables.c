@@ -0,0 +1,446 @@
+#include "instr_tables.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static instr_param_layout_s *param_layouts = NULL;
+
+// open addressing hash table of the names of enum param values
+typedef struct {
+    const bpbxsyn_param_info_s *info;
+    const char *name;
+    uint32_t hash;
+    int value;
+} enum_entry_s;
+
+static enum_entry_s *enum_entries = NULL;
+static uint32_t enum_capacity = 0;
+
+static uint64_t param_key(const char str_id[8]) {
+    uint64_t key;
+    memcpy(&key, str_id, sizeof(key));
+    return key;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    const instr_param_key_s *ka = a;
+    const instr_param_key_s *kb = b;
+    if (ka->key != kb->key) return ka->key < kb->key ? -1 : 1;
+    return 0;
+}
+
+static int compare_keys_and_index(const void *a, const void *b) {
+    int cmp = compare_keys(a, b);
+    if (cmp) return cmp;
+
+    const instr_param_key_s *ka = a;
+    const instr_param_key_s *kb = b;
+    return ka->index < kb->index ? -1 : (ka->index > kb->index);
+}
+
+clap_param_info_flags instr_param_clap_flags(const bpbxsyn_param_info_s *info) {
+    clap_param_info_flags flags = CLAP_PARAM_IS_AUTOMATABLE;
+    if (info->type == BPBXSYN_PARAM_UINT8 || info->type == BPBXSYN_PARAM_INT) {
+        flags |= CLAP_PARAM_IS_STEPPED;
+
+        if (info->enum_values) flags |= CLAP_PARAM_IS_ENUM;
+    }
+
+    // ignore this property i suppose ...
+    // if (!info->no_modulation)
+    //    flags |= CLAP_PARAM_IS_AUTOMATABLE;
+
+    return flags;
+}
+
+static uint16_t clamped_strlen(const char *str, size_t buf_size) {
+    size_t len = strlen(str);
+    return (uint16_t)(len < buf_size ? len : buf_size - 1);
+}
+
+static void build_clap_param(instr_clap_param_s *clap,
+                             const bpbxsyn_param_info_s *info, bool inactive)
+{
+    if (!info) {
+        *clap = (instr_clap_param_s) {
+            .name = "-",
+            .module = "",
+            .name_len = 1,
+            .module_len = 0,
+            .flags = CLAP_PARAM_IS_HIDDEN,
+            .min_value = 0.0,
+            .max_value = 1.0,
+            .default_value = 0.0
+        };
+        return;
+    }
+
+    const char *module_name = info->group ? info->group : "";
+
+    *clap = (instr_clap_param_s) {
+        .name = info->name,
+        .module = module_name,
+        .name_len = clamped_strlen(info->name, CLAP_NAME_SIZE),
+        .module_len = clamped_strlen(module_name, CLAP_PATH_SIZE),
+        .flags = instr_param_clap_flags(info),
+        .min_value = info->min_value,
+        .max_value = info->max_value,
+        .default_value = info->default_value
+    };
+
+    // only the hidden flag differs between layouts, which lets the host be
+    // notified of a synth type change with CLAP_PARAM_RESCAN_INFO
+    if (inactive)
+        clap->flags |= CLAP_PARAM_IS_HIDDEN;
+}
+
+void instr_param_clap_info(const instr_param_slot_s *slot,
+                           clap_param_info_t *param_info)
+{
+    const instr_clap_param_s *clap = &slot->clap;
+
+    param_info->cookie = NULL;
+    param_info->flags = clap->flags;
+    param_info->min_value = clap->min_value;
+    param_info->max_value = clap->max_value;
+    param_info->default_value = clap->default_value;
+
+    // the host does not need the rest of the buffers to be cleared
+    memcpy(param_info->name, clap->name, clap->name_len);
+    param_info->name[clap->name_len] = '\0';
+    memcpy(param_info->module, clap->module, clap->module_len);
+    param_info->module[clap->module_len] = '\0';
+}
+
+// also fills in the param info of the layout
+static void build_param_keys(instr_param_layout_s *layout,
+                             bpbxsyn_synth_type_e type)
+{
+    layout->key_count = 0;
+
+    for (uint32_t i = 0; i < layout->count; ++i) {
+        instr_param_id id = layout->params[i].id;
+        const bpbxsyn_param_info_s *info = instr_type_param_info(type, id);
+        assert(info);
+        layout->params[i].info = info;
+        build_clap_param(&layout->params[i].clap, info,
+                         layout->params[i].inactive);
+
+        // inactive slots all share the same placeholder id and are never
+        // saved
+        if (!info || layout->params[i].inactive) continue;
+
+        // only modulation of the whole instrument is supported, as synth
+        // params are not per voice
+        if (instr_param_is_modulatable(id, info))
+            layout->params[i].clap.flags |= CLAP_PARAM_IS_MODULATABLE;
+
+        layout->keys[layout->key_count++] = (instr_param_key_s) {
+            .key = param_key(info->id),
+            .id = id,
+            .info = info,
+            .index = i
+        };
+    }
+
+    qsort(layout->keys, layout->key_count, sizeof(*layout->keys),
+          compare_keys_and_index);
+
+    // string ids should be unique. if they are not, keep the param that
+    // comes first in the layout.
+    uint32_t unique_count = 0;
+    for (uint32_t i = 0; i < layout->key_count; ++i) {
+        if (unique_count > 0 &&
+            layout->keys[unique_count - 1].key == layout->keys[i].key)
+            continue;
+
+        layout->keys[unique_count++] = layout->keys[i];
+    }
+
+    layout->key_count = unique_count;
+}
+
+typedef struct {
+    instr_param_id id;
+    uint16_t index;
+} id_index_pair_s;
+
+static int compare_id_pairs(const void *a, const void *b) {
+    const instr_param_id ia = ((const id_index_pair_s *)a)->id;
+    const instr_param_id ib = ((const id_index_pair_s *)b)->id;
+    return ia < ib ? -1 : (ia > ib);
+}
+
+static void build_id_order(instr_param_layout_s *layout) {
+    id_index_pair_s pairs[INSTR_PARAM_COUNT];
+    for (uint32_t i = 0; i < layout->count; ++i) {
+        pairs[i] = (id_index_pair_s) {
+            .id = layout->params[i].id,
+            .index = (uint16_t)i
+        };
+    }
+
+    qsort(pairs, layout->count, sizeof(*pairs), compare_id_pairs);
+
+    for (uint32_t i = 0; i < layout->count; ++i) {
+        layout->id_order[i] = pairs[i].index;
+    }
+}
+
+uint32_t instr_param_index(const instr_param_layout_s *layout,
+                           instr_param_id id)
+{
+    uint32_t lo = 0;
+    uint32_t hi = layout->count;
+
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        const uint16_t index = layout->id_order[mid];
+        const instr_param_id mid_id = layout->params[index].id;
+
+        if (mid_id == id) return index;
+        if (mid_id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+static void build_param_layout(instr_param_layout_s *layout,
+                               bpbxsyn_synth_type_e type)
+{
+    uint32_t index = 0;
+
+    #define push_id(param_id, is_inactive)                                     \
+        assert(index < INSTR_PARAM_COUNT);                                     \
+        layout->params[index++] = (instr_param_slot_s) {                       \
+            .id = (param_id),                                                  \
+            .inactive = (is_inactive)                                          \
+        }
+
+    #define push(module, pindex, is_inactive)                                  \
+        push_id(instr_global_id((module), (pindex)), (is_inactive))
+
+    #define push_range(module, start, count)                                   \
+        for (uint32_t i = 0; i < (uint32_t)(count); ++i) {                     \
+            push((module), (start) + i, false);                                \
+        }
+
+    // control parameters
+    push_range(INSTR_MODULE_CONTROL, 0, INSTR_CPARAM_ENABLE_DISTORTION);
+
+    // volume and panning
+    push_range(INSTR_MODULE_VOLUME, 0, BPBXSYN_VOLUME_PARAM_COUNT);
+    push_range(INSTR_MODULE_PANNING, 0, BPBXSYN_PANNING_PARAM_COUNT);
+
+    // synth general parameters
+    const uint32_t note_effect_start = BPBXSYN_PARAM_ENABLE_TRANSITION_TYPE;
+    push_range(INSTR_MODULE_SYNTH, 0, note_effect_start);
+
+    // synth params of every synth type, so that the params do not change
+    // when switching between them. params of other types are marked as
+    // inactive.
+    for (int t = 0; t < BPBXSYN_SYNTH_COUNT; ++t) {
+        const bpbxsyn_synth_type_e param_type = instr_synth_type_values[t];
+        if (param_type == -1) continue;
+
+        const uint32_t synth_param_count =
+            bpbxsyn_synth_param_count(param_type) - BPBXSYN_BASE_PARAM_COUNT;
+
+        for (uint32_t i = 0; i < synth_param_count; ++i) {
+            push_id(instr_typed_synth_param(param_type,
+                                            BPBXSYN_BASE_PARAM_COUNT + i),
+                    param_type != type);
+        }
+    }
+
+    // synth note effect parameters
+    push_range(INSTR_MODULE_SYNTH, note_effect_start,
+               BPBXSYN_BASE_PARAM_COUNT - note_effect_start);
+
+    // eq
+    push_range(INSTR_MODULE_EQ, 0, BPBXSYN_EQ_PARAM_COUNT);
+
+    // distortion
+    push(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_DISTORTION, false);
+    push_range(INSTR_MODULE_DISTORTION, 0, BPBXSYN_DISTORTION_PARAM_COUNT);
+
+    // bitcrusher
+    push(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_BITCRUSHER, false);
+    push_range(INSTR_MODULE_BITCRUSHER, 0, BPBXSYN_BITCRUSHER_PARAM_COUNT);
+
+    // chorus
+    push(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_CHORUS, false);
+    push_range(INSTR_MODULE_CHORUS, 0, BPBXSYN_CHORUS_PARAM_COUNT);
+
+    // echo
+    push(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_ECHO, false);
+    push_range(INSTR_MODULE_ECHO, 0, BPBXSYN_ECHO_PARAM_COUNT);
+
+    // reverb
+    push(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_REVERB, false);
+    push_range(INSTR_MODULE_REVERB, 0, BPBXSYN_REVERB_PARAM_COUNT);
+
+    #undef push_range
+    #undef push
+    #undef push_id
+
+    assert(index <= INSTR_PARAM_COUNT);
+    layout->count = index;
+
+    build_param_keys(layout, type);
+    build_id_order(layout);
+}
+
+// fnv-1a
+static uint32_t hash_string(const char *str) {
+    uint32_t hash = 2166136261u;
+    for (; *str; ++str) {
+        hash ^= (uint8_t)*str;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static uint32_t enum_slot(const bpbxsyn_param_info_s *info, uint32_t hash) {
+    // mix in the param, as params often share value names
+    uint32_t h = hash ^ (uint32_t)((uintptr_t)info >> 4) * 2654435761u;
+    return h & (enum_capacity - 1);
+}
+
+static void insert_enum_values(const bpbxsyn_param_info_s *info) {
+    if (!info || !info->enum_values) return;
+
+    const int end_value = (int)info->max_value;
+    for (int v = (int)info->min_value; v <= end_value; ++v) {
+        const char *name = info->enum_values[v];
+        const uint32_t hash = hash_string(name);
+
+        uint32_t slot = enum_slot(info, hash);
+        for (;;) {
+            enum_entry_s *entry = &enum_entries[slot];
+            if (!entry->info) {
+                *entry = (enum_entry_s) {
+                    .info = info,
+                    .name = name,
+                    .hash = hash,
+                    .value = v
+                };
+                break;
+            }
+
+            // param was already inserted through another layout, or two
+            // values share a name, in which case the first one wins
+            if (entry->info == info && entry->hash == hash &&
+                !strcmp(entry->name, name))
+                break;
+
+            slot = (slot + 1) & (enum_capacity - 1);
+        }
+    }
+}
+
+static bool build_enum_table(void) {
+    // upper bound of the entry count. params shared between synth types
+    // are counted once per type.
+    uint32_t value_count = 0;
+    for (int t = 0; t < BPBXSYN_SYNTH_COUNT; ++t) {
+        const instr_param_layout_s *layout = &param_layouts[t];
+        for (uint32_t i = 0; i < layout->count; ++i) {
+            const bpbxsyn_param_info_s *info = layout->params[i].info;
+            if (info && info->enum_values && !layout->params[i].inactive)
+                value_count += (uint32_t)(info->max_value - info->min_value) + 1;
+        }
+    }
+
+    // keep the load factor at or below one half
+    enum_capacity = 16;
+    while (enum_capacity < value_count * 2)
+        enum_capacity *= 2;
+
+    enum_entries = calloc(enum_capacity, sizeof(*enum_entries));
+    if (!enum_entries) return false;
+
+    for (int t = 0; t < BPBXSYN_SYNTH_COUNT; ++t) {
+        const instr_param_layout_s *layout = &param_layouts[t];
+        for (uint32_t i = 0; i < layout->count; ++i) {
+            if (!layout->params[i].inactive)
+                insert_enum_values(layout->params[i].info);
+        }
+    }
+
+    return true;
+}
+
+bool instr_param_enum_value(const bpbxsyn_param_info_s *info,
+                            const char *text, int *out_value)
+{
+    assert(enum_entries);
+    if (!enum_entries) return false;
+
+    const uint32_t hash = hash_string(text);
+    uint32_t slot = enum_slot(info, hash);
+
+    for (;;) {
+        const enum_entry_s *entry = &enum_entries[slot];
+        if (!entry->info) return false;
+
+        if (entry->info == info && entry->hash == hash &&
+            !strcmp(entry->name, text))
+        {
+            *out_value = entry->value;
+            return true;
+        }
+
+        slot = (slot + 1) & (enum_capacity - 1);
+    }
+}
+
+bool instr_tables_init(void) {
+    assert(!param_layouts);
+
+    // synth types must fit into the type tag of param ids
+    assert(BPBXSYN_SYNTH_COUNT < 0xF);
+
+    param_layouts = malloc(sizeof(*param_layouts) * BPBXSYN_SYNTH_COUNT);
+    if (!param_layouts) return false;
+
+    for (int i = 0; i < BPBXSYN_SYNTH_COUNT; ++i) {
+        build_param_layout(&param_layouts[i], (bpbxsyn_synth_type_e)i);
+    }
+
+    if (!build_enum_table()) {
+        instr_tables_deinit();
+        return false;
+    }
+
+    return true;
+}
+
+void instr_tables_deinit(void) {
+    free(enum_entries);
+    enum_entries = NULL;
+    enum_capacity = 0;
+
+    free(param_layouts);
+    param_layouts = NULL;
+}
+
+const instr_param_layout_s* instr_param_layout(bpbxsyn_synth_type_e type) {
+    assert(type >= 0 && type < BPBXSYN_SYNTH_COUNT);
+    if (!param_layouts) return NULL;
+    return &param_layouts[type];
+}
+
+const instr_param_key_s* instr_param_find(const instr_param_layout_s *layout,
+                                          const char str_id[8])
+{
+    const instr_param_key_s key = { .key = param_key(str_id) };
+    return bsearch(&key, layout->keys, layout->key_count,
+                   sizeof(*layout->keys), compare_keys);
+}
@@ -0,0 +1,90 @@
+// process-wide param layout and id lookup tables, shared by every plugin
+// instance. built by plugin_static_init and released by
+// plugin_static_deinit. the dsp tables of the synths are owned by cbeepsynth.
+#ifndef _bpbxclap_instr_tables_h_
+#define _bpbxclap_instr_tables_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "include/instrument.h"
+#include "instrument_impl.h"
+
+// clap param info prepared ahead of time. strings point into the synth
+// param info, and their lengths are clamped to the clap buffer sizes.
+typedef struct {
+    const char *name;
+    const char *module;
+    uint16_t name_len;
+    uint16_t module_len;
+
+    clap_param_info_flags flags;
+    double min_value;
+    double max_value;
+    double default_value;
+} instr_clap_param_s;
+
+typedef struct {
+    instr_param_id id;
+    const bpbxsyn_param_info_s *info;
+    instr_clap_param_s clap;
+
+    // param slot is not used by the synth type of this layout
+    bool inactive;
+} instr_param_slot_s;
+
+// entry of the string id index. key is the 8-byte string id of the param
+// read as an integer.
+typedef struct {
+    uint64_t key;
+    instr_param_id id;
+    const bpbxsyn_param_info_s *info;
+
+    // host-facing index of the param
+    uint32_t index;
+} instr_param_key_s;
+
+// mapping of host-facing parameter indices to parameter ids for a given
+// synth type.
+typedef struct {
+    uint32_t count;
+    instr_param_slot_s params[INSTR_PARAM_COUNT];
+
+    // active params sorted by key, for looking up saved params
+    uint32_t key_count;
+    instr_param_key_s keys[INSTR_PARAM_COUNT];
+
+    // param indices sorted by param id
+    uint16_t id_order[INSTR_PARAM_COUNT];
+} instr_param_layout_s;
+
+// called by plugin_static_init/plugin_static_deinit, which do the reference
+// counting. not thread-safe.
+bool instr_tables_init(void);
+void instr_tables_deinit(void);
+
+// returns NULL if the tables were not initialized
+const instr_param_layout_s* instr_param_layout(bpbxsyn_synth_type_e type);
+
+// fill in the clap info of a param of a layout. the id is left to the
+// caller, as it may differ from the instrument param id.
+void instr_param_clap_info(const instr_param_slot_s *slot,
+                           clap_param_info_t *param_info);
+
+// flags of the clap info of a synth param
+clap_param_info_flags instr_param_clap_flags(const bpbxsyn_param_info_s *info);
+
+// find the value of an enum param with the given name. returns false if
+// the param has no such value.
+bool instr_param_enum_value(const bpbxsyn_param_info_s *info,
+                            const char *text, int *out_value);
+
+// find the index of the param with the given id. returns UINT32_MAX if
+// there is none.
+uint32_t instr_param_index(const instr_param_layout_s *layout,
+                           instr_param_id id);
+
+// find the param with the given string id. returns NULL if there is none.
+const instr_param_key_s* instr_param_find(const instr_param_layout_s *layout,
+                                          const char str_id[8]);
+
+#endif
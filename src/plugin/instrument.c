@@ -1,8 +1,10 @@
 #include "include/instrument.h"
 #include "instrument_impl.h"
+#include "instr_tables.h"
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 typedef struct {
@@ -55,6 +57,47 @@ static inline bool is_effect(instr_module_e module) {
 static const bpbxsyn_param_info_s control_param_info[INSTR_CPARAM_COUNT];
 static const bpbxsyn_param_info_s unused_param_info;
 
+static const uint32_t lazy_effect_param_counts[INSTR_LAZY_EFFECT_COUNT] = {
+    BPBXSYN_DISTORTION_PARAM_COUNT,
+    BPBXSYN_BITCRUSHER_PARAM_COUNT,
+    BPBXSYN_CHORUS_PARAM_COUNT,
+    BPBXSYN_ECHO_PARAM_COUNT,
+    BPBXSYN_REVERB_PARAM_COUNT,
+};
+
+static inline bool is_lazy_effect(bpbxsyn_effect_type_e type) {
+    return    type >= INSTR_LAZY_EFFECT_FIRST
+           && type < INSTR_LAZY_EFFECT_FIRST + INSTR_LAZY_EFFECT_COUNT;
+}
+
+static inline instr_lazy_effect_s* lazy_effect(instrument_s *instr,
+                                               bpbxsyn_effect_type_e type)
+{
+    assert(is_lazy_effect(type));
+    return &instr->lazy_fx[type - INSTR_LAZY_EFFECT_FIRST];
+}
+
+static void apply_param_mods(instrument_s *instr);
+static void set_mod_base(instrument_s *instr, instr_param_id id,
+                         double value);
+static void rebase_synth_mods(instrument_s *instr, bool reload_base);
+static void mark_snapshot_param(instrument_s *instr, instr_param_id id);
+static void mark_snapshot_all(instrument_s *instr);
+static void stage_shadow(instrument_s *instr, const instr_shadow_s *shadow);
+
+static bool is_effect_used(const instrument_s *instr,
+                           bpbxsyn_effect_type_e type)
+{
+    switch (type) {
+        case BPBXSYN_EFFECT_DISTORTION: return instr->use_distortion;
+        case BPBXSYN_EFFECT_BITCRUSHER: return instr->use_bitcrusher;
+        case BPBXSYN_EFFECT_CHORUS:     return instr->use_chorus;
+        case BPBXSYN_EFFECT_ECHO:       return instr->use_echo;
+        case BPBXSYN_EFFECT_REVERB:     return instr->use_reverb;
+        default:                        return true;
+    }
+}
+
 
 
 
@@ -91,7 +134,9 @@ bpbxsyn_synth_s* instr_get_synth(const instrument_s *instr) {
     return instr->synth;
 }
 
-bool instr_init(instrument_s *instr, bpbxsyn_context_s *ctx, bpbxsyn_synth_type_e type) {
+bool instr_init(instrument_s *instr, bpbxsyn_context_s *ctx,
+                bpbxsyn_synth_type_e type, uint32_t flags)
+{
     // calculate type index. type index uses different values than the values
     // for the type enums.
     int type_idx = instr_synth_type_index(type);
@@ -110,50 +155,204 @@ bool instr_init(instrument_s *instr, bpbxsyn_context_s *ctx, bpbxsyn_synth_type_
         .type = type,
         .type_index = (uint8_t)type_idx,
         .new_type_index = (uint8_t)type_idx,
+        .ctx = ctx,
         .bpm = 150.0,
         .tempo_multiplier = 1.0,
         .tempo_override = 150.0,
         .tempo_use_override = false,
+        .init_flags = flags,
     };
 
     instr->synth = bpbxsyn_synth_new(ctx, type);
     if (!instr->synth) return false;
 
+    instr->snapshots = calloc(INSTR_SNAPSHOT_SLOTS, sizeof(instr_snapshot_s));
+    if (!instr->snapshots) return false;
+
+    instr->staged_snapshot = calloc(1, sizeof(instr_snapshot_s));
+    if (!instr->staged_snapshot) return false;
+
     instr->fx.fader = bpbxsyn_effect_new(ctx, BPBXSYN_EFFECT_VOLUME);
     if (!instr->fx.fader) return false;
 
     instr->fx.panning = bpbxsyn_effect_new(ctx, BPBXSYN_EFFECT_PANNING);
     if (!instr->fx.panning) return false;
 
-    instr->fx.distortion = bpbxsyn_effect_new(ctx, BPBXSYN_EFFECT_DISTORTION);
-    if (!instr->fx.distortion) return false;
-
-    instr->fx.bitcrusher = bpbxsyn_effect_new(ctx, BPBXSYN_EFFECT_BITCRUSHER);
-    if (!instr->fx.bitcrusher) return false;
-
     instr->fx.eq = bpbxsyn_effect_new(ctx, BPBXSYN_EFFECT_EQ);
     if (!instr->fx.eq) return false;
 
-    instr->fx.chorus = bpbxsyn_effect_new(ctx, BPBXSYN_EFFECT_CHORUS);
-    if (!instr->fx.chorus) return false;
+    // the other effects are created once they are enabled, so they only
+    // hold their params for now
+    for (int i = 0; i < INSTR_LAZY_EFFECT_COUNT; ++i) {
+        const bpbxsyn_effect_type_e fx_type = INSTR_LAZY_EFFECT_FIRST + i;
+        for (uint32_t j = 0; j < lazy_effect_param_counts[i]; ++j) {
+            const bpbxsyn_param_info_s *info =
+                bpbxsyn_effect_param_info(fx_type, j);
+            instr->lazy_fx[i].params[j] = info ? info->default_value : 0.0;
+        }
+    }
+
+    mark_snapshot_all(instr);
+    instr_publish_snapshot(instr);
+    return true;
+}
+
+static bool set_effect_param(bpbxsyn_effect_s *effect, instr_param_id idx,
+                             const bpbxsyn_param_info_s *info, double *value)
+{
+    switch (info->type) {
+        case BPBXSYN_PARAM_DOUBLE:
+            return !bpbxsyn_effect_set_param_double(effect, idx, *value);
+        
+        case BPBXSYN_PARAM_INT:
+        case BPBXSYN_PARAM_UINT8:
+            *value = round(*value);
+            return !bpbxsyn_effect_set_param_int(effect, idx, (int)*value);
+    }
+
+    return false;
+}
 
-    instr->fx.echo = bpbxsyn_effect_new(ctx, BPBXSYN_EFFECT_ECHO);
-    if (!instr->fx.echo) return false;
+// create the module of a lazy effect. its params are written by whoever
+// ends up owning it.
+static bpbxsyn_effect_s* new_lazy_effect(instrument_s *instr,
+                                         bpbxsyn_effect_type_e type)
+{
+    bpbxsyn_effect_s *effect = bpbxsyn_effect_new(instr->ctx, type);
+    if (effect && instr->sample_rate > 0.0)
+        bpbxsyn_effect_set_sample_rate(effect, instr->sample_rate);
 
-    instr->fx.reverb = bpbxsyn_effect_new(ctx, BPBXSYN_EFFECT_REVERB);
-    if (!instr->fx.reverb) return false;
+    return effect;
+}
 
-    return true;
+static void restore_lazy_params(instrument_s *instr,
+                                bpbxsyn_effect_type_e type,
+                                bpbxsyn_effect_s *effect)
+{
+    instr_lazy_effect_s *lazy = lazy_effect(instr, type);
+
+    for (uint32_t i = 0;
+         i < lazy_effect_param_counts[type - INSTR_LAZY_EFFECT_FIRST]; ++i)
+    {
+        const bpbxsyn_param_info_s *info = bpbxsyn_effect_param_info(type, i);
+        double value = lazy->params[i];
+        if (info)
+            set_effect_param(effect, i, info, &value);
+    }
+}
+
+static inline bool is_offline(const instrument_s *instr) {
+    return atomic_load(&instr->render_offline);
+}
+
+// hand a module to the main thread to be destroyed. returns false if the
+// main queue is full.
+static bool retire_lazy_effect(instrument_s *instr, bpbxsyn_effect_s *effect) {
+    if (is_offline(instr)) {
+        bpbxsyn_effect_destroy(effect);
+        return true;
+    }
+
+    return main_queue_defer_effect_destroy(instr->main_queue, instr->clap_host,
+                                           effect);
+}
+
+// start the waiting module of an enabled effect. if there is none yet, the
+// main thread is asked for one and it is picked up by a later call. when
+// rendering offline, it is created right away.
+static void take_lazy_effect(instrument_s *instr, bpbxsyn_effect_type_e type) {
+    instr_lazy_effect_s *lazy = lazy_effect(instr, type);
+    bpbxsyn_effect_s **module = &instr->effect_modules[type];
+
+    // starts running on the next tick
+    *module = atomic_exchange_ptr(&lazy->ready, NULL);
+    if (!*module && is_offline(instr))
+        *module = new_lazy_effect(instr, type);
+
+    if (*module) {
+        restore_lazy_params(instr, type, *module);
+        return;
+    }
+
+    if (!atomic_exchange(&lazy->requested, true))
+        instr->clap_host->request_callback(instr->clap_host);
+}
+
+// called from the audio thread. starts modules of enabled effects that were
+// not ready when they were enabled, and puts the modules of disabled
+// effects back to wait in ready.
+static void update_lazy_effects(instrument_s *instr) {
+    for (int i = 0; i < INSTR_LAZY_EFFECT_COUNT; ++i) {
+        const bpbxsyn_effect_type_e type = INSTR_LAZY_EFFECT_FIRST + i;
+        instr_lazy_effect_s *lazy = &instr->lazy_fx[i];
+        bpbxsyn_effect_s **module = &instr->effect_modules[type];
+
+        if (is_effect_used(instr, type)) {
+            if (!*module && atomic_load(&lazy->ready))
+                take_lazy_effect(instr, type);
+            continue;
+        }
+
+        if (!*module) continue;
+
+        // the main thread may have filled ready in the meantime, in which
+        // case the spare module is destroyed there
+        if (!atomic_load(&lazy->ready)) {
+            atomic_store(&lazy->ready, *module);
+            *module = NULL;
+        } else if (retire_lazy_effect(instr, *module)) {
+            *module = NULL;
+        }
+    }
+}
+
+// destroy the lazy effect modules that are in flight between threads, as
+// well as the ones of disabled effects. called from the main thread while
+// the audio thread is not processing.
+static void drop_lazy_effects(instrument_s *instr) {
+    for (int i = 0; i < INSTR_LAZY_EFFECT_COUNT; ++i) {
+        const bpbxsyn_effect_type_e type = INSTR_LAZY_EFFECT_FIRST + i;
+        instr_lazy_effect_s *lazy = &instr->lazy_fx[i];
+
+        atomic_store(&lazy->requested, false);
+
+        bpbxsyn_effect_s *ready = atomic_exchange_ptr(&lazy->ready, NULL);
+        if (ready)
+            bpbxsyn_effect_destroy(ready);
+
+        if (instr->effect_modules[type] && !is_effect_used(instr, type)) {
+            bpbxsyn_effect_destroy(instr->effect_modules[type]);
+            instr->effect_modules[type] = NULL;
+        }
+    }
 }
 
 void instr_destroy(instrument_s *instr) {
     // caller should have called this before, but do it again just in case.
     instr_deactivate(instr);
 
-    bpbxsyn_synth_destroy(instr->synth);
+    if (instr->synth)
+        bpbxsyn_synth_destroy(instr->synth);
+
     for (int i = 0; i < INSTR_EFFECT_MODULE_COUNT; ++i) {
-        bpbxsyn_effect_destroy(instr->effect_modules[i]);
+        if (instr->effect_modules[i])
+            bpbxsyn_effect_destroy(instr->effect_modules[i]);
     }
+
+    free(instr->snapshots);
+    free(instr->staged_snapshot);
+}
+
+bool instr_has_module(const instrument_s *instr, instr_module_e module) {
+    if (module == INSTR_MODULE_ECHO || module == INSTR_MODULE_REVERB)
+        return !(instr->init_flags & INSTR_INIT_NO_SEND_EFFECTS);
+
+    // lazy effects may not have a module yet
+    if (is_effect(module) &&
+        !is_lazy_effect(module - INSTR_FIRST_EFFECT_MODULE))
+        return instr->effect_modules[module - INSTR_FIRST_EFFECT_MODULE] != NULL;
+
+    return module < INSTR_MODULE_COUNT;
 }
 
 bool copy_synth_config(const bpbxsyn_synth_s *src, bpbxsyn_synth_s *dst) {
@@ -214,21 +413,11 @@ bool copy_synth_config(const bpbxsyn_synth_s *src, bpbxsyn_synth_s *dst) {
     return true;
 }
 
-void instr_on_main_thread(instrument_s *instr) {
-    assert(instr->clap_host);
-    assert(instr->clap_host_params);
-
-    if (atomic_exchange(&instr->need_param_rescan, false)) {
-        if (instr->clap_host_params)
-            instr->clap_host_params->rescan(instr->clap_host,
-                                            CLAP_PARAM_RESCAN_ALL);
-    }
-}
-
 bool instr_activate(instrument_s *instr, bpbxsyn_context_s *ctx,
                     double sample_rate, uint32_t max_frames_count) {
     assert(instr->clap_host);
     assert(instr->clap_host_params);
+    assert(instr->main_queue);
 
     // load new instrument type when requested
     if (instr->new_type_index != instr->type_index && instr->synth) {
@@ -253,9 +442,14 @@ bool instr_activate(instrument_s *instr, bpbxsyn_context_s *ctx,
         
         bpbxsyn_synth_destroy(instr->synth);
         instr->synth = new_synth;
-
-        atomic_store(&instr->need_param_rescan, true);
-        instr->clap_host->request_callback(instr->clap_host);
+        rebase_synth_mods(instr, false);
+        mark_snapshot_all(instr);
+
+        // params keep their ids across synth types, and only their hidden
+        // flags and values change
+        main_queue_defer_rescan(instr->main_queue, instr->clap_host,
+                                CLAP_PARAM_RESCAN_INFO |
+                                CLAP_PARAM_RESCAN_VALUES);
         
         instr->frames_until_next_tick = 0;
     }
@@ -269,18 +463,167 @@ bool instr_activate(instrument_s *instr, bpbxsyn_context_s *ctx,
             bpbxsyn_effect_set_sample_rate(instr->effect_modules[i], sample_rate);
     }
 
+    // effects that are enabled already get their module now. the others
+    // get one that waits until they are enabled while active.
+    for (int i = 0; i < INSTR_LAZY_EFFECT_COUNT; ++i) {
+        const bpbxsyn_effect_type_e type = INSTR_LAZY_EFFECT_FIRST + i;
+        bpbxsyn_effect_s **module = &instr->effect_modules[type];
+        if (!instr_has_module(instr, INSTR_FIRST_EFFECT_MODULE + type))
+            continue;
+
+        if (!*module) {
+            *module = new_lazy_effect(instr, type);
+            if (!*module) return false;
+            restore_lazy_params(instr, type, *module);
+        }
+
+        if (!is_effect_used(instr, type)) {
+            atomic_store(&instr->lazy_fx[i].ready, *module);
+            *module = NULL;
+        }
+    }
+
     // allocate process blocks
+    free(instr->synth_mono_buffer);
     instr->synth_mono_buffer = malloc(max_frames_count * sizeof(float));
+    if (!instr->synth_mono_buffer) return false;
+
     for (int i = 0; i < 2; ++i) {
         free(instr->process_block[i]);
         instr->process_block[i] = malloc(max_frames_count * sizeof(float));
         if (!instr->process_block[i]) return false;
     }
 
+    // output of the old synth while crossfading to a new synth type
+    free(instr->fade_buffer);
+    instr->fade_buffer = malloc(max_frames_count * sizeof(float));
+    if (!instr->fade_buffer) return false;
+
+    instr->fade_frames =
+        (uint32_t)(sample_rate * INSTR_SYNTH_SWAP_FADE_MS / 1000.0);
+    if (instr->fade_frames == 0) instr->fade_frames = 1;
+
+    instr_publish_snapshot(instr);
+
+    instr->is_active = true;
     return true;
 }
 
+// destroy every synth involved in an unfinished synth type change. called
+// from the main thread while the audio thread is not processing.
+static void drop_swap_synths(instrument_s *instr) {
+    atomic_store(&instr->swap_requested, false);
+    atomic_store(&instr->synth_swapped, false);
+
+    bpbxsyn_synth_s *synths[3] = {
+        atomic_exchange_ptr(&instr->ready_synth, NULL),
+        instr->fade_synth,
+        instr->retire_synth
+    };
+
+    for (int i = 0; i < 3; ++i) {
+        if (synths[i])
+            bpbxsyn_synth_destroy(synths[i]);
+    }
+
+    instr->fade_synth = NULL;
+    instr->retire_synth = NULL;
+}
+
+// create the synth of a pending synth type change and hand it to the audio
+// thread through ready_synth
+static void make_ready_synth(instrument_s *instr) {
+    // the type may change again before the audio thread picks up the new
+    // synth. it checks the type of the synth before swapping.
+    const bpbxsyn_synth_type_e new_type =
+        instr_synth_type_values[instr->new_type_index];
+
+    bpbxsyn_synth_s *new_synth = NULL;
+    if (new_type != instr->type) {
+        new_synth = bpbxsyn_synth_new(instr->ctx, new_type);
+        if (new_synth)
+            bpbxsyn_synth_set_sample_rate(new_synth, instr->sample_rate);
+    }
+
+    bpbxsyn_synth_s *stale = atomic_exchange_ptr(&instr->ready_synth, new_synth);
+    if (stale)
+        bpbxsyn_synth_destroy(stale);
+}
+
+// ask for the synth of a new synth type while active. it is swapped in by
+// instr_process. when rendering offline, it is created right away instead
+// of by the main thread.
+static void request_synth(instrument_s *instr) {
+    if (is_offline(instr)) {
+        make_ready_synth(instr);
+        return;
+    }
+
+    atomic_store(&instr->swap_requested, true);
+    instr->clap_host->request_callback(instr->clap_host);
+}
+
+bool instr_is_swapping_synth(const instrument_s *instr) {
+    return instr->fade_synth != NULL;
+}
+
+clap_param_rescan_flags instr_on_main_thread(instrument_s *instr) {
+    clap_param_rescan_flags rescan_flags = 0;
+
+    // the loaded state is in the snapshots now
+    if (atomic_load(&instr->staged) &&
+        atomic_load(&instr->applied_generation) == instr->staged_generation)
+    {
+        atomic_store(&instr->staged, false);
+    }
+
+    // params of the new type are now shown and those of the old one hidden
+    if (atomic_exchange(&instr->synth_swapped, false))
+        rescan_flags |= CLAP_PARAM_RESCAN_INFO | CLAP_PARAM_RESCAN_VALUES;
+
+    for (int i = 0; i < INSTR_LAZY_EFFECT_COUNT; ++i) {
+        instr_lazy_effect_s *lazy = &instr->lazy_fx[i];
+
+        // the audio thread writes the params once it starts the module
+        if (atomic_exchange(&lazy->requested, false) &&
+            !atomic_load(&lazy->ready))
+        {
+            atomic_store(&lazy->ready,
+                         new_lazy_effect(instr, INSTR_LAZY_EFFECT_FIRST + i));
+        }
+    }
+
+    if (atomic_exchange(&instr->swap_requested, false))
+        make_ready_synth(instr);
+
+    return rescan_flags;
+}
+
+void instr_set_render_mode(instrument_s *instr, bool offline) {
+    atomic_store(&instr->render_offline, offline);
+}
+
+void instr_stop_processing(instrument_s *instr) {
+    if (instr->is_active)
+        update_lazy_effects(instr);
+}
+
 bool instr_deactivate(instrument_s *instr) {
+    instr->is_active = false;
+    drop_swap_synths(instr);
+    drop_lazy_effects(instr);
+
+    instr_shadow_free(instr->retire_shadow);
+    instr->retire_shadow = NULL;
+
+    // state that was loaded but not picked up by the audio thread
+    instr_shadow_s *pending = atomic_exchange_ptr(&instr->pending_shadow, NULL);
+    if (pending)
+        instr_publish_shadow(instr, pending);
+
+    free(instr->fade_buffer);
+    instr->fade_buffer = NULL;
+
     // free process blocks
     free(instr->synth_mono_buffer);
     instr->synth_mono_buffer = NULL;
@@ -294,17 +637,161 @@ bool instr_deactivate(instrument_s *instr) {
     return true;
 }
 
-void instr_process(instrument_s *instr, float **output, uint32_t frame_count,
-                   uint32_t start_frame, const clap_output_events_t *out_events)
+// end the voices of the old synth when swapping synths. the old synth keeps
+// running while it is faded out.
+static void end_all_voices(instrument_s *instr, uint32_t time,
+                           const clap_output_events_t *out_events)
 {
-    inst_process_userdata_s inst_proc = {
-        .instr = instr,
-        .cur_sample = start_frame,
-        .out_events = out_events
-    };
-    bpbxsyn_synth_set_userdata(instr->synth, &inst_proc);
+    for (int i = 0; i < BPBXSYN_SYNTH_MAX_VOICES; ++i) {
+        voice_s *voice = &instr->voices[i];
+        if (!voice->active) continue;
+
+        clap_event_note_t ev = {
+            .header = {
+                .size = sizeof(ev),
+                .time = time,
+                .type = CLAP_EVENT_NOTE_END,
+            },
+            .note_id = voice->note_id,
+            .port_index = voice->port_index,
+            .channel = voice->channel,
+            .key = voice->key
+        };
+
+        out_events->try_push(out_events, (clap_event_header_t*) &ev);
+        voice->active = false;
+    }
 
-    instr->linear_gain = pow(10.0, instr->gain / 10.0);
+    instr->active_voice_count = 0;
+}
+
+static void free_shadow(void *shadow) {
+    instr_shadow_free(shadow);
+}
+
+// hand a retired synth and shadow back to the main thread, or keep them
+// around until the main queue has room. when rendering offline, they are
+// destroyed right away.
+static void retire_synths(instrument_s *instr) {
+    if (is_offline(instr)) {
+        if (instr->retire_synth)
+            bpbxsyn_synth_destroy(instr->retire_synth);
+        instr_shadow_free(instr->retire_shadow);
+
+        instr->retire_synth = NULL;
+        instr->retire_shadow = NULL;
+        return;
+    }
+
+    if (instr->retire_synth &&
+        main_queue_defer_synth_destroy(instr->main_queue, instr->clap_host,
+                                       instr->retire_synth))
+    {
+        instr->retire_synth = NULL;
+    }
+
+    if (instr->retire_shadow &&
+        main_queue_defer_call(instr->main_queue, instr->clap_host,
+                              free_shadow, instr->retire_shadow))
+    {
+        instr->retire_shadow = NULL;
+    }
+}
+
+// make the given synth the synth of the instrument, and fade out the old
+// one. voices of the old synth are ended.
+static void begin_synth_fade(instrument_s *instr, bpbxsyn_synth_s *synth,
+                             void *userdata, uint32_t time,
+                             const clap_output_events_t *out_events)
+{
+    assert(!instr->fade_synth);
+    end_all_voices(instr, time, out_events);
+
+    instr->fade_synth = instr->synth;
+    instr->fade_pos = 0;
+    instr->synth = synth;
+    bpbxsyn_synth_set_userdata(synth, userdata);
+}
+
+static bool set_shadow_params(instrument_s *instr, instr_shadow_s *shadow) {
+    instr->type = shadow->type;
+    instr->type_index = shadow->type_index;
+    instr->new_type_index = shadow->type_index;
+
+    return instr_set_params(instr, shadow->values, shadow->value_count);
+}
+
+// apply a shadow published by instr_publish_shadow. called at tick
+// boundaries from the audio thread.
+static void apply_pending_shadow(instrument_s *instr, void *userdata,
+                                 uint32_t time,
+                                 const clap_output_events_t *out_events)
+{
+    retire_synths(instr);
+
+    // one swap at a time, and the previous shadow has to be handed back
+    // before this one
+    if (instr->fade_synth || instr->retire_synth) return;
+    if (instr->retire_shadow) return;
+
+    instr_shadow_s *shadow = atomic_exchange_ptr(&instr->pending_shadow, NULL);
+    if (!shadow) return;
+
+    // the loaded state replaces a synth type change that is still pending
+    atomic_store(&instr->swap_requested, false);
+    instr->retire_synth = atomic_exchange_ptr(&instr->ready_synth, NULL);
+
+    begin_synth_fade(instr, shadow->synth, userdata, time, out_events);
+    shadow->synth = NULL;
+    set_shadow_params(instr, shadow);
+    rebase_synth_mods(instr, true);
+
+    instr->announce_generation = shadow->generation;
+    instr->retire_shadow = shadow;
+    retire_synths(instr);
+
+    // announced at the end of the block
+    mark_snapshot_all(instr);
+    instr->announce_swap = true;
+}
+
+// swap in a synth created by instr_on_main_thread. called at tick
+// boundaries from the audio thread.
+static void swap_ready_synth(instrument_s *instr, void *userdata, uint32_t time,
+                             const clap_output_events_t *out_events)
+{
+    retire_synths(instr);
+
+    // one swap at a time
+    if (instr->fade_synth || instr->retire_synth) return;
+
+    bpbxsyn_synth_s *ready = atomic_exchange_ptr(&instr->ready_synth, NULL);
+    if (!ready) return;
+
+    // type was changed again while the synth was created
+    const bpbxsyn_synth_type_e new_type =
+        instr_synth_type_values[instr->new_type_index];
+    if (bpbxsyn_synth_type(ready) != new_type ||
+        !copy_synth_config(instr->synth, ready))
+    {
+        instr->retire_synth = ready;
+        retire_synths(instr);
+
+        if (new_type != instr->type)
+            request_synth(instr);
+        return;
+    }
+
+    begin_synth_fade(instr, ready, userdata, time, out_events);
+    instr->type = new_type;
+    instr->type_index = instr->new_type_index;
+    rebase_synth_mods(instr, false);
+
+    mark_snapshot_all(instr);
+    instr->announce_swap = true;
+}
+
+static double instr_active_bpm(const instrument_s *instr) {
     double active_bpm;
     if (instr->tempo_use_override) {
         active_bpm = instr->tempo_override;
@@ -322,44 +809,71 @@ void instr_process(instrument_s *instr, float **output, uint32_t frame_count,
         active_bpm = 1.0;
     }
 
+    return active_bpm;
+}
+
+void instr_process(instrument_s *instr, float **output, uint32_t frame_count,
+                   uint32_t start_frame, const clap_output_events_t *out_events)
+{
+    inst_process_userdata_s inst_proc = {
+        .instr = instr,
+        .cur_sample = start_frame,
+        .out_events = out_events
+    };
+    bpbxsyn_synth_set_userdata(instr->synth, &inst_proc);
+
+    instr->linear_gain = pow(10.0, instr->gain / 10.0);
+    const double active_bpm = instr_active_bpm(instr);
+
     const double beats_per_sec = active_bpm / 60.0;
     const double sample_len = 1.0 / instr->sample_rate;
 
+    update_lazy_effects(instr);
+
     float *out_l = output[0];
     float *out_r = output[1];
     for (uint32_t i = 0; i < frame_count;) {
         // instrument needs a tick
         if (instr->frames_until_next_tick == 0) {
+            apply_pending_shadow(instr, &inst_proc, inst_proc.cur_sample,
+                                 out_events);
+            swap_ready_synth(instr, &inst_proc, inst_proc.cur_sample,
+                             out_events);
+            if (instr->mods_dirty)
+                apply_param_mods(instr);
+
             bpbxsyn_tick_ctx_s tick_ctx = (bpbxsyn_tick_ctx_s) {
                 .bpm = active_bpm,
                 .beat = instr->cur_beat,
             };
 
             bpbxsyn_synth_tick(instr->synth, &tick_ctx);
+            if (instr->fade_synth)
+                bpbxsyn_synth_tick(instr->fade_synth, &tick_ctx);
 
             // tick panning, eq, and fader
             bpbxsyn_effect_tick(instr->fx.panning, &tick_ctx);
             bpbxsyn_effect_tick(instr->fx.eq, &tick_ctx);
             bpbxsyn_effect_tick(instr->fx.fader, &tick_ctx);
 
-            instr->run_distortion = instr->use_distortion;
-            if (instr->use_distortion)
+            instr->run_distortion = instr->use_distortion && instr->fx.distortion;
+            if (instr->run_distortion)
                 bpbxsyn_effect_tick(instr->fx.distortion, &tick_ctx);
 
-            instr->run_bitcrusher = instr->use_bitcrusher;
-            if (instr->use_bitcrusher)
+            instr->run_bitcrusher = instr->use_bitcrusher && instr->fx.bitcrusher;
+            if (instr->run_bitcrusher)
                 bpbxsyn_effect_tick(instr->fx.bitcrusher, &tick_ctx);
 
-            instr->run_chorus = instr->use_chorus;
-            if (instr->use_chorus)
+            instr->run_chorus = instr->use_chorus && instr->fx.chorus;
+            if (instr->run_chorus)
                 bpbxsyn_effect_tick(instr->fx.chorus, &tick_ctx);
 
-            instr->run_echo = instr->use_echo;
-            if (instr->use_echo)
+            instr->run_echo = instr->use_echo && instr->fx.echo;
+            if (instr->run_echo)
                 bpbxsyn_effect_tick(instr->fx.echo, &tick_ctx);
             
-            instr->run_reverb = instr->use_reverb;
-            if (instr->use_reverb)
+            instr->run_reverb = instr->use_reverb && instr->fx.reverb;
+            if (instr->run_reverb)
                 bpbxsyn_effect_tick(instr->fx.reverb, &tick_ctx);
 
             instr->frames_until_next_tick =
@@ -375,6 +889,27 @@ void instr_process(instrument_s *instr, float **output, uint32_t frame_count,
 
         bpbxsyn_synth_run(instr->synth, instr->synth_mono_buffer + i, frames_to_process);
 
+        // crossfade from the synth of the previous type
+        if (instr->fade_synth) {
+            bpbxsyn_synth_run(instr->fade_synth, instr->fade_buffer,
+                              frames_to_process);
+
+            float *mono = instr->synth_mono_buffer + i;
+            for (uint32_t j = 0; j < frames_to_process; ++j) {
+                uint32_t pos = instr->fade_pos + j;
+                float t = pos >= instr->fade_frames
+                    ? 1.0f : (float)pos / instr->fade_frames;
+
+                mono[j] = mono[j] * t + instr->fade_buffer[j] * (1.0f - t);
+            }
+
+            instr->fade_pos += frames_to_process;
+            if (instr->fade_pos >= instr->fade_frames) {
+                instr->retire_synth = instr->fade_synth;
+                instr->fade_synth = NULL;
+            }
+        }
+
         // convert mono audio from process_block[1] into process_block[0]
         float *process_block[2];
         process_block[0] = instr->process_block[0] + i;
@@ -428,6 +963,23 @@ void instr_process(instrument_s *instr, float **output, uint32_t frame_count,
     }
 
     bpbxsyn_synth_set_userdata(instr->synth, NULL);
+    if (instr->fade_synth)
+        bpbxsyn_synth_set_userdata(instr->fade_synth, NULL);
+    if (instr->retire_synth)
+        bpbxsyn_synth_set_userdata(instr->retire_synth, NULL);
+
+    instr_publish_snapshot(instr);
+
+    // the main thread rescans the params of a swapped synth, and the gui
+    // syncs to it, so they have to find it in the snapshot. this is a flag
+    // rather than a queued rescan, as instr_on_main_thread reports it to
+    // the plugin, which also syncs the gui.
+    if (instr->announce_swap) {
+        instr->announce_swap = false;
+        atomic_store(&instr->applied_generation, instr->announce_generation);
+        atomic_store(&instr->synth_swapped, true);
+        instr->clap_host->request_callback(instr->clap_host);
+    }
 }
 
 // bool instr_is_module_active(const instrument_s *instr, instr_module_e module) {
@@ -441,10 +993,16 @@ void instr_process(instrument_s *instr, float **output, uint32_t frame_count,
 void instr_set_effect_active(instrument_s *instr, bpbxsyn_effect_type_e effect,
                              bool value)
 {
+    // effects left out on init cannot be enabled
+    if (!is_lazy_effect(effect) ||
+        !instr_has_module(instr, INSTR_FIRST_EFFECT_MODULE + effect))
+        return;
+
     #define HANDLE_EFFECT(name)                                                \
         if (instr->use_##name != value) {                                      \
             if (!value) {                                                      \
-                bpbxsyn_effect_stop(instr->fx.name);                           \
+                if (instr->fx.name)                                            \
+                    bpbxsyn_effect_stop(instr->fx.name);                       \
                 instr->run_##name = false;                                     \
             }                                                                  \
             instr->use_##name = value;                                         \
@@ -475,6 +1033,10 @@ void instr_set_effect_active(instrument_s *instr, bpbxsyn_effect_type_e effect,
     }
 
     #undef HANDLE_EFFECT
+
+    // when inactive, instr_activate creates the module instead
+    if (value && instr->is_active && !instr->effect_modules[effect])
+        take_lazy_effect(instr, effect);
 }
 
 void instr_begin_note(instrument_s *instr, int16_t key, double velocity,
@@ -506,108 +1068,127 @@ void instr_end_notes(instrument_s *instr, int16_t key, int32_t note_id,
    }
 }
 
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
+void instr_process_transport(instrument_s *instr,
+                             const clap_event_transport_t *ev)
+{
+    if (ev->flags & CLAP_TRANSPORT_HAS_TEMPO) {
+        instr->bpm = ev->tempo;
+    } else {
+        instr->bpm = 150.0;
+    }
+
+    bool is_playing = (ev->flags & CLAP_TRANSPORT_IS_PLAYING) != 0;
+
+    // if playing state changed, update current beat from transport event.
+    // otherwise plugin should increment cur beat on its own using bpm info.
+    if (is_playing != instr->is_playing) {
+        if (ev->flags & CLAP_TRANSPORT_HAS_BEATS_TIMELINE) {
+            int64_t beats_int = ev->song_pos_beats / CLAP_BEATTIME_FACTOR;
+            int64_t beats_frac = ev->song_pos_beats % CLAP_BEATTIME_FACTOR;
+            instr->cur_beat =
+                (double)beats_int + (double)beats_frac / CLAP_BEATTIME_FACTOR;
+        }
+
+        if (is_playing)
+            bpbxsyn_synth_begin_transport(instr->synth,
+                                          instr->cur_beat,
+                                          instr->bpm);
+    }
 
-// use the param count of the generator that has the most number of
-// parameters
-#define MAX_SYNTH_PARAM_COUNT ((                                               \
-        MAX(BPBXSYN_CHIP_PARAM_COUNT,                                          \
-        MAX(BPBXSYN_FM_PARAM_COUNT,                                            \
-        MAX(BPBXSYN_NOISE_PARAM_COUNT,                                         \
-        MAX(BPBXSYN_PULSE_WIDTH_PARAM_COUNT,                                   \
-        MAX(BPBXSYN_CUSTOM_CHIP_PARAM_COUNT,                                   \
-        MAX(BPBXSYN_HARMONICS_PARAM_COUNT,                                     \
-        MAX(BPBXSYN_SPECTRUM_PARAM_COUNT,                                      \
-        MAX(BPBXSYN_PICKED_STRING_PARAM_COUNT,                                 \
-            BPBXSYN_SUPERSAW_PARAM_COUNT)                                      \
-        )))))))                                                                \
-    ))
+    instr->is_playing = is_playing;
+}
 
 uint32_t instr_params_count(const instrument_s *instr) {
-    uint32_t count =
-        BPBXSYN_BASE_PARAM_COUNT
-        + MAX_SYNTH_PARAM_COUNT
-        + INSTR_CPARAM_COUNT
-        + BPBXSYN_VOLUME_PARAM_COUNT
-        + BPBXSYN_PANNING_PARAM_COUNT
-        + BPBXSYN_EQ_PARAM_COUNT
-        + BPBXSYN_DISTORTION_PARAM_COUNT
-        + BPBXSYN_BITCRUSHER_PARAM_COUNT
-        + BPBXSYN_CHORUS_PARAM_COUNT
-        + BPBXSYN_ECHO_PARAM_COUNT
-        + BPBXSYN_REVERB_PARAM_COUNT;
+    const instr_param_layout_s *layout = instr_param_layout(instr->type);
+    assert(layout);
+    return layout->count;
+}
 
-    return count;
+instr_param_id instr_typed_param_id(const instrument_s *instr,
+                                    instr_param_id id)
+{
+    instr_module_e module;
+    instr_param_id idx;
+    instr_local_id(id, &module, &idx);
+
+    if (module != INSTR_MODULE_SYNTH || idx < BPBXSYN_BASE_PARAM_COUNT ||
+        instr_param_synth_type(id) != -1)
+        return id;
+
+    return instr_typed_synth_param(instr->type, idx);
+}
+
+// returns false if the param id belongs to a synth type other than the
+// current one
+static bool is_current_synth_param(const instrument_s *instr,
+                                   instr_param_id id)
+{
+    const int type = instr_param_synth_type(id);
+    return type == -1 || type == (int)instr->type;
 }
 
 instr_param_id instr_get_param_id(const instrument_s *instr, uint32_t index,
                                   bool *is_inactive) {
-    #define check(module, count) \
-        if (index < count) \
-            return instr_global_id(module, index); \
-        index -= count
-    
-    #define check_within(module, start, count) \
-        if (index < (count)) \
-            return instr_global_id((module), (start) + (index)); \
-        index -= (count)
-    
-    #define check1(module, pindex) \
-        if (index == 0) \
-            return instr_global_id((module), (pindex)); \
-        index--
+    const instr_param_layout_s *layout = instr_param_layout(instr->type);
+    assert(layout);
 
-    if (is_inactive)
-        *is_inactive = false;
+    if (index >= layout->count) {
+        if (is_inactive) *is_inactive = false;
+        return INSTR_INVALID_ID;
+    }
 
-    // control parameters
-    check_within(INSTR_MODULE_CONTROL, 0, INSTR_CPARAM_ENABLE_DISTORTION);
-    
-    // volume and panning
-    check(INSTR_MODULE_VOLUME, BPBXSYN_VOLUME_PARAM_COUNT);
-    check(INSTR_MODULE_PANNING, BPBXSYN_PANNING_PARAM_COUNT);
+    if (is_inactive)
+        *is_inactive = layout->params[index].inactive;
 
-    // synth general parameters
-    const int note_effect_start = BPBXSYN_PARAM_ENABLE_TRANSITION_TYPE;
-    check_within(INSTR_MODULE_SYNTH, 0, note_effect_start);
+    return layout->params[index].id;
+}
 
-    // synth params
-    if (index < MAX_SYNTH_PARAM_COUNT && 
-        index >= bpbxsyn_synth_param_count(instr->type) - BPBXSYN_BASE_PARAM_COUNT
-    ) {
-        if (is_inactive) *is_inactive = true;
+static bool set_synth_param(bpbxsyn_synth_s *synth, instr_param_id idx,
+                            const bpbxsyn_param_info_s *info, double *value)
+{
+    switch (info->type) {
+        case BPBXSYN_PARAM_DOUBLE:
+            return !bpbxsyn_synth_set_param_double(synth, idx, *value);
+        
+        case BPBXSYN_PARAM_INT:
+        case BPBXSYN_PARAM_UINT8:
+            *value = round(*value);
+            return !bpbxsyn_synth_set_param_int(synth, idx, (int)*value);
     }
-    check_within(INSTR_MODULE_SYNTH, BPBXSYN_BASE_PARAM_COUNT, MAX_SYNTH_PARAM_COUNT);
 
-    // synth note effect parameters
-    check_within(INSTR_MODULE_SYNTH, note_effect_start, BPBXSYN_BASE_PARAM_COUNT - note_effect_start);
-
-    // eq
-    check(INSTR_MODULE_EQ, BPBXSYN_EQ_PARAM_COUNT);
-
-    // distortion
-    check1(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_DISTORTION);
-    check(INSTR_MODULE_DISTORTION, BPBXSYN_DISTORTION_PARAM_COUNT);
+    return false;
+}
 
-    // bitcrusher
-    check1(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_BITCRUSHER);
-    check(INSTR_MODULE_BITCRUSHER, BPBXSYN_BITCRUSHER_PARAM_COUNT);
+// write a synth or effect param whose info is already known
+static bool set_module_param(instrument_s *instr, instr_module_e module,
+                             instr_param_id idx,
+                             const bpbxsyn_param_info_s *info, double *value)
+{
+    if (module == INSTR_MODULE_SYNTH) {
+        return set_synth_param(instr->synth, idx, info, value);
+    }
 
-    // chorus
-    check1(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_CHORUS);
-    check(INSTR_MODULE_CHORUS, BPBXSYN_CHORUS_PARAM_COUNT);
+    assert(is_effect(module));
+    const bpbxsyn_effect_type_e type = module - INSTR_FIRST_EFFECT_MODULE;
+    bpbxsyn_effect_s *effect = instr->effect_modules[type];
 
-    // echo
-    check1(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_ECHO);
-    check(INSTR_MODULE_ECHO, BPBXSYN_ECHO_PARAM_COUNT);
+    // the value is kept for when the module is created
+    if (is_lazy_effect(type)) {
+        if (!instr_has_module(instr, module) ||
+            idx >= lazy_effect_param_counts[type - INSTR_LAZY_EFFECT_FIRST])
+            return false;
 
-    // reverb
-    check1(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_REVERB);
-    check(INSTR_MODULE_REVERB, BPBXSYN_REVERB_PARAM_COUNT);
+        if (info->type != BPBXSYN_PARAM_DOUBLE)
+            *value = round(*value);
+        if (*value < info->min_value) *value = info->min_value;
+        if (*value > info->max_value) *value = info->max_value;
 
-    return INSTR_INVALID_ID;
+        lazy_effect(instr, type)->params[idx] = *value;
+        if (!effect) return true;
+    }
 
-    #undef check
+    if (!effect) return false;
+    return set_effect_param(effect, idx, info, value);
 }
 
 bool instr_set_param(instrument_s *instr, instr_param_id id, double *value) {
@@ -620,6 +1201,8 @@ bool instr_set_param(instrument_s *instr, instr_param_id id, double *value) {
     assert(id != INSTR_INVALID_ID);
     if (id == INSTR_INVALID_ID) return false;
 
+    mark_snapshot_param(instr, id);
+
     instr_module_e module;
     instr_param_id idx;
     instr_local_id(id, &module, &idx);
@@ -630,8 +1213,9 @@ bool instr_set_param(instrument_s *instr, instr_param_id id, double *value) {
             if (idx >= BPBXSYN_BASE_PARAM_COUNT + MAX_SYNTH_PARAM_COUNT)
                 return false;
             
-            // unused param, ignore the write
-            if (idx >= bpbxsyn_synth_param_count(instr->type))
+            // param of another synth type or unused param, ignore the write
+            if (!is_current_synth_param(instr, id) ||
+                idx >= bpbxsyn_synth_param_count(instr->type))
                 return true;
 
             const bpbxsyn_param_info_s *info =
@@ -639,15 +1223,11 @@ bool instr_set_param(instrument_s *instr, instr_param_id id, double *value) {
             assert(info);
             if (!info) return false;
 
-            switch (info->type) {
-                case BPBXSYN_PARAM_DOUBLE:
-                    return !bpbxsyn_synth_set_param_double(instr->synth, idx, *value);
-                
-                case BPBXSYN_PARAM_INT:
-                case BPBXSYN_PARAM_UINT8:
-                    *value = round(*value);
-                    return !bpbxsyn_synth_set_param_int(instr->synth, idx, (int)*value);
-            }
+            if (!set_module_param(instr, module, idx, info, value))
+                return false;
+
+            set_mod_base(instr, id, *value);
+            return true;
         }
         
         case INSTR_MODULE_CONTROL:
@@ -658,8 +1238,10 @@ bool instr_set_param(instrument_s *instr, instr_param_id id, double *value) {
                     // -1 means that instrument type is not implemented yet
                     if (instr_synth_type_values[instr->new_type_index] == -1) {
                         instr->new_type_index = instr->type_index;
-                    } else if (instr->clap_host->request_restart) {
-                        instr->clap_host->request_restart(instr->clap_host);
+                    } else if (instr->is_active) {
+                        // when inactive, instr_activate creates the new
+                        // synth instead
+                        request_synth(instr);
                     }
 
                     break;
@@ -693,24 +1275,17 @@ bool instr_set_param(instrument_s *instr, instr_param_id id, double *value) {
             return true;
         
         default:
-            if (is_effect(module) && instr->effect_modules[module - INSTR_FIRST_EFFECT_MODULE]) {
-                bpbxsyn_effect_s *effect =
-                    instr->effect_modules[module - INSTR_FIRST_EFFECT_MODULE];
-                
+            if (is_effect(module) && instr_has_module(instr, module)) {
                 const bpbxsyn_param_info_s *info =
                     bpbxsyn_effect_param_info(module - INSTR_FIRST_EFFECT_MODULE, idx);
                 assert(info);
                 if (!info) return false;
 
-                switch (info->type) {
-                    case BPBXSYN_PARAM_DOUBLE:
-                        return !bpbxsyn_effect_set_param_double(effect, idx, *value);
-                    
-                    case BPBXSYN_PARAM_INT:
-                    case BPBXSYN_PARAM_UINT8:
-                        *value = round(*value);
-                        return !bpbxsyn_effect_set_param_int(effect, idx, (int)*value);
-                }
+                if (!set_module_param(instr, module, idx, info, value))
+                    return false;
+
+                set_mod_base(instr, id, *value);
+                return true;
             }
 
             return false;
@@ -719,10 +1294,699 @@ bool instr_set_param(instrument_s *instr, instr_param_id id, double *value) {
     #undef HANDLE_EFFECT
 }
 
+bool instr_set_params(instrument_s *instr, instr_param_value_s *params,
+                      uint32_t count)
+{
+    bool ok = true;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        instr_param_value_s *p = &params[i];
+        mark_snapshot_param(instr, p->id);
+
+        instr_module_e module;
+        instr_param_id idx;
+        instr_local_id(p->id, &module, &idx);
+
+        // control params have side effects and are few, so they go through
+        // the regular path. synth and effect params are written directly.
+        if (!p->info || module == INSTR_MODULE_CONTROL) {
+            ok = instr_set_param(instr, p->id, &p->value) && ok;
+            continue;
+        }
+
+        if (module == INSTR_MODULE_SYNTH) {
+            // param of another synth type or unused param, ignore the write
+            if (!is_current_synth_param(instr, p->id) ||
+                idx >= bpbxsyn_synth_param_count(instr->type))
+                continue;
+        } else if (!is_effect(module)) {
+            ok = false;
+            continue;
+        }
+
+        if (set_module_param(instr, module, idx, p->info, &p->value))
+            set_mod_base(instr, p->id, p->value);
+        else
+            ok = false;
+    }
+
+    return ok;
+}
+
+uint32_t instr_linked_params(const instrument_s *instr, instr_param_id id,
+                             double value,
+                             instr_param_value_s out[INSTR_MAX_LINKED_PARAMS])
+{
+    uint32_t count = 0;
+
+    #define LINK(param, v)                                                     \
+        out[count++] = (instr_param_value_s) {                                 \
+            .id = instr_synth_param(param),                                    \
+            .value = (v)                                                       \
+        }
+
+    switch (instr_untyped_param_id(id)) {
+        case instr_synth_param(BPBXSYN_PARAM_VIBRATO_PRESET):
+            if ((int)value != BPBXSYN_VIBRATO_PRESET_CUSTOM) {
+                bpbxsyn_vibrato_params_s params;
+                bpbxsyn_vibrato_preset_params((int)value, &params);
+
+                LINK(BPBXSYN_PARAM_VIBRATO_DEPTH, params.depth);
+                LINK(BPBXSYN_PARAM_VIBRATO_SPEED, params.speed);
+                LINK(BPBXSYN_PARAM_VIBRATO_DELAY, (double)params.delay);
+                LINK(BPBXSYN_PARAM_VIBRATO_TYPE, (double)params.type);
+            }
+            break;
+
+        case instr_synth_param(BPBXSYN_PARAM_VIBRATO_DEPTH):
+        case instr_synth_param(BPBXSYN_PARAM_VIBRATO_SPEED):
+        case instr_synth_param(BPBXSYN_PARAM_VIBRATO_DELAY):
+        case instr_synth_param(BPBXSYN_PARAM_VIBRATO_TYPE): {
+            double preset;
+            if (instr_get_param(instr,
+                    instr_synth_param(BPBXSYN_PARAM_VIBRATO_PRESET), &preset)
+                && (int)preset != BPBXSYN_VIBRATO_PRESET_CUSTOM)
+            {
+                LINK(BPBXSYN_PARAM_VIBRATO_PRESET,
+                     (double)BPBXSYN_VIBRATO_PRESET_CUSTOM);
+            }
+            break;
+        }
+    }
+
+    #undef LINK
+
+    return count;
+}
+
+clap_log_severity instr_log_severity(bpbxsyn_log_severity_e severity) {
+    switch (severity) {
+        case BPBXSYN_LOG_DEBUG:
+            return CLAP_LOG_DEBUG;
+
+        case BPBXSYN_LOG_INFO:
+            return CLAP_LOG_INFO;
+
+        case BPBXSYN_LOG_WARNING:
+            return CLAP_LOG_WARNING;
+
+        case BPBXSYN_LOG_ERROR:
+            return CLAP_LOG_ERROR;
+
+        case BPBXSYN_LOG_FATAL:
+            return CLAP_LOG_FATAL;
+    }
+
+    return CLAP_LOG_INFO;
+}
+
+////////////////
+// modulation //
+////////////////
+
+bool instr_param_is_modulatable(instr_param_id id,
+                                const bpbxsyn_param_info_s *info)
+{
+    instr_module_e module;
+    instr_local_id(id, &module, NULL);
+
+    if (module != INSTR_MODULE_SYNTH && !is_effect(module))
+        return false;
+
+    return info && !info->enum_values;
+}
+
+// index of the modulation of a param, or UINT32_MAX. synth params are
+// looked up by their typed id.
+static uint32_t find_mod(const instrument_s *instr, instr_param_id id) {
+    for (uint32_t i = 0; i < instr->mod_count; ++i) {
+        if (instr->mods[i].id == id)
+            return i;
+    }
+
+    return UINT32_MAX;
+}
+
+static void write_mod(instrument_s *instr, instr_param_mod_s *mod) {
+    instr_module_e module;
+    instr_param_id idx;
+    instr_local_id(mod->id, &module, &idx);
+
+    double value = mod->base + mod->amount;
+    if (value < mod->info->min_value) value = mod->info->min_value;
+    if (value > mod->info->max_value) value = mod->info->max_value;
+
+    set_module_param(instr, module, idx, mod->info, &value);
+    mod->dirty = false;
+}
+
+static void remove_mod(instrument_s *instr, uint32_t index) {
+    instr->mods[index] = instr->mods[--instr->mod_count];
+}
+
+// write the modulated values of the params whose modulation or base value
+// changed since the last tick
+static void apply_param_mods(instrument_s *instr) {
+    instr->mods_dirty = false;
+
+    for (uint32_t i = 0; i < instr->mod_count;) {
+        instr_param_mod_s *mod = &instr->mods[i];
+        if (mod->dirty)
+            write_mod(instr, mod);
+
+        // back at the base value, so the slot is free again
+        if (mod->amount == 0.0) {
+            remove_mod(instr, i);
+            continue;
+        }
+
+        ++i;
+    }
+}
+
+// a param got a new base value, which was just written to its module.
+// the modulation is put back on top right away.
+static void set_mod_base(instrument_s *instr, instr_param_id id,
+                         double value)
+{
+    if (instr->mod_count == 0) return;
+
+    const uint32_t i = find_mod(instr, instr_typed_param_id(instr, id));
+    if (i == UINT32_MAX) return;
+
+    instr->mods[i].base = value;
+    write_mod(instr, &instr->mods[i]);
+}
+
+// the synth was replaced. modulation of params specific to another synth
+// type is dropped, and the rest is written to the new synth at the next
+// tick. reload_base takes the base values from the new synth, for when it
+// was loaded from a state.
+static void rebase_synth_mods(instrument_s *instr, bool reload_base) {
+    for (uint32_t i = 0; i < instr->mod_count;) {
+        instr_param_mod_s *mod = &instr->mods[i];
+
+        instr_module_e module;
+        instr_param_id idx;
+        instr_local_id(mod->id, &module, &idx);
+
+        if (module != INSTR_MODULE_SYNTH) {
+            ++i;
+            continue;
+        }
+
+        if (!is_current_synth_param(instr, mod->id)) {
+            remove_mod(instr, i);
+            continue;
+        }
+
+        if (reload_base)
+            bpbxsyn_synth_get_param_double(instr->synth, idx, &mod->base);
+
+        mod->dirty = true;
+        instr->mods_dirty = true;
+        ++i;
+    }
+}
+
+bool instr_mod_param(instrument_s *instr, instr_param_id id, double amount) {
+    id = instr_typed_param_id(instr, id);
+
+    const bpbxsyn_param_info_s *info = instr_get_param_info(instr, id);
+    if (!instr_param_is_modulatable(id, info)) return false;
+
+    instr_module_e module;
+    instr_param_id idx;
+    instr_local_id(id, &module, &idx);
+
+    // param of another synth type, or of a module left out on init
+    if (module == INSTR_MODULE_SYNTH) {
+        if (!is_current_synth_param(instr, id) ||
+            idx >= bpbxsyn_synth_param_count(instr->type))
+            return false;
+    } else if (!instr_has_module(instr, module)) {
+        return false;
+    }
+
+    uint32_t i = find_mod(instr, id);
+    if (i == UINT32_MAX) {
+        // nothing to undo
+        if (amount == 0.0) return true;
+        if (instr->mod_count == INSTR_MOD_SLOT_COUNT) return false;
+
+        double base;
+        if (!instr_get_param(instr, id, &base)) return false;
+
+        i = instr->mod_count++;
+        instr->mods[i] = (instr_param_mod_s) {
+            .id = id,
+            .info = info,
+            .base = base,
+        };
+    }
+
+    instr->mods[i].amount = amount;
+    instr->mods[i].dirty = true;
+    instr->mods_dirty = true;
+    return true;
+}
+
+instr_shadow_s* instr_shadow_new(const instrument_s *instr,
+                                 bpbxsyn_synth_type_e type)
+{
+    const int type_idx = instr_synth_type_index(type);
+    if (type_idx == -1) return NULL;
+
+    instr_shadow_s *shadow = calloc(1, sizeof(instr_shadow_s));
+    if (!shadow) return NULL;
+
+    shadow->type = type;
+    shadow->type_index = (uint8_t)type_idx;
+    shadow->synth = bpbxsyn_synth_new(instr->ctx, type);
+    if (!shadow->synth) {
+        free(shadow);
+        return NULL;
+    }
+
+    // otherwise, set on activation
+    if (instr->sample_rate > 0.0)
+        bpbxsyn_synth_set_sample_rate(shadow->synth, instr->sample_rate);
+
+    return shadow;
+}
+
+void instr_shadow_free(instr_shadow_s *shadow) {
+    if (!shadow) return;
+
+    if (shadow->synth)
+        bpbxsyn_synth_destroy(shadow->synth);
+    free(shadow);
+}
+
+bool instr_shadow_set_params(instr_shadow_s *shadow,
+                             instr_param_value_s *params, uint32_t count)
+{
+    bool ok = true;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        instr_param_value_s *p = &params[i];
+
+        instr_module_e module;
+        instr_param_id idx;
+        instr_local_id(p->id, &module, &idx);
+
+        if (module == INSTR_MODULE_SYNTH) {
+            // param of another synth type or unused param
+            const int type = instr_param_synth_type(p->id);
+            if ((type != -1 && type != (int)shadow->type) ||
+                idx >= bpbxsyn_synth_param_count(shadow->type))
+                continue;
+
+            const bpbxsyn_param_info_s *info = p->info;
+            if (!info) info = bpbxsyn_synth_param_info(shadow->type, idx);
+
+            ok = info && set_synth_param(shadow->synth, idx, info, &p->value)
+                && ok;
+            continue;
+        }
+
+        if (p->id == instr_global_id(INSTR_MODULE_CONTROL,
+                                     INSTR_CPARAM_SYNTH_TYPE))
+            continue;
+
+        if (shadow->value_count >= INSTR_PARAM_COUNT)
+            return false;
+
+        shadow->values[shadow->value_count++] = *p;
+    }
+
+    return ok;
+}
+
+bool instr_publish_shadow(instrument_s *instr, instr_shadow_s *shadow) {
+    if (!instr->is_active) {
+        for (int i = 0; i < BPBXSYN_SYNTH_MAX_VOICES; ++i) {
+            instr->voices[i].active = false;
+        }
+        instr->active_voice_count = 0;
+
+        bpbxsyn_synth_destroy(instr->synth);
+        instr->synth = shadow->synth;
+        shadow->synth = NULL;
+
+        const bool ok = set_shadow_params(instr, shadow);
+        rebase_synth_mods(instr, true);
+        instr_shadow_free(shadow);
+        mark_snapshot_all(instr);
+        instr_publish_snapshot(instr);
+        atomic_store(&instr->staged, false);
+        return ok;
+    }
+
+    // the loaded state replaces a synth type change that was not picked up
+    // by the audio thread yet
+    atomic_store(&instr->swap_requested, false);
+    bpbxsyn_synth_s *ready = atomic_exchange_ptr(&instr->ready_synth, NULL);
+    if (ready)
+        bpbxsyn_synth_destroy(ready);
+
+    // readers see the loaded state right away, even if the host does not
+    // process for a while
+    shadow->generation = ++instr->staged_generation;
+    stage_shadow(instr, shadow);
+
+    instr_shadow_free(atomic_exchange_ptr(&instr->pending_shadow, shadow));
+
+    // the host may have put the plugin to sleep
+    if (instr->clap_host->request_process)
+        instr->clap_host->request_process(instr->clap_host);
+
+    return true;
+}
+
+///////////////
+// snapshots //
+///////////////
+
+static void mark_snapshot_param(instrument_s *instr, instr_param_id id) {
+    instr->snapshot_dirty = true;
+
+    const instr_param_layout_s *layout = instr_param_layout(instr->type);
+    if (!layout) return;
+
+    const uint32_t i =
+        instr_param_index(layout, instr_typed_param_id(instr, id));
+    if (i == UINT32_MAX) return;
+
+    for (int s = 0; s < INSTR_SNAPSHOT_SLOTS; ++s)
+        instr->snapshot_dirty_bits[s][i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static void mark_snapshot_all(instrument_s *instr) {
+    instr->snapshot_dirty = true;
+
+    for (int s = 0; s < INSTR_SNAPSHOT_SLOTS; ++s)
+        instr->snapshot_rebuild[s] = true;
+}
+
+static void fill_snapshot_param(const instrument_s *instr,
+                                const instr_param_layout_s *layout,
+                                instr_snapshot_s *snapshot, uint32_t i)
+{
+    const instr_param_slot_s *slot = &layout->params[i];
+    double value = slot->clap.default_value;
+
+    snapshot->readable[i] =
+        slot->inactive || instr_get_param(instr, slot->id, &value);
+    snapshot->values[i] = value;
+}
+
+// bring a slot up to date. only the params that changed since the slot was
+// last written are read, unless it has to be rebuilt.
+static void fill_snapshot(instrument_s *instr, uint32_t slot_index) {
+    instr_snapshot_s *snapshot = &instr->snapshots[slot_index];
+    uint64_t *dirty = instr->snapshot_dirty_bits[slot_index];
+
+    const instr_param_layout_s *layout = instr_param_layout(instr->type);
+    assert(layout);
+
+    if (instr->snapshot_rebuild[slot_index]) {
+        instr->snapshot_rebuild[slot_index] = false;
+        memset(dirty, 0, sizeof(instr->snapshot_dirty_bits[slot_index]));
+
+        snapshot->type = instr->type;
+        for (uint32_t i = 0; i < layout->count; ++i)
+            fill_snapshot_param(instr, layout, snapshot, i);
+    } else {
+        for (uint32_t w = 0; w < INSTR_SNAPSHOT_DIRTY_WORDS; ++w) {
+            uint64_t bits = dirty[w];
+            dirty[w] = 0;
+
+            for (uint32_t b = 0; bits; ++b, bits >>= 1) {
+                if (bits & 1)
+                    fill_snapshot_param(instr, layout, snapshot, w * 64 + b);
+            }
+        }
+    }
+
+    snapshot->envelope_count = bpbxsyn_synth_envelope_count(instr->synth);
+    if (snapshot->envelope_count > 0) {
+        memcpy(snapshot->envelopes,
+               bpbxsyn_synth_get_envelope(instr->synth, 0),
+               snapshot->envelope_count * sizeof(bpbxsyn_envelope_s));
+    }
+}
+
+void instr_publish_snapshot(instrument_s *instr) {
+    if (!instr->snapshot_dirty) return;
+    instr->snapshot_dirty = false;
+
+    // readers are on the latest slot, or on the one before it if they are
+    // slow. the one after it is free unless they are slower than that.
+    const uint32_t slot =
+        (atomic_load(&instr->latest_snapshot) + 1) % INSTR_SNAPSHOT_SLOTS;
+    atomic_uint *seq = &instr->snapshot_seqs[slot];
+    const uint32_t s = atomic_load(seq);
+
+    atomic_store(seq, s + 1);
+    atomic_thread_fence(memory_order_release);
+    fill_snapshot(instr, slot);
+    atomic_store(seq, s + 2);
+
+    atomic_store(&instr->latest_snapshot, slot);
+}
+
+// returns the latest slot, along with its sequence to be checked by
+// end_snapshot_read
+static uint32_t begin_snapshot_read(const instrument_s *instr, uint32_t *seq) {
+    for (;;) {
+        const uint32_t slot = atomic_load(&instr->latest_snapshot);
+        *seq = atomic_load(&instr->snapshot_seqs[slot]);
+
+        // the owner never stays in a write for long
+        if (!(*seq & 1)) return slot;
+    }
+}
+
+// returns false if the slot was overwritten while it was read
+static bool end_snapshot_read(const instrument_s *instr, uint32_t slot,
+                              uint32_t seq)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load(&instr->snapshot_seqs[slot]) == seq;
+}
+
+// returns false if there is no staged state. otherwise, the sequence of the
+// staged state is to be checked by end_staged_read.
+static bool begin_staged_read(const instrument_s *instr, uint32_t *seq) {
+    for (;;) {
+        if (!atomic_load(&instr->staged)) return false;
+
+        *seq = atomic_load(&instr->staged_seq);
+        if (!(*seq & 1)) return true;
+    }
+}
+
+// returns false if the staged state was overwritten while it was read
+static bool end_staged_read(const instrument_s *instr, uint32_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load(&instr->staged_seq) == seq;
+}
+
+static bool snapshot_get_param(const instr_snapshot_s *snapshot,
+                               instr_param_id id, double *value)
+{
+    // the type may be torn by a concurrent write, which the caller retries
+    const instr_param_layout_s *layout = instr_param_layout(snapshot->type);
+    if (!layout) return false;
+
+    const uint32_t index = instr_param_index(layout, id);
+    if (index == UINT32_MAX || !snapshot->readable[index]) return false;
+
+    *value = snapshot->values[index];
+    return true;
+}
+
+// read a param from the latest snapshot, ignoring the staged state
+static bool read_snapshot_param(const instrument_s *instr, instr_param_id id,
+                                double *value)
+{
+    uint32_t slot, seq;
+    bool found;
+    double v = 0.0;
+
+    do {
+        slot = begin_snapshot_read(instr, &seq);
+        found = snapshot_get_param(&instr->snapshots[slot], id, &v);
+    } while (!end_snapshot_read(instr, slot, seq));
+
+    if (found) *value = v;
+    return found;
+}
+
+// value of a param once the shadow is applied. params that the shadow does
+// not hold keep their current value.
+static bool get_shadow_param(const instrument_s *instr,
+                             const instr_shadow_s *shadow, instr_param_id id,
+                             double *value)
+{
+    instr_module_e module;
+    instr_param_id idx;
+    instr_local_id(id, &module, &idx);
+
+    if (module == INSTR_MODULE_SYNTH) {
+        const int type = instr_param_synth_type(id);
+        if (type != -1 && type != (int)shadow->type) {
+            const bpbxsyn_param_info_s *info =
+                instr_type_param_info(shadow->type, id);
+            *value = info ? info->default_value : 0.0;
+            return true;
+        }
+
+        if (idx >= bpbxsyn_synth_param_count(shadow->type)) {
+            *value = 0.0;
+            return true;
+        }
+
+        return !bpbxsyn_synth_get_param_double(shadow->synth, idx, value);
+    }
+
+    if (module == INSTR_MODULE_CONTROL && idx == INSTR_CPARAM_SYNTH_TYPE) {
+        *value = (double)shadow->type_index;
+        return true;
+    }
+
+    for (uint32_t i = 0; i < shadow->value_count; ++i) {
+        if (shadow->values[i].id == id) {
+            *value = shadow->values[i].value;
+            return true;
+        }
+    }
+
+    return read_snapshot_param(instr, id, value);
+}
+
+// write the state of a shadow handed to the audio thread to the staged
+// snapshot. called from the main thread.
+static void stage_shadow(instrument_s *instr, const instr_shadow_s *shadow) {
+    instr_snapshot_s *snapshot = instr->staged_snapshot;
+    const instr_param_layout_s *layout = instr_param_layout(shadow->type);
+    assert(layout);
+
+    const uint32_t s = atomic_load(&instr->staged_seq);
+    atomic_store(&instr->staged_seq, s + 1);
+    atomic_thread_fence(memory_order_release);
+
+    snapshot->type = shadow->type;
+    for (uint32_t i = 0; i < layout->count; ++i) {
+        const instr_param_slot_s *slot = &layout->params[i];
+        double value = slot->clap.default_value;
+
+        snapshot->readable[i] = slot->inactive ||
+            get_shadow_param(instr, shadow, slot->id, &value);
+        snapshot->values[i] = value;
+    }
+
+    snapshot->envelope_count = bpbxsyn_synth_envelope_count(shadow->synth);
+    if (snapshot->envelope_count > 0) {
+        memcpy(snapshot->envelopes,
+               bpbxsyn_synth_get_envelope(shadow->synth, 0),
+               snapshot->envelope_count * sizeof(bpbxsyn_envelope_s));
+    }
+
+    atomic_store(&instr->staged_seq, s + 2);
+    atomic_store(&instr->staged, true);
+}
+
+instr_snapshot_s* instr_snapshot_new(void) {
+    return calloc(1, sizeof(instr_snapshot_s));
+}
+
+void instr_snapshot_free(instr_snapshot_s *snapshot) {
+    free(snapshot);
+}
+
+void instr_read_snapshot(const instrument_s *instr, instr_snapshot_s *snapshot) {
+    uint32_t slot, seq;
+
+    while (begin_staged_read(instr, &seq)) {
+        memcpy(snapshot, instr->staged_snapshot, sizeof(*snapshot));
+        if (end_staged_read(instr, seq)) return;
+    }
+
+    do {
+        slot = begin_snapshot_read(instr, &seq);
+        memcpy(snapshot, &instr->snapshots[slot], sizeof(*snapshot));
+    } while (!end_snapshot_read(instr, slot, seq));
+}
+
+bpbxsyn_synth_type_e instr_snapshot_type(const instr_snapshot_s *snapshot) {
+    return snapshot->type;
+}
+
+uint32_t instr_snapshot_params_count(const instr_snapshot_s *snapshot) {
+    const instr_param_layout_s *layout = instr_param_layout(snapshot->type);
+    assert(layout);
+    return layout->count;
+}
+
+instr_param_id instr_snapshot_param(const instr_snapshot_s *snapshot,
+                                    uint32_t index, bool *is_inactive,
+                                    double *value)
+{
+    const instr_param_layout_s *layout = instr_param_layout(snapshot->type);
+    assert(layout);
+
+    if (index >= layout->count) {
+        if (is_inactive) *is_inactive = false;
+        return INSTR_INVALID_ID;
+    }
+
+    if (is_inactive)
+        *is_inactive = layout->params[index].inactive;
+    if (value)
+        *value = snapshot->values[index];
+
+    return layout->params[index].id;
+}
+
+const bpbxsyn_envelope_s* instr_snapshot_envelopes(
+    const instr_snapshot_s *snapshot, uint32_t *count)
+{
+    *count = snapshot->envelope_count;
+    return snapshot->envelopes;
+}
+
+bool instr_get_published_param(const instrument_s *instr, instr_param_id id,
+                               double *value)
+{
+    uint32_t seq;
+
+    while (begin_staged_read(instr, &seq)) {
+        double v = 0.0;
+        const bool found = snapshot_get_param(instr->staged_snapshot, id, &v);
+        if (end_staged_read(instr, seq)) {
+            if (found) *value = v;
+            return found;
+        }
+    }
+
+    return read_snapshot_param(instr, id, value);
+}
+
 bool instr_get_param(const instrument_s *instr, instr_param_id id, double *value) {
     assert(id != INSTR_INVALID_ID);
     if (id == INSTR_INVALID_ID) return false;
 
+    // the host only sees the value without modulation
+    if (instr->mod_count > 0) {
+        const uint32_t mod = find_mod(instr, instr_typed_param_id(instr, id));
+        if (mod != UINT32_MAX) {
+            *value = instr->mods[mod].base;
+            return true;
+        }
+    }
+
     instr_module_e module;
     instr_param_id idx;
     instr_local_id(id, &module, &idx);
@@ -733,6 +1997,14 @@ bool instr_get_param(const instrument_s *instr, instr_param_id id, double *value
             if (idx >= BPBXSYN_BASE_PARAM_COUNT + MAX_SYNTH_PARAM_COUNT)
                 return false;
 
+            // param of another synth type. report its default value.
+            if (!is_current_synth_param(instr, id)) {
+                const bpbxsyn_param_info_s *info =
+                    instr_type_param_info(instr->type, id);
+                *value = info ? info->default_value : 0.0;
+                return true;
+            }
+
             // unused param
             if (idx >= bpbxsyn_synth_param_count(instr->type)) {
                 *value = 0.0;
@@ -785,17 +2057,32 @@ bool instr_get_param(const instrument_s *instr, instr_param_id id, double *value
             return true;
         
         default:
-            if (is_effect(module) && instr->effect_modules[module - INSTR_FIRST_EFFECT_MODULE]) {
-                return !bpbxsyn_effect_get_param_double(
-                    instr->effect_modules[module - INSTR_FIRST_EFFECT_MODULE], idx, value);
+            if (!is_effect(module) || !instr_has_module(instr, module))
+                return false;
+
+            const bpbxsyn_effect_type_e type =
+                module - INSTR_FIRST_EFFECT_MODULE;
+            if (is_lazy_effect(type)) {
+                if (idx >= lazy_effect_param_counts[type - INSTR_LAZY_EFFECT_FIRST])
+                    return false;
+
+                *value = instr->lazy_fx[type - INSTR_LAZY_EFFECT_FIRST].params[idx];
+                return true;
             }
 
-            return false;
+            return !bpbxsyn_effect_get_param_double(
+                instr->effect_modules[type], idx, value);
     }
 }
 
 const bpbxsyn_param_info_s* instr_get_param_info(const instrument_s *instr,
                                                  instr_param_id id)
+{
+    return instr_type_param_info(instr->type, id);
+}
+
+const bpbxsyn_param_info_s* instr_type_param_info(bpbxsyn_synth_type_e type,
+                                                  instr_param_id id)
 {
     assert(id != INSTR_INVALID_ID);
     if (id == INSTR_INVALID_ID) return NULL;
@@ -807,10 +2094,15 @@ const bpbxsyn_param_info_s* instr_get_param_info(const instrument_s *instr,
     switch (module) {
         case INSTR_MODULE_SYNTH:
             assert(idx < BPBXSYN_BASE_PARAM_COUNT + MAX_SYNTH_PARAM_COUNT);
-            if (idx >= bpbxsyn_synth_param_count(instr->type))
+
+            // typed ids always refer to the param of their own type
+            if (instr_param_synth_type(id) != -1)
+                type = (bpbxsyn_synth_type_e)instr_param_synth_type(id);
+
+            if (idx >= bpbxsyn_synth_param_count(type))
                 return &unused_param_info;
 
-            return bpbxsyn_synth_param_info(instr->type, idx);
+            return bpbxsyn_synth_param_info(type, idx);
         
         case INSTR_MODULE_CONTROL:
             return &control_param_info[idx];
@@ -837,7 +2129,7 @@ void instr_local_id(instr_param_id global_id, instr_module_e *out_module,
     if (out_local_index)
         *out_local_index = global_id & 0xFFFF;
     if (out_module)
-        *out_module = global_id >> 16;
+        *out_module = (global_id >> 16) & 0xF;
 }
 
 static const bpbxsyn_param_info_s unused_param_info = {
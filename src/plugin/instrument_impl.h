@@ -3,8 +3,47 @@
 
 #include "include/instrument.h"
 #include <stdint.h>
+#include "main_queue.h"
 #include "atomic_bool.h"
 
+// length of the crossfade when the synth type is changed while active
+#define INSTR_SYNTH_SWAP_FADE_MS 20.0
+
+// how many params can be modulated by the host at the same time
+#define INSTR_MOD_SLOT_COUNT 32
+
+// snapshots kept for readers, see instr_publish_snapshot
+#define INSTR_SNAPSHOT_SLOTS 3
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// distortion, bitcrusher, chorus, echo and reverb. these are only
+// allocated while the instrument is active or they are enabled.
+#define INSTR_LAZY_EFFECT_FIRST BPBXSYN_EFFECT_DISTORTION
+#define INSTR_LAZY_EFFECT_COUNT 5
+
+#define INSTR_LAZY_EFFECT_MAX_PARAM_COUNT (                                    \
+        MAX(BPBXSYN_DISTORTION_PARAM_COUNT,                                    \
+        MAX(BPBXSYN_BITCRUSHER_PARAM_COUNT,                                    \
+        MAX(BPBXSYN_CHORUS_PARAM_COUNT,                                        \
+        MAX(BPBXSYN_ECHO_PARAM_COUNT,                                          \
+            BPBXSYN_REVERB_PARAM_COUNT)                                        \
+        )))                                                                    \
+    )
+
+typedef struct {
+    // param values, which outlive the effect module
+    double params[INSTR_LAZY_EFFECT_MAX_PARAM_COUNT];
+
+    // while active, the module of a disabled effect waits in ready, so that
+    // the audio thread can start it as soon as the effect is enabled and
+    // put it back once it is disabled. if ready is empty, the audio thread
+    // asks the main thread to fill it through requested. modules are only
+    // created and destroyed on the main thread.
+    atomic_bool requested;
+    atomic_ptr ready;
+} instr_lazy_effect_s;
+
 typedef struct {
    bool active;
 
@@ -14,12 +53,133 @@ typedef struct {
    int16_t key;
 } voice_s;
 
+// use the param count of the generator that has the most number of
+// parameters
+#define MAX_SYNTH_PARAM_COUNT ((                                               \
+        MAX(BPBXSYN_CHIP_PARAM_COUNT,                                          \
+        MAX(BPBXSYN_FM_PARAM_COUNT,                                            \
+        MAX(BPBXSYN_NOISE_PARAM_COUNT,                                         \
+        MAX(BPBXSYN_PULSE_WIDTH_PARAM_COUNT,                                   \
+        MAX(BPBXSYN_CUSTOM_CHIP_PARAM_COUNT,                                   \
+        MAX(BPBXSYN_HARMONICS_PARAM_COUNT,                                     \
+        MAX(BPBXSYN_SPECTRUM_PARAM_COUNT,                                      \
+        MAX(BPBXSYN_PICKED_STRING_PARAM_COUNT,                                 \
+            BPBXSYN_SUPERSAW_PARAM_COUNT)                                      \
+        )))))))                                                                \
+    ))
+
+// sum of the specific param counts of every synth type
+#define INSTR_ALL_SYNTH_PARAM_COUNT (                                          \
+        BPBXSYN_CHIP_PARAM_COUNT                                               \
+        + BPBXSYN_FM_PARAM_COUNT                                               \
+        + BPBXSYN_NOISE_PARAM_COUNT                                            \
+        + BPBXSYN_PULSE_WIDTH_PARAM_COUNT                                      \
+        + BPBXSYN_CUSTOM_CHIP_PARAM_COUNT                                      \
+        + BPBXSYN_HARMONICS_PARAM_COUNT                                        \
+        + BPBXSYN_SPECTRUM_PARAM_COUNT                                         \
+        + BPBXSYN_PICKED_STRING_PARAM_COUNT                                    \
+        + BPBXSYN_SUPERSAW_PARAM_COUNT                                         \
+    )
+
+// total number of parameters exposed to the host. the synth params of
+// every type are listed, with the ones of other types hidden.
+#define INSTR_PARAM_COUNT (                                                    \
+        BPBXSYN_BASE_PARAM_COUNT                                               \
+        + INSTR_ALL_SYNTH_PARAM_COUNT                                          \
+        + INSTR_CPARAM_COUNT                                                   \
+        + BPBXSYN_VOLUME_PARAM_COUNT                                           \
+        + BPBXSYN_PANNING_PARAM_COUNT                                          \
+        + BPBXSYN_EQ_PARAM_COUNT                                               \
+        + BPBXSYN_DISTORTION_PARAM_COUNT                                       \
+        + BPBXSYN_BITCRUSHER_PARAM_COUNT                                       \
+        + BPBXSYN_CHORUS_PARAM_COUNT                                           \
+        + BPBXSYN_ECHO_PARAM_COUNT                                             \
+        + BPBXSYN_REVERB_PARAM_COUNT                                           \
+    )
+
+// words of the dirty bits of a snapshot
+#define INSTR_SNAPSHOT_DIRTY_WORDS ((INSTR_PARAM_COUNT + 63) / 64)
+
+// modulation of a param by the host. the modulated value is not visible
+// to the host, which only sees the base value.
+typedef struct {
+    instr_param_id id;
+    const bpbxsyn_param_info_s *info;
+
+    // value set by the host or the gui
+    double base;
+    double amount;
+
+    // base + amount was not written to the module yet
+    bool dirty;
+} instr_param_mod_s;
+
 typedef struct instrument {
     bpbxsyn_synth_type_e type;
     uint8_t type_index;
     uint8_t new_type_index;
 
     bpbxsyn_synth_s *synth;
+    bpbxsyn_context_s *ctx;
+    bool is_active;
+
+    // synth type changes while active. the main thread creates the synth
+    // of the new type and hands it to the audio thread through ready_synth.
+    // the audio thread swaps it in at the next tick and crossfades from the
+    // old synth, which is handed back through the main queue to be
+    // destroyed.
+    atomic_bool swap_requested;
+    atomic_bool synth_swapped;
+    atomic_ptr ready_synth;
+
+    // owned by the audio thread. retire_synth and retire_shadow wait for
+    // room in the main queue.
+    bpbxsyn_synth_s *fade_synth;
+    bpbxsyn_synth_s *retire_synth;
+    struct instr_shadow *retire_shadow;
+    uint32_t fade_pos;
+    uint32_t fade_frames;
+    float *fade_buffer;
+
+    // loaded state handed to the audio thread as a whole, see
+    // instr_publish_shadow. it is applied like a synth type change, and the
+    // emptied shadow goes back through the main queue to be freed.
+    atomic_ptr pending_shadow;
+
+    // published params and envelopes. the owner fills the slot after the
+    // latest one while readers copy the latest, so readers only retry when
+    // they fall two publishes behind. the sequence of a slot is odd while it
+    // is being written.
+    instr_snapshot_s *snapshots;
+    atomic_uint snapshot_seqs[INSTR_SNAPSHOT_SLOTS];
+    atomic_uint latest_snapshot;
+    bool snapshot_dirty;
+
+    // params changed since each slot was last written, by index in the
+    // param layout. slots with snapshot_rebuild set are written as a whole,
+    // such as after the synth was replaced.
+    uint64_t snapshot_dirty_bits[INSTR_SNAPSHOT_SLOTS][INSTR_SNAPSHOT_DIRTY_WORDS];
+    bool snapshot_rebuild[INSTR_SNAPSHOT_SLOTS];
+
+    // owned by the audio thread. a swapped synth is announced to the main
+    // thread once it is in the snapshot.
+    bool announce_swap;
+
+    // state that was loaded while active, as it will be once the audio
+    // thread applies it. readers see it instead of the snapshots until then.
+    // written by the main thread, with staged_seq odd while it is written.
+    // it is dropped once the audio thread announces the shadow of the same
+    // generation.
+    instr_snapshot_s *staged_snapshot;
+    atomic_uint staged_seq;
+    atomic_bool staged;
+    uint32_t staged_generation;
+    atomic_uint applied_generation;
+
+    // owned by the audio thread. generation of the last shadow it applied.
+    uint32_t announce_generation;
+
+    uint32_t init_flags;
 
     bool use_distortion;
     bool use_bitcrusher;
@@ -50,7 +210,17 @@ typedef struct instrument {
         } fx;
     };
 
+    // modules of the lazy effects come and go, see instr_lazy_effect_s
+    instr_lazy_effect_s lazy_fx[INSTR_LAZY_EFFECT_COUNT];
+
     uint32_t frames_until_next_tick;
+
+    // params modulated by the host, owned by the audio thread. modulation
+    // events only update this table, and the modulated values are written
+    // to the modules at the next tick.
+    instr_param_mod_s mods[INSTR_MOD_SLOT_COUNT];
+    uint32_t mod_count;
+    bool mods_dirty;
     
     // mono output buffer for the synth
     float *synth_mono_buffer;
@@ -63,7 +233,6 @@ typedef struct instrument {
     double bpm;
     double cur_beat;
     bool is_playing;
-    atomic_bool need_param_rescan;
 
     double gain;
     bool tempo_use_override;
@@ -79,8 +248,63 @@ typedef struct instrument {
 
     const clap_host_t *clap_host;
     const clap_host_params_t *clap_host_params;
+
+    // owned by the plugin, used for host notifications
+    main_queue_s *main_queue;
+
+    // set while the host renders offline. the audio thread then creates and
+    // destroys synths and effect modules itself, as it need not avoid
+    // allocation and would otherwise wait on main thread callbacks.
+    atomic_bool render_offline;
 } instrument_s;
 
+struct instr_snapshot {
+    bpbxsyn_synth_type_e type;
+
+    // by index in the param layout of the synth type. readable is false
+    // for params whose module does not exist.
+    double values[INSTR_PARAM_COUNT];
+    bool readable[INSTR_PARAM_COUNT];
+
+    uint32_t envelope_count;
+    bpbxsyn_envelope_s envelopes[BPBXSYN_MAX_ENVELOPE_COUNT];
+};
+
+// detached copy of the state of an instrument, such as a loaded preset. it
+// is built on the main thread while the audio thread keeps using the
+// instrument.
+typedef struct instr_shadow {
+    bpbxsyn_synth_type_e type;
+    uint8_t type_index;
+
+    // set by instr_publish_shadow, see staged_snapshot
+    uint32_t generation;
+
+    // synth with the synth params and envelopes already applied
+    bpbxsyn_synth_s *synth;
+
+    // params of the other modules, applied along with the synth
+    instr_param_value_s values[INSTR_PARAM_COUNT];
+    uint32_t value_count;
+} instr_shadow_s;
+
+// returns NULL if the synth type is not implemented or on allocation
+// failure
+instr_shadow_s* instr_shadow_new(const instrument_s *instr,
+                                 bpbxsyn_synth_type_e type);
+void instr_shadow_free(instr_shadow_s *shadow);
+
+// synth params are written to the synth of the shadow. the synth type
+// param is ignored, as that is given by the synth.
+bool instr_shadow_set_params(instr_shadow_s *shadow,
+                             instr_param_value_s *params, uint32_t count);
+
+// hand the shadow over to the instrument, which takes ownership of it.
+// while active, the audio thread applies it at its next tick and
+// crossfades from the old synth, and instr_on_main_thread asks for a param
+// rescan afterwards. otherwise it is applied right away.
+bool instr_publish_shadow(instrument_s *instr, instr_shadow_s *shadow);
+
 extern const bpbxsyn_synth_type_e instr_synth_type_values[BPBXSYN_SYNTH_COUNT];
 
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "include/log_ring.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "atomic_bool.h"
+
+// must be a power of two
+#define LOG_RING_CAPACITY 64
+
+typedef struct {
+    // the writer of position pos waits for the entry to be at pos, and the
+    // reader for pos + 1
+    atomic_uint seq;
+
+    clap_log_severity severity;
+    log_msg_e msg;
+    log_arg_u args[LOG_RING_MAX_ARGS];
+    char text[LOG_RING_TEXT_SIZE];
+} log_entry_s;
+
+struct log_ring {
+    log_entry_s entries[LOG_RING_CAPACITY];
+    atomic_uint write_index;
+    atomic_uint dropped;
+
+    // owned by the main thread
+    unsigned int read_index;
+};
+
+static const uint8_t msg_arg_counts[LOG_MSG_COUNT] = {
+    [LOG_MSG_TEXT] = 0,
+    [LOG_MSG_SYNTH_MEMORY] = 4,
+};
+
+log_ring_s* log_ring_new(void) {
+    log_ring_s *ring = calloc(1, sizeof(log_ring_s));
+    if (!ring) return NULL;
+
+    for (unsigned int i = 0; i < LOG_RING_CAPACITY; ++i)
+        atomic_store(&ring->entries[i].seq, i);
+
+    return ring;
+}
+
+void log_ring_free(log_ring_s *ring) {
+    free(ring);
+}
+
+bool log_ring_push(log_ring_s *ring, clap_log_severity severity,
+                   log_msg_e msg, const log_arg_u *args, const char *text)
+{
+    assert(msg < LOG_MSG_COUNT);
+
+    // claim a position. other writers may claim it first, in which case
+    // the next one is tried.
+    unsigned int pos = atomic_load(&ring->write_index);
+    log_entry_s *entry;
+    for (;;) {
+        entry = &ring->entries[pos & (LOG_RING_CAPACITY - 1)];
+        const int diff = (int)(atomic_load(&entry->seq) - pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak(&ring->write_index, &pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            // not read yet since the previous lap
+            atomic_fetch_add(&ring->dropped, 1);
+            return false;
+        } else {
+            pos = atomic_load(&ring->write_index);
+        }
+    }
+
+    entry->severity = severity;
+    entry->msg = msg;
+
+    for (int i = 0; i < msg_arg_counts[msg]; ++i)
+        entry->args[i] = args[i];
+
+    // copied by hand, as strcpy_s does not truncate
+    size_t len = 0;
+    if (text) {
+        while (len < LOG_RING_TEXT_SIZE - 1 && text[len]) {
+            entry->text[len] = text[len];
+            ++len;
+        }
+    }
+    entry->text[len] = '\0';
+
+    atomic_store(&entry->seq, pos + 1);
+    return true;
+}
+
+bool log_ring_defer(log_ring_s *ring, const clap_host_t *host,
+                    clap_log_severity severity, log_msg_e msg,
+                    const log_arg_u *args, const char *text)
+{
+    if (!log_ring_push(ring, severity, msg, args, text))
+        return false;
+
+    host->request_callback(host);
+    return true;
+}
+
+static void format_entry(const log_entry_s *entry, char *buf, size_t size) {
+    const log_arg_u *args = entry->args;
+
+    switch (entry->msg) {
+        case LOG_MSG_TEXT:
+            snprintf(buf, size, "%s", entry->text);
+            break;
+
+        case LOG_MSG_SYNTH_MEMORY:
+            snprintf(buf, size, "synth memory: %llu bytes in use, %llu peak, %llu reserved, %llu allocations",
+                     (unsigned long long)args[0].u,
+                     (unsigned long long)args[1].u,
+                     (unsigned long long)args[2].u,
+                     (unsigned long long)args[3].u);
+            break;
+
+        default:
+            snprintf(buf, size, "unknown log message %i", (int)entry->msg);
+            break;
+    }
+}
+
+void log_ring_flush(log_ring_s *ring, const clap_host_t *host,
+                    log_ring_deliver_f deliver)
+{
+    char buf[LOG_RING_TEXT_SIZE + 128];
+
+    for (;;) {
+        const unsigned int pos = ring->read_index;
+        log_entry_s *entry = &ring->entries[pos & (LOG_RING_CAPACITY - 1)];
+        if (atomic_load(&entry->seq) != pos + 1)
+            break;
+
+        format_entry(entry, buf, sizeof(buf));
+        const clap_log_severity severity = entry->severity;
+
+        // free for the writer one lap ahead
+        atomic_store(&entry->seq, pos + LOG_RING_CAPACITY);
+        ring->read_index = pos + 1;
+
+        if (deliver)
+            deliver(host, severity, buf);
+    }
+
+    const unsigned int dropped = atomic_load(&ring->dropped);
+    if (dropped == 0) return;
+
+    atomic_fetch_sub(&ring->dropped, dropped);
+    if (deliver) {
+        snprintf(buf, sizeof(buf), "%u log messages were dropped", dropped);
+        deliver(host, CLAP_LOG_WARNING, buf);
+    }
+}
@@ -0,0 +1,142 @@
+#include "main_queue.h"
+
+#include <assert.h>
+
+void main_queue_init(main_queue_s *queue) {
+    for (unsigned int i = 0; i < MAIN_QUEUE_CAPACITY; ++i)
+        atomic_store(&queue->slots[i].seq, i);
+
+    atomic_store(&queue->write_index, 0);
+    queue->read_index = 0;
+}
+
+bool main_queue_push(main_queue_s *queue, const main_task_s *task) {
+    // claim a position. other writers may claim it first, in which case
+    // the next one is tried.
+    unsigned int pos = atomic_load(&queue->write_index);
+    main_queue_slot_s *slot;
+    for (;;) {
+        slot = &queue->slots[pos & (MAIN_QUEUE_CAPACITY - 1)];
+        const int diff = (int)(atomic_load(&slot->seq) - pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak(&queue->write_index, &pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            // not read yet since the previous lap
+            return false;
+        } else {
+            pos = atomic_load(&queue->write_index);
+        }
+    }
+
+    slot->task = *task;
+    atomic_store(&slot->seq, pos + 1);
+    return true;
+}
+
+bool main_queue_pop(main_queue_s *queue, main_task_s *task) {
+    const unsigned int pos = queue->read_index;
+    main_queue_slot_s *slot = &queue->slots[pos & (MAIN_QUEUE_CAPACITY - 1)];
+    if (atomic_load(&slot->seq) != pos + 1)
+        return false;
+
+    *task = slot->task;
+
+    // free for the writer one lap ahead
+    atomic_store(&slot->seq, pos + MAIN_QUEUE_CAPACITY);
+    queue->read_index = pos + 1;
+    return true;
+}
+
+bool main_queue_defer(main_queue_s *queue, const clap_host_t *host,
+                      const main_task_s *task)
+{
+    if (!main_queue_push(queue, task))
+        return false;
+
+    host->request_callback(host);
+    return true;
+}
+
+bool main_queue_defer_synth_destroy(main_queue_s *queue,
+                                    const clap_host_t *host,
+                                    bpbxsyn_synth_s *synth)
+{
+    if (!synth) return true;
+
+    main_task_s task = {
+        .type = MAIN_TASK_DESTROY_SYNTH,
+        .synth = synth
+    };
+
+    return main_queue_defer(queue, host, &task);
+}
+
+bool main_queue_defer_effect_destroy(main_queue_s *queue,
+                                     const clap_host_t *host,
+                                     bpbxsyn_effect_s *effect)
+{
+    if (!effect) return true;
+
+    main_task_s task = {
+        .type = MAIN_TASK_DESTROY_EFFECT,
+        .effect = effect
+    };
+
+    return main_queue_defer(queue, host, &task);
+}
+
+bool main_queue_defer_call(main_queue_s *queue, const clap_host_t *host,
+                           void (*func)(void *userdata), void *userdata)
+{
+    main_task_s task = {
+        .type = MAIN_TASK_CALL,
+        .call.func = func,
+        .call.userdata = userdata
+    };
+
+    return main_queue_defer(queue, host, &task);
+}
+
+bool main_queue_defer_rescan(main_queue_s *queue, const clap_host_t *host,
+                             clap_param_rescan_flags flags)
+{
+    main_task_s task = {
+        .type = MAIN_TASK_PARAM_RESCAN,
+        .rescan_flags = flags
+    };
+
+    return main_queue_defer(queue, host, &task);
+}
+
+void main_queue_run(main_queue_s *queue, const clap_host_t *host,
+                    const clap_host_params_t *host_params)
+{
+    // rescans requested several times are only passed to the host once
+    clap_param_rescan_flags rescan_flags = 0;
+
+    main_task_s task;
+    while (main_queue_pop(queue, &task)) {
+        switch (task.type) {
+            case MAIN_TASK_DESTROY_SYNTH:
+                bpbxsyn_synth_destroy(task.synth);
+                break;
+
+            case MAIN_TASK_DESTROY_EFFECT:
+                bpbxsyn_effect_destroy(task.effect);
+                break;
+
+            case MAIN_TASK_PARAM_RESCAN:
+                rescan_flags |= task.rescan_flags;
+                break;
+
+            case MAIN_TASK_CALL:
+                task.call.func(task.call.userdata);
+                break;
+        }
+    }
+
+    if (rescan_flags && host_params)
+        host_params->rescan(host, rescan_flags);
+}
@@ -0,0 +1,80 @@
+// lock-free queue of tasks deferred from the audio thread to the main thread,
+// such as destroying retired modules and notifying the host. any thread may
+// push tasks, including the worker threads of the multi plugin, and tasks
+// are run by main_queue_run on the main thread. log messages go through
+// log_ring.h instead.
+#ifndef _bpbxclap_main_queue_h_
+#define _bpbxclap_main_queue_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <cbeepsynth/synth/include/beepbox_synth.h>
+#include <clap/clap.h>
+#include "atomic_bool.h"
+
+// must be a power of two
+#define MAIN_QUEUE_CAPACITY 128
+
+typedef enum {
+    MAIN_TASK_DESTROY_SYNTH,
+    MAIN_TASK_DESTROY_EFFECT,
+    MAIN_TASK_PARAM_RESCAN,
+    MAIN_TASK_CALL,
+} main_task_type_e;
+
+typedef struct {
+    main_task_type_e type;
+
+    union {
+        bpbxsyn_synth_s *synth;
+        bpbxsyn_effect_s *effect;
+        clap_param_rescan_flags rescan_flags;
+
+        struct {
+            void (*func)(void *userdata);
+            void *userdata;
+        } call;
+    };
+} main_task_s;
+
+typedef struct {
+    // the writer of position pos waits for the slot to be at pos, and the
+    // reader for pos + 1
+    atomic_uint seq;
+    main_task_s task;
+} main_queue_slot_s;
+
+typedef struct {
+    main_queue_slot_s slots[MAIN_QUEUE_CAPACITY];
+    atomic_uint write_index;
+
+    // owned by the main thread
+    unsigned int read_index;
+} main_queue_s;
+
+void main_queue_init(main_queue_s *queue);
+
+// returns false if the queue is full
+bool main_queue_push(main_queue_s *queue, const main_task_s *task);
+bool main_queue_pop(main_queue_s *queue, main_task_s *task);
+
+// push a task and ask the host for a main thread callback. if the queue is
+// full, the caller keeps what it wanted to hand over and tries again later.
+bool main_queue_defer(main_queue_s *queue, const clap_host_t *host,
+                      const main_task_s *task);
+bool main_queue_defer_synth_destroy(main_queue_s *queue,
+                                    const clap_host_t *host,
+                                    bpbxsyn_synth_s *synth);
+bool main_queue_defer_effect_destroy(main_queue_s *queue,
+                                     const clap_host_t *host,
+                                     bpbxsyn_effect_s *effect);
+bool main_queue_defer_call(main_queue_s *queue, const clap_host_t *host,
+                           void (*func)(void *userdata), void *userdata);
+bool main_queue_defer_rescan(main_queue_s *queue, const clap_host_t *host,
+                             clap_param_rescan_flags flags);
+
+// run every queued task. called from the main thread.
+void main_queue_run(main_queue_s *queue, const clap_host_t *host,
+                    const clap_host_params_t *host_params);
+
+#endif
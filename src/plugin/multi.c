@@ -0,0 +1,1367 @@
+#include "multi_impl.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cbeepsynth/synth/include/beepbox_synth.h>
+#include "system.h"
+#include "util.h"
+#include "instr_tables.h"
+#include "state.h"
+
+static const bpbxsyn_effect_type_e bus_effect_types[MULTI_SEND_COUNT] = {
+    BPBXSYN_EFFECT_ECHO, BPBXSYN_EFFECT_REVERB
+};
+
+static const instr_module_e bus_effect_modules[MULTI_SEND_COUNT] = {
+    INSTR_MODULE_ECHO, INSTR_MODULE_REVERB
+};
+
+static const uint32_t bus_effect_param_counts[MULTI_SEND_COUNT] = {
+    BPBXSYN_ECHO_PARAM_COUNT, BPBXSYN_REVERB_PARAM_COUNT
+};
+
+static const bpbxsyn_param_info_s send_param_info[MULTI_SEND_COUNT] = {
+    {
+        .group = "Sends",
+        .name = "Echo Send",
+        .id = "sndEcho\0",
+        .type = BPBXSYN_PARAM_DOUBLE,
+
+        .min_value = 0.0,
+        .max_value = 1.0,
+        .default_value = 0.0,
+    },
+    {
+        .group = "Sends",
+        .name = "Reverb Send",
+        .id = "sndRevrb",
+        .type = BPBXSYN_PARAM_DOUBLE,
+
+        .min_value = 0.0,
+        .max_value = 1.0,
+        .default_value = 0.0,
+    },
+};
+
+static void bpbx_log_cb(bpbxsyn_log_severity_e severity, const char *msg, void *userdata) {
+   multi_s *multi = (multi_s*)userdata;
+
+   // slots log from the audio thread, or from worker threads when
+   // rendering offline. the ring takes messages from any of them.
+   log_ring_defer(multi->log_ring, multi->host, instr_log_severity(severity),
+                  LOG_MSG_TEXT, NULL, msg);
+}
+
+static bool event_buffer_push(const clap_output_events_t *list,
+                              const clap_event_header_t *event);
+
+void multi_create(multi_s *multi) {
+    main_queue_init(&multi->main_queue);
+    multi->bpm = 150.0;
+}
+
+static void build_slot_param_map(multi_s *multi) {
+    // param ids are at the same indices for every synth type, so any layout
+    // will do
+    const instr_param_layout_s *layout =
+        instr_param_layout(BPBXSYN_SYNTH_CHIP);
+    assert(layout);
+
+    const instr_param_id echo_toggle =
+        instr_global_id(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_ECHO);
+    const instr_param_id reverb_toggle =
+        instr_global_id(INSTR_MODULE_CONTROL, INSTR_CPARAM_ENABLE_REVERB);
+
+    multi->slot_param_count = 0;
+    for (uint32_t i = 0; i < layout->count; ++i) {
+        instr_param_id id = layout->params[i].id;
+        if (id == echo_toggle || id == reverb_toggle) continue;
+
+        instr_module_e module;
+        instr_local_id(id, &module, NULL);
+        if (module == INSTR_MODULE_ECHO || module == INSTR_MODULE_REVERB)
+            continue;
+
+        multi->slot_param_map[multi->slot_param_count++] = (uint16_t)i;
+    }
+}
+
+bool multi_init(multi_s *multi) {
+    multi->host_log = (const clap_host_log_t *)multi->host->get_extension(multi->host, CLAP_EXT_LOG);
+    multi->host_thread_check = (const clap_host_thread_check_t *)multi->host->get_extension(multi->host, CLAP_EXT_THREAD_CHECK);
+    multi->host_state = (const clap_host_state_t *)multi->host->get_extension(multi->host, CLAP_EXT_STATE);
+    multi->host_params = (const clap_host_params_t *)multi->host->get_extension(multi->host, CLAP_EXT_PARAMS);
+
+    if (!plugin_static_init()) return false;
+    multi->has_static_ref = true;
+
+    build_slot_param_map(multi);
+
+    multi->arena = synth_arena_new();
+    if (!multi->arena) return false;
+
+    bpbxsyn_allocator_s alloc = synth_arena_allocator(multi->arena);
+    multi->ctx = bpbxsyn_context_new(&alloc);
+    if (!multi->ctx) return false;
+
+    if (multi->host_log) {
+        multi->log_ring = log_ring_new();
+        if (!multi->log_ring) return false;
+
+        bpbxsyn_set_log_func(multi->ctx, bpbx_log_cb, multi);
+    }
+
+    for (int i = 0; i < MULTI_SLOT_COUNT; ++i) {
+        instrument_s *instr = &multi->slots[i].instrument;
+        if (!instr_init(instr, multi->ctx, BPBXSYN_SYNTH_CHIP,
+                        INSTR_INIT_NO_SEND_EFFECTS))
+            return false;
+
+        instr->clap_host = multi->host;
+        instr->clap_host_params = multi->host_params;
+        instr->main_queue = &multi->main_queue;
+
+        multi_event_buffer_s *events = &multi->slots[i].out_events;
+        events->list.ctx = events;
+        events->list.try_push = event_buffer_push;
+    }
+
+    for (int i = 0; i < MULTI_SEND_COUNT; ++i) {
+        multi->bus_effects[i] = bpbxsyn_effect_new(multi->ctx,
+                                                   bus_effect_types[i]);
+        if (!multi->bus_effects[i]) return false;
+
+        for (uint32_t j = 0; j < bus_effect_param_counts[i]; ++j) {
+            if (bpbxsyn_effect_get_param_double(multi->bus_effects[i], j,
+                                                &multi->published.bus_params[i][j]))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void multi_destroy(multi_s *multi) {
+    multi_deactivate(multi);
+    main_queue_run(&multi->main_queue, multi->host, NULL);
+
+    worker_pool_free(multi->worker_pool);
+    multi->worker_pool = NULL;
+
+    // slots that were not initialized are zeroed, which instr_destroy
+    // handles
+    for (int i = 0; i < MULTI_SLOT_COUNT; ++i) {
+        instr_destroy(&multi->slots[i].instrument);
+    }
+
+    for (int i = 0; i < MULTI_SEND_COUNT; ++i) {
+        if (multi->bus_effects[i])
+            bpbxsyn_effect_destroy(multi->bus_effects[i]);
+        multi->bus_effects[i] = NULL;
+    }
+
+    if (multi->ctx) {
+        bpbxsyn_context_destroy(multi->ctx);
+        multi->ctx = NULL;
+    }
+
+    // the synth may log until its context is gone
+    if (multi->log_ring) {
+        log_ring_flush(multi->log_ring, multi->host, multi->host_log->log);
+        log_ring_free(multi->log_ring);
+        multi->log_ring = NULL;
+    }
+
+    synth_arena_free(multi->arena);
+    multi->arena = NULL;
+
+    if (multi->has_static_ref) {
+        plugin_static_deinit();
+        multi->has_static_ref = false;
+    }
+}
+
+// create or free the worker pool to match the render mode. must only be
+// called while the plugin is inactive.
+static void update_worker_pool(multi_s *multi) {
+    assert(!multi->is_active);
+
+    if (multi->render_offline && !multi->worker_pool) {
+        uint32_t thread_count = worker_pool_hardware_threads();
+        if (thread_count > MULTI_SLOT_COUNT)
+            thread_count = MULTI_SLOT_COUNT;
+
+        // NULL if threads are not available, in which case slots are
+        // processed serially
+        multi->worker_pool = worker_pool_new(thread_count);
+    } else if (!multi->render_offline && multi->worker_pool) {
+        worker_pool_free(multi->worker_pool);
+        multi->worker_pool = NULL;
+    }
+}
+
+void multi_set_render_mode(multi_s *multi, bool offline) {
+    atomic_store(&multi->render_offline, offline);
+    for (int i = 0; i < MULTI_SLOT_COUNT; ++i)
+        instr_set_render_mode(&multi->slots[i].instrument, offline);
+
+    // otherwise, picked up on the next activation
+    if (!multi->is_active)
+        update_worker_pool(multi);
+}
+
+bool multi_activate(multi_s *multi, double sample_rate,
+                    uint32_t min_frames_count, uint32_t max_frames_count)
+{
+    update_worker_pool(multi);
+
+    multi->sample_rate = sample_rate;
+    multi->bus_frames_until_next_tick = 0;
+
+    for (int i = 0; i < MULTI_SLOT_COUNT; ++i) {
+        multi_slot_s *slot = &multi->slots[i];
+        if (!instr_activate(&slot->instrument, multi->ctx, sample_rate,
+                            max_frames_count))
+            return false;
+
+        for (int c = 0; c < 2; ++c) {
+            free(slot->output[c]);
+            slot->output[c] = malloc(max_frames_count * sizeof(float));
+            if (!slot->output[c]) return false;
+        }
+    }
+
+    for (int i = 0; i < MULTI_SEND_COUNT; ++i) {
+        bpbxsyn_effect_set_sample_rate(multi->bus_effects[i], sample_rate);
+
+        for (int c = 0; c < 2; ++c) {
+            free(multi->bus_block[i][c]);
+            multi->bus_block[i][c] = malloc(max_frames_count * sizeof(float));
+            if (!multi->bus_block[i][c]) return false;
+        }
+    }
+
+    multi->is_active = true;
+    return true;
+}
+
+static void apply_shadow(multi_s *multi, const multi_shadow_s *shadow);
+
+bool multi_deactivate(multi_s *multi) {
+    #ifdef PLUGIN_ALLOC_STATS
+    if (multi->is_active && multi->log_ring) {
+        synth_arena_stats_s stats;
+        synth_arena_get_stats(multi->arena, &stats);
+
+        const log_arg_u args[] = {
+            { .u = stats.current_bytes },
+            { .u = stats.peak_bytes },
+            { .u = stats.reserved_bytes },
+            { .u = stats.alloc_count },
+        };
+        log_ring_defer(multi->log_ring, multi->host, CLAP_LOG_DEBUG,
+                       LOG_MSG_SYNTH_MEMORY, args, NULL);
+    }
+    #endif
+
+    multi->is_active = false;
+
+    free(multi->retire_shadow);
+    multi->retire_shadow = NULL;
+
+    // state that was loaded but not picked up by the audio thread
+    multi_shadow_s *pending = atomic_exchange_ptr(&multi->pending_shadow, NULL);
+    if (pending) {
+        apply_shadow(multi, pending);
+        free(pending);
+    }
+
+    for (int i = 0; i < MULTI_SLOT_COUNT; ++i) {
+        multi_slot_s *slot = &multi->slots[i];
+        instr_deactivate(&slot->instrument);
+
+        for (int c = 0; c < 2; ++c) {
+            free(slot->output[c]);
+            slot->output[c] = NULL;
+        }
+    }
+
+    for (int i = 0; i < MULTI_SEND_COUNT; ++i) {
+        for (int c = 0; c < 2; ++c) {
+            free(multi->bus_block[i][c]);
+            multi->bus_block[i][c] = NULL;
+        }
+    }
+
+    return true;
+}
+
+void multi_stop_processing(multi_s *multi) {
+    for (int i = 0; i < MULTI_SLOT_COUNT; ++i) {
+        instr_stop_processing(&multi->slots[i].instrument);
+    }
+}
+
+void multi_on_main_thread(multi_s *multi) {
+    main_queue_run(&multi->main_queue, multi->host, multi->host_params);
+
+    if (multi->log_ring)
+        log_ring_flush(multi->log_ring, multi->host, multi->host_log->log);
+
+    clap_param_rescan_flags rescan = 0;
+    for (int i = 0; i < MULTI_SLOT_COUNT; ++i) {
+        rescan |= instr_on_main_thread(&multi->slots[i].instrument);
+    }
+
+    if (rescan && multi->host_params)
+        multi->host_params->rescan(multi->host, rescan);
+}
+
+typedef enum {
+    MULTI_PARAM_INVALID,
+    MULTI_PARAM_BUS,
+    MULTI_PARAM_SEND,
+    MULTI_PARAM_SLOT,
+} multi_param_kind_e;
+
+typedef struct {
+    multi_param_kind_e kind;
+
+    // slot index for MULTI_PARAM_SEND and MULTI_PARAM_SLOT
+    uint32_t slot;
+
+    // bus effect or send index for MULTI_PARAM_BUS and MULTI_PARAM_SEND,
+    // local param index for MULTI_PARAM_BUS
+    uint32_t index;
+    uint32_t local;
+
+    // instrument param id for MULTI_PARAM_SLOT
+    instr_param_id id;
+} multi_param_s;
+
+static multi_param_s decode_param_id(clap_id param_id) {
+    multi_param_s p = { .kind = MULTI_PARAM_INVALID };
+
+    const uint32_t slot_field = param_id >> 24;
+    const instr_param_id id = param_id & 0xFFFFFF;
+
+    instr_module_e module;
+    instr_param_id local;
+    instr_local_id(id, &module, &local);
+
+    if (slot_field == MULTI_BUS_SLOT) {
+        for (uint32_t e = 0; e < MULTI_SEND_COUNT; ++e) {
+            if (module == bus_effect_modules[e] &&
+                local < bus_effect_param_counts[e])
+            {
+                p.kind = MULTI_PARAM_BUS;
+                p.index = e;
+                p.local = local;
+            }
+        }
+
+        return p;
+    }
+
+    if (slot_field == 0 || slot_field > MULTI_SLOT_COUNT)
+        return p;
+
+    p.slot = slot_field - 1;
+
+    if (module == MULTI_MODULE_SEND) {
+        if (local < MULTI_SEND_COUNT) {
+            p.kind = MULTI_PARAM_SEND;
+            p.index = local;
+        }
+    } else if (module < INSTR_MODULE_COUNT) {
+        p.kind = MULTI_PARAM_SLOT;
+        p.id = id;
+    }
+
+    return p;
+}
+
+// get the range of slots a note event applies to. note port 0 routes by
+// channel, and every other note port addresses the slot before it directly.
+// wildcards may match more than one slot.
+static void event_slots(int16_t port_index, int16_t channel,
+                        uint32_t *first, uint32_t *end)
+{
+    *first = 0;
+    *end = 0;
+
+    if (port_index > 0) {
+        if (port_index <= MULTI_SLOT_COUNT) {
+            *first = port_index - 1;
+            *end = port_index;
+        }
+    } else if (channel == -1) {
+        *end = MULTI_SLOT_COUNT;
+    } else if (channel >= 0 && channel < MULTI_SLOT_COUNT) {
+        *first = channel;
+        *end = channel + 1;
+    }
+}
+
+static bool is_note_on_slot(int16_t port_index, int16_t channel,
+                            uint32_t slot, bool single)
+{
+    uint32_t first, end;
+    event_slots(port_index, channel, &first, &end);
+
+    // a note starts on one slot only
+    if (single && end - first != 1) return false;
+    return slot >= first && slot < end;
+}
+
+// returns true if an event has to be handled by the given slot
+static bool is_slot_event(const clap_event_header_t *hdr, uint32_t slot) {
+    if (hdr->space_id != CLAP_CORE_EVENT_SPACE_ID) return false;
+
+    switch (hdr->type) {
+        case CLAP_EVENT_NOTE_ON:
+        case CLAP_EVENT_NOTE_OFF: {
+            const clap_event_note_t *ev = (const clap_event_note_t *)hdr;
+            return is_note_on_slot(ev->port_index, ev->channel, slot,
+                                   hdr->type == CLAP_EVENT_NOTE_ON);
+        }
+
+        case CLAP_EVENT_PARAM_VALUE: {
+            const clap_event_param_value_t *ev = (const clap_event_param_value_t *)hdr;
+            multi_param_s p = decode_param_id(ev->param_id);
+            return p.kind == MULTI_PARAM_SLOT && p.slot == slot;
+        }
+
+        case CLAP_EVENT_PARAM_MOD: {
+            const clap_event_param_mod_t *ev = (const clap_event_param_mod_t *)hdr;
+            if (ev->note_id != -1 || ev->key != -1) return false;
+
+            multi_param_s p = decode_param_id(ev->param_id);
+            return p.kind == MULTI_PARAM_SLOT && p.slot == slot;
+        }
+
+        case CLAP_EVENT_TRANSPORT:
+            return true;
+
+        case CLAP_EVENT_MIDI: {
+            const clap_event_midi_t *ev = (const clap_event_midi_t *)hdr;
+            return is_note_on_slot(ev->port_index, ev->data[0] & 0x0F, slot,
+                                   false);
+        }
+
+        default:
+            return false;
+    }
+}
+
+// handle an event of a slot. only touches the state of that slot, so that
+// slots can be processed in parallel.
+static void slot_process_event(multi_s *multi, uint32_t slot,
+                               const clap_event_header_t *hdr,
+                               const clap_output_events_t *out_events)
+{
+    instrument_s *instr = &multi->slots[slot].instrument;
+
+    switch (hdr->type) {
+        case CLAP_EVENT_NOTE_ON: {
+            const clap_event_note_t *ev = (const clap_event_note_t *)hdr;
+
+            // note lengths are not looked up, so the note cache is not used
+            // for the slots
+            instr_begin_note(instr, ev->key, ev->velocity, ev->note_id,
+                             ev->port_index, ev->channel);
+            break;
+        }
+
+        case CLAP_EVENT_NOTE_OFF: {
+            const clap_event_note_t *ev = (const clap_event_note_t *)hdr;
+            instr_end_notes(instr, ev->key, ev->note_id, ev->port_index,
+                            ev->channel);
+            break;
+        }
+
+        case CLAP_EVENT_PARAM_VALUE: {
+            const clap_event_param_value_t *ev = (const clap_event_param_value_t *)hdr;
+            multi_params_set_value(multi, ev->param_id, ev->value, 0,
+                                   out_events);
+            break;
+        }
+
+        case CLAP_EVENT_PARAM_MOD: {
+            const clap_event_param_mod_t *ev = (const clap_event_param_mod_t *)hdr;
+            multi_param_s p = decode_param_id(ev->param_id);
+            instr_mod_param(instr, p.id, ev->amount);
+            break;
+        }
+
+        case CLAP_EVENT_TRANSPORT: {
+            const clap_event_transport_t *ev = (const clap_event_transport_t *)hdr;
+            instr_process_transport(instr, ev);
+            break;
+        }
+
+        case CLAP_EVENT_MIDI: {
+            const clap_event_midi_t *ev = (const clap_event_midi_t *)hdr;
+
+            uint8_t status = ev->data[0] & 0xF0;
+            uint8_t channel = ev->data[0] & 0x0F;
+
+            // off
+            if ((status == 0x80) || ((status == 0x90) && ev->data[2] == 0)) {
+                instr_end_notes(instr, ev->data[1], -1, ev->port_index,
+                                channel);
+            }
+
+            // on
+            else if (status == 0x90) {
+                instr_begin_note(instr, ev->data[1], ev->data[2] / 127.0, -1,
+                                 ev->port_index, channel);
+            }
+
+            // channel mode messages
+            else if (status == 0xB0) {
+                // all notes off
+                if (ev->data[1] == 123 && ev->data[2] == 0) {
+                    instr_end_notes(instr, -1, -1, ev->port_index, channel);
+                }
+            }
+
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+static void set_bus_tempo(multi_s *multi, const clap_event_transport_t *ev) {
+    if (ev->flags & CLAP_TRANSPORT_HAS_TEMPO) {
+        multi->bpm = ev->tempo;
+    } else {
+        multi->bpm = 150.0;
+    }
+}
+
+// handle the parts of an event that are not specific to a slot
+static void process_global_event(multi_s *multi,
+                                 const clap_event_header_t *hdr,
+                                 const clap_output_events_t *out_events)
+{
+    if (hdr->space_id != CLAP_CORE_EVENT_SPACE_ID) return;
+
+    switch (hdr->type) {
+        case CLAP_EVENT_PARAM_VALUE: {
+            const clap_event_param_value_t *ev = (const clap_event_param_value_t *)hdr;
+            multi_param_s p = decode_param_id(ev->param_id);
+            if (p.kind == MULTI_PARAM_BUS || p.kind == MULTI_PARAM_SEND)
+                multi_params_set_value(multi, ev->param_id, ev->value, 0,
+                                       out_events);
+            break;
+        }
+
+        case CLAP_EVENT_TRANSPORT:
+            set_bus_tempo(multi, (const clap_event_transport_t *)hdr);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void multi_process_event(multi_s *multi, const clap_event_header_t *hdr,
+                         const clap_output_events_t *out_events)
+{
+    process_global_event(multi, hdr, out_events);
+
+    for (uint32_t s = 0; s < MULTI_SLOT_COUNT; ++s) {
+        if (is_slot_event(hdr, s))
+            slot_process_event(multi, s, hdr, out_events);
+    }
+}
+
+static bool event_buffer_push(const clap_output_events_t *list,
+                              const clap_event_header_t *event)
+{
+    multi_event_buffer_s *buf = list->ctx;
+    if (event->size > sizeof(multi_event_u)) return false;
+    if (buf->count == MULTI_SLOT_EVENT_CAPACITY) return false;
+
+    memcpy(&buf->events[buf->count++], event, event->size);
+    return true;
+}
+
+// render a slot over the whole process block. the block is only split at
+// events that concern this slot.
+static void process_slot(void *userdata, uint32_t slot_index) {
+    multi_s *multi = userdata;
+    multi_slot_s *slot = &multi->slots[slot_index];
+    const clap_process_t *process = multi->cur_process;
+    const clap_output_events_t *out_events = &slot->out_events.list;
+
+    const uint32_t nframes = process->frames_count;
+    const uint32_t nev = process->in_events->size(process->in_events);
+    uint32_t i = 0;
+
+    for (uint32_t ev_index = 0; ev_index <= nev; ++ev_index) {
+        const clap_event_header_t *hdr = NULL;
+        uint32_t next_ev_frame = nframes;
+
+        if (ev_index < nev) {
+            hdr = process->in_events->get(process->in_events, ev_index);
+            if (!is_slot_event(hdr, slot_index)) continue;
+
+            // modulation is applied at tick rate and does not split the
+            // block
+            if (hdr->type == CLAP_EVENT_PARAM_MOD)
+                next_ev_frame = i;
+            else if (hdr->time < nframes)
+                next_ev_frame = hdr->time;
+        }
+
+        /* process every samples until the next event */
+        if (next_ev_frame > i) {
+            float *output[2];
+            output[0] = slot->output[0] + i;
+            output[1] = slot->output[1] + i;
+            instr_process(&slot->instrument, output, next_ev_frame - i, i,
+                          out_events);
+
+            i = next_ev_frame;
+        }
+
+        if (hdr)
+            slot_process_event(multi, slot_index, hdr, out_events);
+    }
+}
+
+// push the output events of all slots, ordered by time
+static void flush_slot_events(multi_s *multi,
+                              const clap_output_events_t *out_events)
+{
+    uint32_t read_index[MULTI_SLOT_COUNT] = { 0 };
+
+    for (;;) {
+        int first_slot = -1;
+        uint32_t first_time = 0;
+
+        for (int s = 0; s < MULTI_SLOT_COUNT; ++s) {
+            const multi_event_buffer_s *buf = &multi->slots[s].out_events;
+            if (read_index[s] >= buf->count) continue;
+
+            uint32_t time = buf->events[read_index[s]].header.time;
+            if (first_slot == -1 || time < first_time) {
+                first_slot = s;
+                first_time = time;
+            }
+        }
+
+        if (first_slot == -1) break;
+
+        multi_event_buffer_s *buf = &multi->slots[first_slot].out_events;
+        out_events->try_push(out_events,
+                             &buf->events[read_index[first_slot]++].header);
+    }
+}
+
+// run the send bus over the accumulated send signals
+static void process_bus(multi_s *multi, uint32_t frame_count) {
+    double bpm = multi->bpm;
+    if (bpm < 1.0) bpm = 1.0;
+
+    const double beats_per_sec = bpm / 60.0;
+
+    for (uint32_t i = 0; i < frame_count;) {
+        if (multi->bus_frames_until_next_tick == 0) {
+            bpbxsyn_tick_ctx_s tick_ctx = (bpbxsyn_tick_ctx_s) {
+                .bpm = bpm,
+                .beat = multi->cur_beat,
+            };
+
+            for (int e = 0; e < MULTI_SEND_COUNT; ++e) {
+                bpbxsyn_effect_tick(multi->bus_effects[e], &tick_ctx);
+            }
+
+            multi->bus_frames_until_next_tick = (uint32_t)ceil(
+                bpbxsyn_calc_samples_per_tick(bpm, multi->sample_rate));
+
+            multi->cur_beat += beats_per_sec / multi->sample_rate
+                             * multi->bus_frames_until_next_tick;
+        }
+
+        uint32_t frames_to_process = frame_count - i;
+        if (multi->bus_frames_until_next_tick < frames_to_process)
+            frames_to_process = multi->bus_frames_until_next_tick;
+
+        for (int e = 0; e < MULTI_SEND_COUNT; ++e) {
+            float *block[2] = {
+                multi->bus_block[e][0] + i,
+                multi->bus_block[e][1] + i,
+            };
+
+            bpbxsyn_effect_run(multi->bus_effects[e], block,
+                               frames_to_process);
+        }
+
+        i += frames_to_process;
+        multi->bus_frames_until_next_tick -= frames_to_process;
+    }
+}
+
+// hand an applied shadow back to be freed, and have the host rescan the
+// values it changed. returns false if the main queue is full.
+static bool retire_shadow(multi_s *multi) {
+    if (!main_queue_defer_rescan(&multi->main_queue, multi->host,
+                                 CLAP_PARAM_RESCAN_VALUES))
+        return false;
+
+    // rescans are merged, so a retry may request another one
+    if (!main_queue_defer_call(&multi->main_queue, multi->host, free,
+                               multi->retire_shadow))
+        return false;
+
+    multi->retire_shadow = NULL;
+    return true;
+}
+
+clap_process_status multi_process(multi_s *multi,
+                                  const clap_process_t *process)
+{
+    fp_env env = disable_denormals();
+
+    // apply a loaded state before the events of this block, once the
+    // previous one was handed back
+    if (!multi->retire_shadow || retire_shadow(multi)) {
+        multi_shadow_s *shadow =
+            atomic_exchange_ptr(&multi->pending_shadow, NULL);
+
+        if (shadow) {
+            apply_shadow(multi, shadow);
+            multi->retire_shadow = shadow;
+            retire_shadow(multi);
+        }
+    }
+
+    if (process->transport) {
+        set_bus_tempo(multi, process->transport);
+
+        for (int s = 0; s < MULTI_SLOT_COUNT; ++s) {
+            instr_process_transport(&multi->slots[s].instrument,
+                                    process->transport);
+        }
+    }
+
+    // send levels and the send bus are only applied after the slots are
+    // rendered, so their params are handled up front.
+    const uint32_t nframes = process->frames_count;
+    const uint32_t nev = process->in_events->size(process->in_events);
+    for (uint32_t i = 0; i < nev; ++i) {
+        const clap_event_header_t *hdr = process->in_events->get(process->in_events, i);
+        process_global_event(multi, hdr, process->out_events);
+    }
+
+    for (int s = 0; s < MULTI_SLOT_COUNT; ++s) {
+        multi->slots[s].out_events.count = 0;
+    }
+
+    multi->cur_process = process;
+
+    if (multi->render_offline && multi->worker_pool) {
+        worker_pool_run(multi->worker_pool, process_slot, multi,
+                        MULTI_SLOT_COUNT);
+    } else {
+        for (uint32_t s = 0; s < MULTI_SLOT_COUNT; ++s) {
+            process_slot(multi, s);
+        }
+    }
+
+    multi->cur_process = NULL;
+    flush_slot_events(multi, process->out_events);
+
+    // mix slots into the main output and the send bus. the bus effects
+    // return their input along with the effect signal, so the amount sent
+    // is taken out of the dry signal to not count it twice.
+    float *main_out[2] = {
+        process->audio_outputs[0].data32[0],
+        process->audio_outputs[0].data32[1],
+    };
+
+    for (int c = 0; c < 2; ++c) {
+        memset(main_out[c], 0, nframes * sizeof(float));
+        for (int e = 0; e < MULTI_SEND_COUNT; ++e) {
+            memset(multi->bus_block[e][c], 0, nframes * sizeof(float));
+        }
+    }
+
+    bool has_active_voices = false;
+
+    for (int s = 0; s < MULTI_SLOT_COUNT; ++s) {
+        multi_slot_s *slot = &multi->slots[s];
+        if (slot->instrument.active_voice_count > 0 ||
+            instr_is_swapping_synth(&slot->instrument))
+            has_active_voices = true;
+
+        const float echo_send = (float)slot->send_level[MULTI_SEND_ECHO];
+        const float reverb_send = (float)slot->send_level[MULTI_SEND_REVERB];
+        const float dry = 1.0f - echo_send - reverb_send;
+
+        for (int c = 0; c < 2; ++c) {
+            const float *src = slot->output[c];
+            float *echo = multi->bus_block[MULTI_SEND_ECHO][c];
+            float *reverb = multi->bus_block[MULTI_SEND_REVERB][c];
+
+            for (uint32_t i = 0; i < nframes; ++i) {
+                main_out[c][i] += src[i] * dry;
+                echo[i] += src[i] * echo_send;
+                reverb[i] += src[i] * reverb_send;
+            }
+        }
+
+        // slot outputs are optional
+        const uint32_t port = (uint32_t)s + 1;
+        if (port < process->audio_outputs_count &&
+            process->audio_outputs[port].channel_count >= 2)
+        {
+            for (int c = 0; c < 2; ++c) {
+                memcpy(process->audio_outputs[port].data32[c],
+                       slot->output[c], nframes * sizeof(float));
+            }
+        }
+    }
+
+    process_bus(multi, nframes);
+
+    for (int c = 0; c < 2; ++c) {
+        for (int e = 0; e < MULTI_SEND_COUNT; ++e) {
+            const float *src = multi->bus_block[e][c];
+            for (uint32_t i = 0; i < nframes; ++i) {
+                main_out[c][i] += src[i];
+            }
+        }
+    }
+
+    enable_denormals(env);
+
+    if (has_active_voices)
+        return CLAP_PROCESS_CONTINUE;
+
+    // let the tails of the send bus ring out
+    return CLAP_PROCESS_CONTINUE_IF_NOT_QUIET;
+}
+
+////////////
+// params //
+////////////
+
+static const bpbxsyn_param_info_s* get_param_info(const multi_s *multi,
+                                                  multi_param_s p)
+{
+    switch (p.kind) {
+        case MULTI_PARAM_BUS:
+            return bpbxsyn_effect_param_info(bus_effect_types[p.index],
+                                             p.local);
+
+        case MULTI_PARAM_SEND:
+            return &send_param_info[p.index];
+
+        case MULTI_PARAM_SLOT:
+            return instr_get_param_info(&multi->slots[p.slot].instrument,
+                                        p.id);
+
+        default:
+            return NULL;
+    }
+}
+
+uint32_t multi_params_count(const multi_s *multi) {
+    return BUS_PARAM_COUNT +
+        MULTI_SLOT_COUNT * (MULTI_SEND_COUNT + multi->slot_param_count);
+}
+
+// prepend the bus or slot name to the name and module of a param
+static void prefix_param_info(clap_param_info_t *param_info,
+                              const char *prefix)
+{
+    char buf[CLAP_PATH_SIZE];
+
+    if (param_info->flags & CLAP_PARAM_IS_HIDDEN) return;
+
+    snprintf(buf, sizeof(buf), "%s %s", prefix, param_info->name);
+    impl_strcpy_s(param_info->name, CLAP_NAME_SIZE, buf);
+
+    if (param_info->module[0]) {
+        snprintf(buf, sizeof(buf), "%s/%s", prefix, param_info->module);
+    } else {
+        snprintf(buf, sizeof(buf), "%s", prefix);
+    }
+    impl_strcpy_s(param_info->module, CLAP_PATH_SIZE, buf);
+}
+
+bool multi_params_get_info(const multi_s *multi, uint32_t param_index,
+                           clap_param_info_t *param_info)
+{
+    // bus params
+    if (param_index < BUS_PARAM_COUNT) {
+        uint32_t e = 0;
+        while (param_index >= bus_effect_param_counts[e]) {
+            param_index -= bus_effect_param_counts[e];
+            ++e;
+        }
+
+        clap_id id = multi_param_id(MULTI_BUS_SLOT,
+            instr_global_id(bus_effect_modules[e], param_index));
+
+        const bpbxsyn_param_info_s *info =
+            bpbxsyn_effect_param_info(bus_effect_types[e], param_index);
+
+        if (!param_info_to_clap(info, id, false, param_info))
+            return false;
+
+        prefix_param_info(param_info, "Bus");
+        return true;
+    }
+
+    // slot params
+    param_index -= BUS_PARAM_COUNT;
+
+    const uint32_t stride = MULTI_SEND_COUNT + multi->slot_param_count;
+    const uint32_t slot_index = param_index / stride;
+    const uint32_t local_index = param_index % stride;
+    if (slot_index >= MULTI_SLOT_COUNT)
+        return false;
+
+    const instrument_s *instr = &multi->slots[slot_index].instrument;
+
+    bool ok;
+    if (local_index < MULTI_SEND_COUNT) {
+        clap_id id = multi_slot_param_id(slot_index,
+            instr_global_id(MULTI_MODULE_SEND, local_index));
+
+        ok = param_info_to_clap(&send_param_info[local_index], id, false,
+                                param_info);
+    } else {
+        const instr_param_layout_s *layout = instr_param_layout(instr->type);
+        assert(layout);
+
+        const instr_param_slot_s *slot =
+            &layout->params[multi->slot_param_map[local_index - MULTI_SEND_COUNT]];
+
+        instr_param_clap_info(slot, param_info);
+        param_info->id = multi_slot_param_id(slot_index, slot->id);
+        ok = true;
+    }
+
+    if (!ok) return false;
+
+    char prefix[16];
+    snprintf(prefix, sizeof(prefix), "Slot %u", slot_index + 1);
+    prefix_param_info(param_info, prefix);
+    return true;
+}
+
+// called by whichever thread owns processing
+static void publish_value(multi_s *multi, double *dst, double value) {
+    const uint32_t s = atomic_load(&multi->published_seq);
+    atomic_store(&multi->published_seq, s + 1);
+    atomic_thread_fence(memory_order_release);
+    *dst = value;
+    atomic_store(&multi->published_seq, s + 2);
+}
+
+// reads a published value on the main thread, retrying if it was
+// overwritten in the middle of the read
+static double read_published_value(const multi_s *multi, const double *src) {
+    for (;;) {
+        const uint32_t s = atomic_load(&multi->published_seq);
+        if (s & 1) continue;
+
+        const double value = *src;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load(&multi->published_seq) == s) return value;
+    }
+}
+
+static void read_published(const multi_s *multi, multi_shadow_s *dst) {
+    for (;;) {
+        const uint32_t s = atomic_load(&multi->published_seq);
+        if (s & 1) continue;
+
+        memcpy(dst, &multi->published, sizeof(*dst));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load(&multi->published_seq) == s) return;
+    }
+}
+
+bool multi_params_get_value(const multi_s *multi, clap_id param_id,
+                            double *out_value)
+{
+    multi_param_s p = decode_param_id(param_id);
+
+    switch (p.kind) {
+        case MULTI_PARAM_BUS:
+            *out_value = read_published_value(
+                multi, &multi->published.bus_params[p.index][p.local]);
+            return true;
+
+        case MULTI_PARAM_SEND:
+            *out_value = read_published_value(
+                multi, &multi->published.send_level[p.slot][p.index]);
+            return true;
+
+        case MULTI_PARAM_SLOT:
+            return instr_get_published_param(&multi->slots[p.slot].instrument,
+                                             p.id, out_value);
+
+        default:
+            return false;
+    }
+}
+
+static bool set_bus_param(multi_s *multi, multi_param_s p, double *value) {
+    const bpbxsyn_param_info_s *info =
+        bpbxsyn_effect_param_info(bus_effect_types[p.index], p.local);
+    if (!info) return false;
+
+    bpbxsyn_effect_s *effect = multi->bus_effects[p.index];
+
+    switch (info->type) {
+        case BPBXSYN_PARAM_DOUBLE:
+            if (bpbxsyn_effect_set_param_double(effect, p.local, *value))
+                return false;
+            break;
+
+        case BPBXSYN_PARAM_INT:
+        case BPBXSYN_PARAM_UINT8:
+            *value = round(*value);
+            if (bpbxsyn_effect_set_param_int(effect, p.local, (int)*value))
+                return false;
+            break;
+
+        default:
+            return false;
+    }
+
+    publish_value(multi, &multi->published.bus_params[p.index][p.local],
+                  *value);
+    return true;
+}
+
+static void set_send_level(multi_s *multi, uint32_t slot, uint32_t send,
+                           double value)
+{
+    multi->slots[slot].send_level[send] = value;
+    publish_value(multi, &multi->published.send_level[slot][send], value);
+}
+
+static void apply_shadow(multi_s *multi, const multi_shadow_s *shadow) {
+    for (int e = 0; e < MULTI_SEND_COUNT; ++e) {
+        for (uint32_t i = 0; i < bus_effect_param_counts[e]; ++i) {
+            multi_param_s p = {
+                .kind = MULTI_PARAM_BUS,
+                .index = e,
+                .local = i
+            };
+
+            double value = shadow->bus_params[e][i];
+            set_bus_param(multi, p, &value);
+        }
+    }
+
+    for (int s = 0; s < MULTI_SLOT_COUNT; ++s) {
+        for (int e = 0; e < MULTI_SEND_COUNT; ++e) {
+            set_send_level(multi, s, e, shadow->send_level[s][e]);
+        }
+    }
+}
+
+bool multi_params_set_value(multi_s *multi, clap_id id, double value,
+                            event_send_flags_e send_flags,
+                            const clap_output_events_t *out_events)
+{
+    multi_param_s p = decode_param_id(id);
+
+    switch (p.kind) {
+        case MULTI_PARAM_BUS:
+            if (!set_bus_param(multi, p, &value))
+                return false;
+            break;
+
+        case MULTI_PARAM_SEND:
+            if (value < 0.0) value = 0.0;
+            if (value > 1.0) value = 1.0;
+            set_send_level(multi, p.slot, p.index, value);
+            break;
+
+        case MULTI_PARAM_SLOT:
+            if (!instr_set_param(&multi->slots[p.slot].instrument, p.id,
+                                 &value))
+                return false;
+            break;
+
+        default:
+            return false;
+    }
+
+    if (out_events && (send_flags & SEND_TO_HOST)) {
+        clap_event_param_value_t out_ev = {
+            .header.space_id = CLAP_CORE_EVENT_SPACE_ID,
+            .header.size = sizeof(clap_event_param_value_t),
+            .header.type = CLAP_EVENT_PARAM_VALUE,
+            .header.time = 0,
+
+            .param_id = id,
+            .value = value,
+            .cookie = NULL,
+
+            .note_id = -1,
+            .port_index = -1,
+            .channel = -1,
+            .key = -1,
+        };
+
+        out_events->try_push(out_events, (clap_event_header_t*)&out_ev);
+    }
+
+    if (p.kind != MULTI_PARAM_SLOT || (send_flags & NO_RECURSION))
+        return true;
+
+    // keep the vibrato preset and the vibrato parameters of the slot in
+    // sync, same as the single instrument plugin does.
+    instr_param_value_s linked[INSTR_MAX_LINKED_PARAMS];
+    const uint32_t count = instr_linked_params(
+        &multi->slots[p.slot].instrument, p.id, value, linked);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        multi_params_set_value(multi,
+            multi_slot_param_id(p.slot, linked[i].id), linked[i].value,
+            SEND_TO_HOST | NO_RECURSION, out_events);
+    }
+
+    return true;
+}
+
+bool multi_params_value_to_text(const multi_s *multi, clap_id param_id,
+                                double value, char *out_buf,
+                                uint32_t out_buf_capacity)
+{
+    return param_value_to_text(
+        get_param_info(multi, decode_param_id(param_id)), value, out_buf,
+        out_buf_capacity);
+}
+
+bool multi_params_text_to_value(const multi_s *multi, clap_id param_id,
+                                const char *param_value_text,
+                                double *out_value)
+{
+    return param_text_to_value(
+        get_param_info(multi, decode_param_id(param_id)), param_value_text,
+        out_value);
+}
+
+///////////
+// state //
+///////////
+
+#define ERRCHK(v) if (!(v)) goto error
+
+bool multi_state_save(const multi_s *multi, const clap_ostream_t *stream) {
+    state_buffer_s buf;
+    state_buffer_init(&buf);
+
+    multi_shadow_s published;
+    read_published(multi, &published);
+
+    // write save format revision (single number)
+    uint32_t save_version = STATE_SAVE_VER;
+    ERRCHK(state_write_prim(&buf, &save_version, sizeof(save_version)));
+
+    // write synth version
+    uint32_t synth_maj = BPBXSYN_VERSION_MAJOR;
+    uint32_t synth_min = BPBXSYN_VERSION_MINOR;
+    uint32_t synth_rev = BPBXSYN_VERSION_REVISION;
+    ERRCHK(state_write_prim(&buf, &synth_maj, sizeof(synth_maj)));
+    ERRCHK(state_write_prim(&buf, &synth_min, sizeof(synth_min)));
+    ERRCHK(state_write_prim(&buf, &synth_rev, sizeof(synth_rev)));
+
+    // write bus parameters that differ from their default value
+    for (int e = 0; e < MULTI_SEND_COUNT; ++e) {
+        const uint32_t param_count = bus_effect_param_counts[e];
+        uint32_t indices[BUS_PARAM_COUNT];
+        double values[BUS_PARAM_COUNT];
+        uint32_t write_param_count = 0;
+
+        for (uint32_t i = 0; i < param_count; ++i) {
+            const double value = published.bus_params[e][i];
+            const bpbxsyn_param_info_s *info =
+                bpbxsyn_effect_param_info(bus_effect_types[e], i);
+            if (value == info->default_value) continue;
+
+            indices[write_param_count] = i;
+            values[write_param_count] = value;
+            ++write_param_count;
+        }
+
+        ERRCHK(state_write_varint(&buf, write_param_count));
+        for (uint32_t i = 0; i < write_param_count; ++i) {
+            ERRCHK(state_write_varint(&buf, indices[i]));
+            ERRCHK(state_write_prim(&buf, &values[i], sizeof(values[i])));
+        }
+    }
+
+    // write slots
+    uint8_t slot_count = MULTI_SLOT_COUNT;
+    ERRCHK(state_write_prim(&buf, &slot_count, sizeof(slot_count)));
+
+    for (int s = 0; s < MULTI_SLOT_COUNT; ++s) {
+        const multi_slot_s *slot = &multi->slots[s];
+
+        for (int e = 0; e < MULTI_SEND_COUNT; ++e) {
+            ERRCHK(state_write_prim(&buf, &published.send_level[s][e],
+                                    sizeof(published.send_level[s][e])));
+        }
+
+        ERRCHK(instr_state_save(&slot->instrument, &buf));
+    }
+
+    ERRCHK(state_buffer_flush(&buf, stream));
+
+    state_buffer_free(&buf);
+    return true;
+
+    error:
+        state_buffer_free(&buf);
+        return false;
+}
+
+// bus params of the shadow start out with the current values, which
+// revision 0 keeps for params that are missing
+static bool read_bus_params(multi_shadow_s *shadow, state_buffer_s *buf,
+                            uint32_t save_version, int e)
+{
+    double *values = shadow->bus_params[e];
+
+    if (save_version == 0) {
+        // revision 0: every param of the effect
+        uint32_t param_count;
+        ERRCHK(state_read_prim(buf, &param_count, sizeof(param_count)));
+        if (param_count > bus_effect_param_counts[e]) goto error;
+
+        for (uint32_t i = 0; i < param_count; ++i) {
+            ERRCHK(state_read_prim(buf, &values[i], sizeof(values[i])));
+        }
+
+        return true;
+    }
+
+    // revision 1: params that differ from their default value
+    for (uint32_t i = 0; i < bus_effect_param_counts[e]; ++i) {
+        values[i] = bpbxsyn_effect_param_info(bus_effect_types[e], i)
+            ->default_value;
+    }
+
+    uint32_t param_count;
+    ERRCHK(state_read_varint(buf, &param_count));
+    if (param_count > bus_effect_param_counts[e]) goto error;
+
+    for (uint32_t i = 0; i < param_count; ++i) {
+        uint32_t index;
+        ERRCHK(state_read_varint(buf, &index));
+        if (index >= bus_effect_param_counts[e]) goto error;
+        ERRCHK(state_read_prim(buf, &values[index], sizeof(values[index])));
+    }
+
+    return true;
+    error:
+        return false;
+}
+
+bool multi_state_load(multi_s *multi, const clap_istream_t *stream) {
+    // everything is read before any of it is applied, so that the audio
+    // thread never sees a partially loaded state
+    instr_shadow_s *slot_shadows[MULTI_SLOT_COUNT] = { 0 };
+    multi_shadow_s *shadow = malloc(sizeof(multi_shadow_s));
+
+    state_buffer_s buf;
+    state_buffer_init(&buf);
+    if (!shadow) goto error;
+    ERRCHK(state_buffer_fill(&buf, stream));
+
+    read_published(multi, shadow);
+
+    // read versions; do strict version checking for now.
+    uint32_t save_version;
+    ERRCHK(state_read_prim(&buf, &save_version, sizeof(save_version)));
+    if (save_version > STATE_SAVE_VER) goto error;
+
+    // read and skip synth version
+    uint32_t synth_maj;
+    uint32_t synth_min;
+    uint32_t synth_rev;
+    ERRCHK(state_read_prim(&buf, &synth_maj, sizeof(synth_maj)));
+    ERRCHK(state_read_prim(&buf, &synth_min, sizeof(synth_min)));
+    ERRCHK(state_read_prim(&buf, &synth_rev, sizeof(synth_rev)));
+
+    // read bus parameters
+    for (int e = 0; e < MULTI_SEND_COUNT; ++e) {
+        ERRCHK(read_bus_params(shadow, &buf, save_version, e));
+    }
+
+    // read slots
+    uint8_t slot_count;
+    ERRCHK(state_read_prim(&buf, &slot_count, sizeof(slot_count)));
+    if (slot_count > MULTI_SLOT_COUNT) goto error;
+
+    for (uint8_t s = 0; s < slot_count; ++s) {
+        for (int e = 0; e < MULTI_SEND_COUNT; ++e) {
+            ERRCHK(state_read_prim(&buf, &shadow->send_level[s][e],
+                                   sizeof(shadow->send_level[s][e])));
+        }
+
+        slot_shadows[s] = instr_state_load(&multi->slots[s].instrument, &buf,
+                                           save_version);
+        if (!slot_shadows[s]) goto error;
+    }
+
+    bool ok = true;
+    for (uint8_t s = 0; s < slot_count; ++s) {
+        ok = instr_publish_shadow(&multi->slots[s].instrument,
+                                  slot_shadows[s]) && ok;
+        slot_shadows[s] = NULL;
+    }
+
+    // while active, the audio thread applies the state, after which
+    // multi_on_main_thread rescans the params
+    if (multi->is_active) {
+        free(atomic_exchange_ptr(&multi->pending_shadow, shadow));
+        if (multi->host->request_process)
+            multi->host->request_process(multi->host);
+
+        state_buffer_free(&buf);
+        return ok;
+    }
+
+    apply_shadow(multi, shadow);
+    free(shadow);
+
+    // synth types of the slots may have changed, which changes which
+    // params are hidden
+    if (multi->host_params) {
+        multi->host_params->rescan(multi->host, CLAP_PARAM_RESCAN_VALUES |
+                                                CLAP_PARAM_RESCAN_INFO);
+    }
+
+    state_buffer_free(&buf);
+    return ok;
+
+    error:
+        for (int s = 0; s < MULTI_SLOT_COUNT; ++s) {
+            instr_shadow_free(slot_shadows[s]);
+        }
+
+        free(shadow);
+        state_buffer_free(&buf);
+        return false;
+}
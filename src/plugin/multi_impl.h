@@ -0,0 +1,173 @@
+// multi-timbral variant of the plugin. a fixed number of instrument slots
+// share one synth context and are addressed through midi channels or
+// separate note ports. instead of having their own echo and reverb, slots
+// feed a shared send bus.
+//
+// the multi-timbral plugin does not have a gui.
+#ifndef _bpbxclap_multi_impl_h_
+#define _bpbxclap_multi_impl_h_
+
+#include <beepbox_synth.h>
+#include <clap/clap.h>
+#include "include/instrument.h"
+#include "instrument_impl.h"
+#include "plugin_impl.h"
+#include "atomic_bool.h"
+#include "worker_pool.h"
+#include "main_queue.h"
+#include "include/log_ring.h"
+
+// one slot for each midi channel
+#define MULTI_SLOT_COUNT 16
+
+// clap param ids of slot parameters are the instrument param id with the
+// slot index plus one in the upper 8 bits. parameters of the send bus use
+// MULTI_BUS_SLOT instead.
+#define MULTI_BUS_SLOT 0xFF
+#define multi_param_id(slot_field, id) \
+    (((id) & 0xFFFFFF) | ((uint32_t)(slot_field) << 24))
+#define multi_slot_param_id(slot_index, id) \
+    multi_param_id((slot_index) + 1, (id))
+
+// module number used for the send levels of a slot
+#define MULTI_MODULE_SEND 0xF
+
+typedef enum {
+    MULTI_SEND_ECHO,
+    MULTI_SEND_REVERB,
+
+    MULTI_SEND_COUNT
+} multi_send_e;
+
+#define BUS_PARAM_COUNT (BPBXSYN_ECHO_PARAM_COUNT + BPBXSYN_REVERB_PARAM_COUNT)
+
+// bus params and send levels, the part of the state that is not stored in
+// the slot instruments
+typedef struct {
+    double bus_params[MULTI_SEND_COUNT][BUS_PARAM_COUNT];
+    double send_level[MULTI_SLOT_COUNT][MULTI_SEND_COUNT];
+} multi_shadow_s;
+
+// output events of a slot are collected separately, so that slots can be
+// processed in any order or in parallel and merged by time afterwards.
+#define MULTI_SLOT_EVENT_CAPACITY 128
+
+typedef union {
+    clap_event_header_t header;
+    clap_event_note_t note;
+    clap_event_param_value_t param_value;
+} multi_event_u;
+
+typedef struct {
+    clap_output_events_t list;
+    multi_event_u events[MULTI_SLOT_EVENT_CAPACITY];
+    uint32_t count;
+} multi_event_buffer_s;
+
+typedef struct {
+    instrument_s instrument;
+    double send_level[MULTI_SEND_COUNT];
+
+    // dry stereo output of the slot for the current process block
+    float *output[2];
+    multi_event_buffer_s out_events;
+} multi_slot_s;
+
+typedef struct {
+    clap_plugin_t plugin;
+
+    const clap_host_t *host;
+    const clap_host_log_t *host_log;
+    const clap_host_thread_check_t *host_thread_check;
+    const clap_host_params_t *host_params;
+    const clap_host_state_t *host_state;
+
+    // set if this instance holds a reference to the static data
+    bool has_static_ref;
+
+    // shared by the context of all slots
+    synth_arena_s *arena;
+    bpbxsyn_context_s *ctx;
+    multi_slot_s slots[MULTI_SLOT_COUNT];
+
+    // maps the param indices of a slot to instrument param indices. echo and
+    // reverb params are left out, as slots do not have those modules.
+    uint16_t slot_param_map[INSTR_PARAM_COUNT];
+    uint32_t slot_param_count;
+
+    // send bus, indexed by multi_send_e. effects are processed in-place.
+    bpbxsyn_effect_s *bus_effects[MULTI_SEND_COUNT];
+    float *bus_block[MULTI_SEND_COUNT][2];
+    uint32_t bus_frames_until_next_tick;
+
+    double sample_rate;
+    double bpm;
+    double cur_beat;
+
+    // set by the render extension. when rendering offline, slots are
+    // processed in parallel on the worker pool. the pool is only created
+    // or destroyed while the plugin is inactive.
+    atomic_bool render_offline;
+    bool is_active;
+    worker_pool_s *worker_pool;
+
+    // process call currently being run by the slot jobs
+    const clap_process_t *cur_process;
+
+    // work deferred from the audio thread to the main thread
+    main_queue_s main_queue;
+
+    // log messages of the audio thread and the workers, delivered on the
+    // main thread. NULL if the host has no logger.
+    log_ring_s *log_ring;
+
+    // bus params and send levels of a loaded state, applied by the audio
+    // thread at the start of a block and handed back through the main queue
+    // to be freed. slots load their state through instr_publish_shadow.
+    atomic_ptr pending_shadow;
+
+    // owned by the audio thread. waits for room in the main queue.
+    void *retire_shadow;
+
+    // copy of the bus params and send levels as last written, for the main
+    // thread to read while the audio thread owns the bus effects and the
+    // slots. published_seq is odd while a value is being written.
+    multi_shadow_s published;
+    atomic_uint published_seq;
+} multi_s;
+
+void multi_create(multi_s *multi);
+bool multi_init(multi_s *multi);
+void multi_destroy(multi_s *multi);
+
+bool multi_activate(multi_s *multi, double sample_rate,
+                    uint32_t min_frames_count, uint32_t max_frames_count);
+bool multi_deactivate(multi_s *multi);
+void multi_stop_processing(multi_s *multi);
+void multi_on_main_thread(multi_s *multi);
+void multi_set_render_mode(multi_s *multi, bool offline);
+
+void multi_process_event(multi_s *multi, const clap_event_header_t *hdr,
+                         const clap_output_events_t *out_events);
+clap_process_status multi_process(multi_s *multi,
+                                  const clap_process_t *process);
+
+uint32_t multi_params_count(const multi_s *multi);
+bool multi_params_get_info(const multi_s *multi, uint32_t param_index,
+                           clap_param_info_t *param_info);
+bool multi_params_get_value(const multi_s *multi, clap_id param_id,
+                            double *out_value);
+bool multi_params_set_value(multi_s *multi, clap_id id, double value,
+                            event_send_flags_e send_flags,
+                            const clap_output_events_t *out_events);
+bool multi_params_value_to_text(const multi_s *multi, clap_id param_id,
+                                double value, char *out_buf,
+                                uint32_t out_buf_capacity);
+bool multi_params_text_to_value(const multi_s *multi, clap_id param_id,
+                                const char *param_value_text,
+                                double *out_value);
+
+bool multi_state_save(const multi_s *multi, const clap_ostream_t *stream);
+bool multi_state_load(multi_s *multi, const clap_istream_t *stream);
+
+#endif
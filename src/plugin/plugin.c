@@ -8,6 +8,30 @@
 #include <cbeepsynth/synth/include/beepbox_synth.h>
 #include "system.h"
 #include "util.h"
+#include "instr_tables.h"
+#include "state.h"
+
+static int static_init_counter = 0;
+
+bool plugin_static_init(void) {
+    if (static_init_counter++ > 0)
+        return true;
+
+    if (!instr_tables_init()) {
+        static_init_counter = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void plugin_static_deinit(void) {
+    assert(static_init_counter > 0);
+    if (--static_init_counter == 0) {
+        instr_tables_deinit();
+        preset_bank_close_all();
+    }
+}
 
 static void plugin_track_info_changed(plugin_s *plug) {
     clap_track_info_t track_info;
@@ -32,58 +56,20 @@ static void plugin_track_info_changed(plugin_s *plug) {
 
 static void bpbx_log_cb(bpbxsyn_log_severity_e severity, const char *msg, void *userdata) {
    plugin_s *plug = (plugin_s*)userdata;
-   clap_log_severity clap_sev = CLAP_LOG_INFO;
-   switch (severity) {
-      case BPBXSYN_LOG_DEBUG:
-         clap_sev = CLAP_LOG_DEBUG;
-         break;
-
-      case BPBXSYN_LOG_INFO:
-         clap_sev = CLAP_LOG_INFO;
-         break;
-
-      case BPBXSYN_LOG_WARNING:
-         clap_sev = CLAP_LOG_WARNING;
-         break;
-
-      case BPBXSYN_LOG_ERROR:
-         clap_sev = CLAP_LOG_ERROR;
-         break;
-
-      case BPBXSYN_LOG_FATAL:
-         clap_sev = CLAP_LOG_FATAL;
-         break;
-   }
 
-   plug->host_log->log(plug->host, clap_sev, msg);
+   // the synth may log from the audio thread, where the host logger should
+   // not be called
+   log_ring_defer(plug->log_ring, plug->host, instr_log_severity(severity),
+                  LOG_MSG_TEXT, NULL, msg);
 }
 
 void plugin_create(plugin_s *plug, bpbxsyn_synth_type_e type) {
+    main_queue_init(&plug->main_queue);
+    atomic_store(&plug->pending_preset, 0);
     plug->has_track_color = false;
     plug->instrument.type = type; // store type temporarily
 }
 
-#ifndef _NDEBUG
-static void* testalloc(size_t size, void *ud) {
-    plugin_s *plug = ud;
-    uint8_t *alloc = malloc(size + sizeof(size_t));
-    if (!alloc) return NULL;
-
-    plug->mem_allocated += size;
-    *((size_t*)alloc) = size;
-    return alloc + sizeof(size_t);
-}
-
-static void testfree(void *ptr, void *ud) {
-    if (!ptr) return;
-
-    plugin_s *plug = ud;
-    uint8_t *base = (uint8_t*)ptr - sizeof(size_t);
-    plug->mem_allocated -= *((size_t*)base);
-    free(base);
-}
-#endif
-
 bool plugin_init(plugin_s *plug) {
     // Fetch host's extensions here
     // Make sure to check that the interface functions are not null pointers
@@ -94,31 +80,36 @@ bool plugin_init(plugin_s *plug) {
     plug->host_params = (const clap_host_params_t *)plug->host->get_extension(plug->host, CLAP_EXT_PARAMS);
     plug->host_track_info = (const clap_host_track_info_t*) plug->host->get_extension(plug->host, CLAP_EXT_TRACK_INFO);
     plug->host_context_menu = (const clap_host_context_menu_t*) plug->host->get_extension(plug->host, CLAP_EXT_CONTEXT_MENU);
+    plug->host_preset_load = (const clap_host_preset_load_t*) plug->host->get_extension(plug->host, CLAP_EXT_PRESET_LOAD);
+    if (!plug->host_preset_load)
+        plug->host_preset_load = (const clap_host_preset_load_t*) plug->host->get_extension(plug->host, CLAP_EXT_PRESET_LOAD_COMPAT);
 
-    #ifndef _NDEBUG
-    bpbxsyn_allocator_s alloc = (bpbxsyn_allocator_s) {
-        .alloc = testalloc,
-        .free = testfree,
-        .userdata = plug
-    };
+    if (!plugin_static_init()) return false;
+    plug->has_static_ref = true;
 
-    plug->ctx = bpbxsyn_context_new(&alloc);
-    #endif
+    plug->arena = synth_arena_new();
+    if (!plug->arena) return false;
 
+    bpbxsyn_allocator_s alloc = synth_arena_allocator(plug->arena);
+    plug->ctx = bpbxsyn_context_new(&alloc);
     if (!plug->ctx) return false;
 
-    if (!instr_init(&plug->instrument, plug->ctx, plug->instrument.type))
+    if (!instr_init(&plug->instrument, plug->ctx, plug->instrument.type, 0))
         return false;
 
     plug->instrument.clap_host = plug->host;
     plug->instrument.clap_host_params = plug->host_params;
+    plug->instrument.main_queue = &plug->main_queue;
 
     if (plug->host_track_info) {
         plugin_track_info_changed(plug);
     }
     
     if (plug->host_log) {
-        gui_set_log_func(plug->host_log->log, plug->host);
+        plug->log_ring = log_ring_new();
+        if (!plug->log_ring) return false;
+
+        gui_add_log_host(plug->host_log->log, plug->host);
         bpbxsyn_set_log_func(plug->ctx, bpbx_log_cb, plug);
     }
 
@@ -126,9 +117,42 @@ bool plugin_init(plugin_s *plug) {
 }
 
 void plugin_destroy(plugin_s *plug) {
+    // run tasks still left in the queue, such as deferred frees. the host
+    // is not notified about rescans anymore at this point.
+    main_queue_run(&plug->main_queue, plug->host, NULL);
+
     instr_destroy(&plug->instrument);
-    bpbxsyn_context_destroy(plug->ctx);
+    if (plug->ctx)
+        bpbxsyn_context_destroy(plug->ctx);
     plug->ctx = NULL;
+
+    // the synth may log until its context is gone
+    if (plug->log_ring) {
+        gui_remove_log_host(plug->host);
+        log_ring_flush(plug->log_ring, plug->host, plug->host_log->log);
+        log_ring_free(plug->log_ring);
+        plug->log_ring = NULL;
+    }
+
+    synth_arena_free(plug->arena);
+    plug->arena = NULL;
+
+    if (plug->has_static_ref) {
+        plugin_static_deinit();
+        plug->has_static_ref = false;
+    }
+}
+
+// the gui rereads the state of the instrument on its own thread
+static void resync_gui(plugin_s *plug) {
+    if (!plug->gui) return;
+
+    gui_event_queue_item_s item = (gui_event_queue_item_s) {
+        .type = GUI_EVENT_RESYNC,
+    };
+
+    gui_event_enqueue(plug->gui, item);
+    gui_wake(plug->gui);
 }
 
 bool plugin_activate(plugin_s *plug, double sample_rate,
@@ -139,29 +163,57 @@ bool plugin_activate(plugin_s *plug, double sample_rate,
     
     if (!s) return false;
 
-    if (plug->gui) {
-        gui_event_queue_item_s item = (gui_event_queue_item_s) {
-            .type = GUI_EVENT_RESYNC,
-        };
-
-        gui_event_enqueue(plug->gui, item);
-    }
-    
+    resync_gui(plug);
     return true;
 }
 
 bool plugin_deactivate(plugin_s *plug) {
-    #ifndef _NDEBUG
-    char buf[128];
-    snprintf(buf, 128, "%llu bytes allocated", plug->mem_allocated);
-
-    if (plug->host_log)
-        plug->host_log->log(plug->host, CLAP_LOG_DEBUG, buf);
+    #ifdef PLUGIN_ALLOC_STATS
+    if (plug->log_ring) {
+        synth_arena_stats_s stats;
+        synth_arena_get_stats(plug->arena, &stats);
+
+        const log_arg_u args[] = {
+            { .u = stats.current_bytes },
+            { .u = stats.peak_bytes },
+            { .u = stats.reserved_bytes },
+            { .u = stats.alloc_count },
+        };
+        log_ring_defer(plug->log_ring, plug->host, CLAP_LOG_DEBUG,
+                       LOG_MSG_SYNTH_MEMORY, args, NULL);
+    }
     #endif
     
     return instr_deactivate(&plug->instrument);
 }
 
+void plugin_stop_processing(plugin_s *plug) {
+    instr_stop_processing(&plug->instrument);
+}
+
+void plugin_on_main_thread(plugin_s *plug) {
+    main_queue_run(&plug->main_queue, plug->host, plug->host_params);
+
+    if (plug->log_ring)
+        log_ring_flush(plug->log_ring, plug->host, plug->host_log->log);
+    gui_flush_log();
+
+    // synth was swapped, either for one of another type or with a loaded
+    // state
+    clap_param_rescan_flags rescan = instr_on_main_thread(&plug->instrument);
+    if (rescan && plug->host_params)
+        plug->host_params->rescan(plug->host, rescan);
+    if (rescan)
+        resync_gui(plug);
+
+    if (plug->gui)
+        gui_wake(plug->gui);
+}
+
+void plugin_set_render_mode(plugin_s *plug, bool offline) {
+    instr_set_render_mode(&plug->instrument, offline);
+}
+
 void plugin_process_gui_events(plugin_s *plug,
                                const clap_output_events_t *out_events)
 {
@@ -184,7 +236,8 @@ void plugin_process_gui_events(plugin_s *plug,
                 .header.type = CLAP_EVENT_PARAM_GESTURE_BEGIN,
                 .header.time = 0,
                 
-                .param_id = item.gesture.param_id
+                .param_id = instr_typed_param_id(&plug->instrument,
+                                                 item.gesture.param_id)
                 };
 
                 out_events->try_push(out_events, (clap_event_header_t*)&out_ev);
@@ -198,7 +251,8 @@ void plugin_process_gui_events(plugin_s *plug,
                 .header.type = CLAP_EVENT_PARAM_GESTURE_END,
                 .header.time = 0,
                 
-                .param_id = item.gesture.param_id
+                .param_id = instr_typed_param_id(&plug->instrument,
+                                                 item.gesture.param_id)
                 };
 
                 out_events->try_push(out_events, (clap_event_header_t*)&out_ev);
@@ -207,15 +261,18 @@ void plugin_process_gui_events(plugin_s *plug,
 
             case GUI_EVENT_ADD_ENVELOPE:
                 bpbxsyn_synth_add_envelope(plug->instrument.synth);
+                plug->instrument.snapshot_dirty = true;
                 break;
 
             case GUI_EVENT_MODIFY_ENVELOPE:
                 *bpbxsyn_synth_get_envelope(plug->instrument.synth, item.modify_envelope.index)
                     = item.modify_envelope.envelope;
+                plug->instrument.snapshot_dirty = true;
                 break;
             
             case GUI_EVENT_REMOVE_ENVELOPE:
                 bpbxsyn_synth_remove_envelope(plug->instrument.synth, item.envelope_removal.index);
+                plug->instrument.snapshot_dirty = true;
                 break;
 
             default:
@@ -225,31 +282,7 @@ void plugin_process_gui_events(plugin_s *plug,
 }
 
 void plugin_process_transport(plugin_s *plug, const clap_event_transport_t *ev) {
-    if (ev->flags & CLAP_TRANSPORT_HAS_TEMPO) {
-        plug->instrument.bpm = ev->tempo;
-    } else {
-        plug->instrument.bpm = 150.0;
-    }
-
-    bool is_playing = (ev->flags & CLAP_TRANSPORT_IS_PLAYING) != 0;
-
-    // if playing state changed, update current beat from transport event.
-    // otherwise plugin should increment cur beat on its own using bpm info.
-    if (is_playing != plug->instrument.is_playing) {
-        if (ev->flags & CLAP_TRANSPORT_HAS_BEATS_TIMELINE) {
-            int64_t beats_int = ev->song_pos_beats / CLAP_BEATTIME_FACTOR;
-            int64_t beats_frac = ev->song_pos_beats % CLAP_BEATTIME_FACTOR;
-            plug->instrument.cur_beat =
-                (double)beats_int + (double)beats_frac / CLAP_BEATTIME_FACTOR;
-        }
-
-        if (is_playing)
-            bpbxsyn_synth_begin_transport(plug->instrument.synth,
-                                          plug->instrument.cur_beat,
-                                          plug->instrument.bpm);
-    }
-
-    plug->instrument.is_playing = is_playing;
+    instr_process_transport(&plug->instrument, ev);
 }
 
 void plugin_process_event(plugin_s *plug, const clap_event_header_t *hdr,
@@ -295,7 +328,11 @@ void plugin_process_event(plugin_s *plug, const clap_event_header_t *hdr,
 
         case CLAP_EVENT_PARAM_MOD: {
             const clap_event_param_mod_t *ev = (const clap_event_param_mod_t *)hdr;
-            // TODO: handle parameter modulation
+
+            // per-note modulation is not advertised
+            if (ev->note_id == -1 && ev->key == -1)
+                instr_mod_param(&plug->instrument, ev->param_id, ev->amount);
+
             break;
         }
 
@@ -346,6 +383,11 @@ void plugin_process_event(plugin_s *plug, const clap_event_header_t *hdr,
     }
 }
 
+static inline bool is_param_mod(const clap_event_header_t *hdr) {
+    return hdr->space_id == CLAP_CORE_EVENT_SPACE_ID &&
+        hdr->type == CLAP_EVENT_PARAM_MOD;
+}
+
 clap_process_status plugin_process(plugin_s *plug,
                                    const clap_process_t *process)
 {
@@ -367,7 +409,9 @@ clap_process_status plugin_process(plugin_s *plug,
         /* handle every events that happrens at the frame "i" */
         while (ev_index < nev && next_ev_frame == i) {
             const clap_event_header_t *hdr = process->in_events->get(process->in_events, ev_index);
-            if (hdr->time != i) {
+            // modulation is applied at tick rate, so it does not need to
+            // split the block and is handled at the start of the current one
+            if (hdr->time != i && !is_param_mod(hdr)) {
                 next_ev_frame = hdr->time;
                 break;
             }
@@ -395,7 +439,8 @@ clap_process_status plugin_process(plugin_s *plug,
 
     enable_denormals(env);
 
-    if (plug->instrument.active_voice_count > 0)
+    if (plug->instrument.active_voice_count > 0 ||
+        instr_is_swapping_synth(&plug->instrument))
         return CLAP_PROCESS_CONTINUE;
     else {
         // if (plug->host_log)
@@ -409,16 +454,12 @@ uint32_t plugin_params_count(const plugin_s *plug) {
     return instr_params_count(&plug->instrument);
 }
 
-bool plugin_params_get_info(const plugin_s *plugin, uint32_t param_index,
-                            clap_param_info_t *param_info)
+bool param_info_to_clap(const bpbxsyn_param_info_s *info, clap_id id,
+                        bool is_inactive, clap_param_info_t *param_info)
 {
-    bool is_inactive;
-    instr_param_id param_id = instr_get_param_id(&plugin->instrument,
-                                                 param_index, &is_inactive);
-    
     if (is_inactive) {
         param_info->cookie = NULL;
-        param_info->id = param_id;
+        param_info->id = id;
         impl_strcpy_s(param_info->name, 256, "-");
         impl_strcpy_s(param_info->module, 1024, "");
         param_info->default_value = 0.0;
@@ -428,8 +469,6 @@ bool plugin_params_get_info(const plugin_s *plugin, uint32_t param_index,
         return true;
     }
 
-    const bpbxsyn_param_info_s *info =
-        instr_get_param_info(&plugin->instrument, param_id);
     if (!info)
         return false;
 
@@ -439,37 +478,48 @@ bool plugin_params_get_info(const plugin_s *plugin, uint32_t param_index,
     }
 
     param_info->cookie = NULL;
-    param_info->id = param_id;
+    param_info->id = id;
     impl_strcpy_s(param_info->name, 256, info->name);
     impl_strcpy_s(param_info->module, 1024, module_name);
     param_info->default_value = info->default_value;
     param_info->min_value = info->min_value;
     param_info->max_value = info->max_value;
-    
-    param_info->flags = CLAP_PARAM_IS_AUTOMATABLE;
-    if (info->type == BPBXSYN_PARAM_UINT8 || info->type == BPBXSYN_PARAM_INT) {
-        param_info->flags |= CLAP_PARAM_IS_STEPPED;
+    param_info->flags = instr_param_clap_flags(info);
 
-        if (info->enum_values) param_info->flags |= CLAP_PARAM_IS_ENUM;
-    }
+    return true;
+}
 
-    // ignore this property i suppose ...
-    // if (!info->no_modulation)
-    //    param_info->flags |= CLAP_PARAM_IS_AUTOMATABLE;
+bool plugin_params_get_info(const plugin_s *plugin, uint32_t param_index,
+                            clap_param_info_t *param_info)
+{
+    // built ahead of time by the shared tables
+    const instr_param_layout_s *layout =
+        instr_param_layout(plugin->instrument.type);
+    assert(layout);
 
+    if (param_index >= layout->count)
+        return false;
+
+    const instr_param_slot_s *slot = &layout->params[param_index];
+    instr_param_clap_info(slot, param_info);
+    param_info->id = slot->id;
     return true;
 }
 
 bool plugin_params_get_value(const plugin_s *plug, clap_id param_id,
                              double *out_value)
 {
-    return instr_get_param(&plug->instrument, param_id, out_value);
+    // called from the main thread, possibly while processing
+    return instr_get_published_param(&plug->instrument, param_id, out_value);
 }
 
 bool plugin_params_set_value(plugin_s *plug, clap_id id, double value,
                              event_send_flags_e send_flags,
                              const clap_output_events_t *out_events)
 {
+    // the gui refers to synth params without their type tag
+    id = instr_typed_param_id(&plug->instrument, id);
+
     if (!instr_set_param(&plug->instrument, id, &value))
         return false;
 
@@ -493,14 +543,12 @@ bool plugin_params_set_value(plugin_s *plug, clap_id id, double value,
       out_events->try_push(out_events, (clap_event_header_t*)&out_ev);
    }
 
-   if (plug->gui && (send_flags & SEND_TO_GUI)) {
-      gui_event_queue_item_s item = {
-         .type = GUI_EVENT_PARAM_CHANGE,
-         .param_value.param_id = id,
-         .param_value.value = value
-      };
-
-      gui_event_enqueue(plug->gui, item);
+   // the gui only knows about the synth params of the current type
+   const int param_type = instr_param_synth_type(id);
+   if (plug->gui && (send_flags & SEND_TO_GUI) &&
+       (param_type == -1 || param_type == (int)plug->instrument.type))
+   {
+      gui_param_changed(plug->gui, instr_untyped_param_id(id), value);
    }
 
    // when changing vibrato preset, change vibrato paramaters as well.
@@ -508,54 +556,23 @@ bool plugin_params_set_value(plugin_s *plug, clap_id id, double value,
    // Kind of has to be done plugin-side so that the host knows that those
    // parameters changed...
    if (!(send_flags & NO_RECURSION)) {
-      switch (id) {
-         case BPBXSYN_PARAM_VIBRATO_PRESET:
-            if ((int)value != BPBXSYN_VIBRATO_PRESET_CUSTOM) {
-               bpbxsyn_vibrato_params_s params;
-               bpbxsyn_vibrato_preset_params((int)value, &params);
-
-               event_send_flags_e flags = SEND_TO_GUI | SEND_TO_HOST | NO_RECURSION;
-               plugin_params_set_value(plug,
-                    instr_synth_param(BPBXSYN_PARAM_VIBRATO_DEPTH),
-                    params.depth, flags, out_events);
-               plugin_params_set_value(plug,
-                    instr_synth_param(BPBXSYN_PARAM_VIBRATO_SPEED),
-                    params.speed, flags, out_events);
-               plugin_params_set_value(plug,
-                    instr_synth_param(BPBXSYN_PARAM_VIBRATO_DELAY),
-                    (double)params.delay, flags, out_events);
-               plugin_params_set_value(plug,
-                    instr_synth_param(BPBXSYN_PARAM_VIBRATO_TYPE),
-                    (double)params.type, flags, out_events);
-            }
-            break;
-
-         case BPBXSYN_PARAM_VIBRATO_DEPTH:
-         case BPBXSYN_PARAM_VIBRATO_SPEED:
-         case BPBXSYN_PARAM_VIBRATO_DELAY:
-         case BPBXSYN_PARAM_VIBRATO_TYPE: {
-            double vibrato_preset;
-            bool s = instr_get_param(&plug->instrument,
-                instr_synth_param(BPBXSYN_PARAM_VIBRATO_PRESET), &vibrato_preset);
-            
-            if (!s && (int)vibrato_preset != BPBXSYN_VIBRATO_PRESET_CUSTOM)
-                plugin_params_set_value(plug, BPBXSYN_PARAM_VIBRATO_PRESET,
-                    (double)BPBXSYN_VIBRATO_PRESET_CUSTOM,
-                    SEND_TO_GUI | SEND_TO_HOST | NO_RECURSION, out_events);
-
-            break;
-         }
+      instr_param_value_s linked[INSTR_MAX_LINKED_PARAMS];
+      const uint32_t count =
+         instr_linked_params(&plug->instrument, id, value, linked);
+
+      for (uint32_t i = 0; i < count; ++i) {
+         plugin_params_set_value(plug, linked[i].id, linked[i].value,
+                                 SEND_TO_GUI | SEND_TO_HOST | NO_RECURSION,
+                                 out_events);
       }
    }
    
    return true;
 }
 
-bool plugin_params_value_to_text(const plugin_s *plug, clap_id param_id,
-                                 double value, char *out_buf,
-                                 uint32_t out_buf_capacity)
+bool param_value_to_text(const bpbxsyn_param_info_s *info, double value,
+                         char *out_buf, uint32_t out_buf_capacity)
 {
-    const bpbxsyn_param_info_s *info = instr_get_param_info(&plug->instrument, param_id);
     if (!info)
         return false;
 
@@ -583,11 +600,9 @@ bool plugin_params_value_to_text(const plugin_s *plug, clap_id param_id,
     return true;
 }
 
-bool plugin_params_text_to_value(const plugin_s *plug, clap_id param_id,
-                                 const char *param_value_text,
-                                 double *out_value)
+bool param_text_to_value(const bpbxsyn_param_info_s *info,
+                         const char *param_value_text, double *out_value)
 {
-    const bpbxsyn_param_info_s *info = instr_get_param_info(&plug->instrument, param_id);
     if (!info)
         return false;
 
@@ -595,12 +610,10 @@ bool plugin_params_text_to_value(const plugin_s *plug, clap_id param_id,
         case BPBXSYN_PARAM_UINT8:
         case BPBXSYN_PARAM_INT:
             if (info->enum_values) {
-                int end_value = (int)info->max_value;
-                for (int i = (int)info->min_value; i <= end_value; ++i) {
-                    if (!strcmp(param_value_text, info->enum_values[i])) {
-                        *out_value = (double)i;
-                        return true;
-                    }
+                int value;
+                if (instr_param_enum_value(info, param_value_text, &value)) {
+                    *out_value = (double)value;
+                    return true;
                 }
 
                 *out_value = 0.0;
@@ -623,262 +636,129 @@ bool plugin_params_text_to_value(const plugin_s *plug, clap_id param_id,
    return true;
 }
 
-
-
-
-
-// write primitive type in little-endian
-// return -1 on error
-static int64_t stream_write_prim(const clap_ostream_t *stream, const void *data, size_t data_size) {
-   if (endianness() == LITTLE_ENDIAN) {
-      size_t written = 0;
-
-      uint8_t *p = (uint8_t*)data;
-      while (written < data_size) {
-         int64_t res = stream->write(stream, p, data_size - written);
-         if (res <= 0) return -1;
-         written += res;
-         p += res;
-      }
-
-      assert(written == data_size);
-      if (written != data_size) return false;
-      return written;
-   } else {
-      size_t written = 0;
-
-      for (uint8_t *p = (uint8_t*)data + data_size - 1; p >= (uint8_t*)data; p--) {
-         int64_t res = stream->write(stream, p, sizeof(uint8_t));
-         if (res <= 0) return -1;
-         written += res;
-      }
-
-      assert(written == data_size);
-      return written;
-   }
+bool plugin_params_value_to_text(const plugin_s *plug, clap_id param_id,
+                                 double value, char *out_buf,
+                                 uint32_t out_buf_capacity)
+{
+    return param_value_to_text(
+        instr_get_param_info(&plug->instrument, param_id), value,
+        out_buf, out_buf_capacity);
 }
 
-// read primitive type in little-endian.
-// return -1 on error
-static int64_t stream_read_prim(const clap_istream_t *stream, void *data, size_t data_size) {
-   if (endianness() == LITTLE_ENDIAN) {
-      size_t read = 0;
-
-      uint8_t *p = (uint8_t*)data;
-      while (read < data_size) {
-         int64_t res = stream->read(stream, p, data_size - read);
-         if (res <= 0) return -1;
-         read += res;
-      }
-
-      assert(read == data_size);
-      if (read != data_size) return false;
-      return read;
-   } else {
-      int64_t read = 0;
-
-      for (uint8_t *write = (uint8_t*)data + data_size - 1; write >= (uint8_t*)data; write--) {
-         int64_t res = stream->read(stream, write, sizeof(uint8_t));
-         if (res == 0) break;
-         if (res == -1) return -1;
-         read += res;
-      }
-
-      return read;
-   }
+bool plugin_params_text_to_value(const plugin_s *plug, clap_id param_id,
+                                 const char *param_value_text,
+                                 double *out_value)
+{
+    return param_text_to_value(
+        instr_get_param_info(&plug->instrument, param_id), param_value_text,
+        out_value);
 }
 
-#define STATE_SAVE_VER 0
-#define ERRCHK(v) if ((v) == -1) goto error
+#define ERRCHK(v) if (!(v)) goto error
 
 bool plugin_state_save(const plugin_s *plug, const clap_ostream_t *stream) {
+    state_buffer_s buf;
+    state_buffer_init(&buf);
+
     // write save format revision (single number)
     uint32_t save_version = STATE_SAVE_VER;
-    ERRCHK(stream_write_prim(stream, &save_version, sizeof(save_version)));
+    ERRCHK(state_write_prim(&buf, &save_version, sizeof(save_version)));
 
     // write synth version
     uint32_t synth_maj = BPBXSYN_VERSION_MAJOR;
     uint32_t synth_min = BPBXSYN_VERSION_MINOR;
     uint32_t synth_rev = BPBXSYN_VERSION_REVISION;
-    ERRCHK(stream_write_prim(stream, &synth_maj, sizeof(synth_maj)));
-    ERRCHK(stream_write_prim(stream, &synth_min, sizeof(synth_min)));
-    ERRCHK(stream_write_prim(stream, &synth_rev, sizeof(synth_rev)));
-
-    // write instrument type
-    uint8_t type = (uint8_t)plug->instrument.type;
-    ERRCHK(stream_write_prim(stream, &type, sizeof(type)));
-    
-    // write instrument parameter data
-    uint32_t param_count = instr_params_count(&plug->instrument);
-    
-    // first, get list of parameter ids to write
-    instr_param_id *param_ids = malloc(param_count * sizeof(uint32_t));
-    int write_param_count = 0;
-
-    for (uint32_t i = 0; i < param_count; ++i) {
-        bool is_inactive;
-        uint32_t param_id = instr_get_param_id(&plug->instrument, i,
-                                               &is_inactive);
-        
-        if (param_id == INSTR_INVALID_ID) goto error;
-        if (is_inactive) continue;
-
-        // don't write the synth type parameter, because we already do that in
-        // the header
-        if (param_id == instr_global_id(INSTR_MODULE_CONTROL,
-                                        INSTR_CPARAM_SYNTH_TYPE))
-            continue;
-
-        // don't write this parameter if associated module is inactive
-        // uh, nevermind. i need to disable this so that it passes the
-        // clap-validator state reproducibiilty state.
-        // instr_module_e module;
-        // instr_local_id(param_id, &module, NULL);
-        // if (!instr_is_module_active(&plug->instrument, module))
-        //     continue;
-
-        param_ids[write_param_count++] = param_id;
-    }
-
-    // write parameter count
-    ERRCHK(stream_write_prim(stream, &write_param_count, sizeof(write_param_count)));
-
-    // write the parameters
-    for (uint32_t i = 0; i < write_param_count; ++i) {
-        uint32_t param_id = param_ids[i];
+    ERRCHK(state_write_prim(&buf, &synth_maj, sizeof(synth_maj)));
+    ERRCHK(state_write_prim(&buf, &synth_min, sizeof(synth_min)));
+    ERRCHK(state_write_prim(&buf, &synth_rev, sizeof(synth_rev)));
 
-        // get param info
-        const bpbxsyn_param_info_s *info = instr_get_param_info(&plug->instrument, param_id);
-        if (!info)
-            goto error;
+    ERRCHK(instr_state_save(&plug->instrument, &buf));
+    ERRCHK(state_buffer_flush(&buf, stream));
 
-        // write parameter id
-        ERRCHK(stream_write_prim(stream, info->id, sizeof(info->id)));
+    state_buffer_free(&buf);
+    return true;
 
-        // write parameter value
-        double value;
-        if (!instr_get_param(&plug->instrument, param_id, &value))
-            goto error;
-        
-        ERRCHK(stream_write_prim(stream, &value, sizeof(value)));
-    }
+    error:
+        state_buffer_free(&buf);
+        return false;
+}
 
-    free(param_ids);
+// apply a loaded instrument state
+static bool publish_state(plugin_s *plug, instr_shadow_s *shadow) {
+    const bpbxsyn_synth_type_e old_type = plug->instrument.type;
+    if (!instr_publish_shadow(&plug->instrument, shadow))
+        return false;
 
-    // write envelope data
-    uint8_t envelope_count = bpbxsyn_synth_envelope_count(plug->instrument.synth);
-    ERRCHK(stream_write_prim(stream, &envelope_count, sizeof(envelope_count)));
+    // while active, the state is applied by the audio thread, after which
+    // plugin_on_main_thread rescans the params
+    if (plug->instrument.is_active)
+        return true;
 
-    for (uint8_t i = 0; i < envelope_count; ++i) {
-        const bpbxsyn_envelope_s *env = bpbxsyn_synth_get_envelope(plug->instrument.synth, i);
-        if (env == NULL) goto error;
+    // the synth type of the state may differ, which changes which params
+    // are hidden
+    if (plug->host_params) {
+        clap_param_rescan_flags flags = CLAP_PARAM_RESCAN_VALUES;
+        if (plug->instrument.type != old_type)
+            flags |= CLAP_PARAM_RESCAN_INFO;
 
-        ERRCHK(stream_write_prim(stream, &env->index, sizeof(env->index)));
-        ERRCHK(stream_write_prim(stream, &env->curve_preset, sizeof(env->curve_preset)));
+        plug->host_params->rescan(plug->host, flags);
     }
 
     return true;
-    error:
-        free(param_ids);
-        return false;
 }
 
 bool plugin_state_load(plugin_s *plug, const clap_istream_t *stream) {
+    state_buffer_s buf;
+    state_buffer_init(&buf);
+    ERRCHK(state_buffer_fill(&buf, stream));
+
     // read versions; do strict version checking for now.
     uint32_t save_version;
-    ERRCHK(stream_read_prim(stream, &save_version, sizeof(save_version)));
-    if (save_version != STATE_SAVE_VER) return false;
+    ERRCHK(state_read_prim(&buf, &save_version, sizeof(save_version)));
+    if (save_version > STATE_SAVE_VER) goto error;
 
     // read and skip synth version
     uint32_t synth_maj;
     uint32_t synth_min;
     uint32_t synth_rev;
-    ERRCHK(stream_read_prim(stream, &synth_maj, sizeof(synth_maj)));
-    ERRCHK(stream_read_prim(stream, &synth_min, sizeof(synth_min)));
-    ERRCHK(stream_read_prim(stream, &synth_rev, sizeof(synth_rev)));
+    ERRCHK(state_read_prim(&buf, &synth_maj, sizeof(synth_maj)));
+    ERRCHK(state_read_prim(&buf, &synth_min, sizeof(synth_min)));
+    ERRCHK(state_read_prim(&buf, &synth_rev, sizeof(synth_rev)));
 
-    // read instrument type
-    uint8_t inst_type;
-    ERRCHK(stream_read_prim(stream, &inst_type, sizeof(inst_type)));
+    instr_shadow_s *shadow =
+        instr_state_load(&plug->instrument, &buf, save_version);
+    if (!shadow) goto error;
+    ERRCHK(publish_state(plug, shadow));
 
-    // load new instrument type
-    bpbxsyn_synth_s *new_synth =
-        bpbxsyn_synth_new(plug->ctx, inst_type);
-    
-    if (new_synth) {
-        int type_idx = instr_synth_type_index(inst_type);
-        if (type_idx == -1) {
-            bpbxsyn_synth_destroy(new_synth);
-            goto error;
-        }
-
-        assert(type_idx >= 0 && type_idx <= UINT8_MAX);
-        
-        plug->instrument.new_type_index = (uint8_t)type_idx;
-        plug->instrument.type_index = (uint8_t)type_idx;
-        plug->instrument.type = inst_type;
-
-        bpbxsyn_synth_destroy(plug->instrument.synth);
-        plug->instrument.synth = new_synth;
-    } else {
-        goto error;
-    }
-
-    uint32_t all_param_count = instr_params_count(&plug->instrument);
-    uint32_t param_count;
-    ERRCHK(stream_read_prim(stream, &param_count, sizeof(param_count)));
-
-    for (uint32_t i = 0; i < param_count; ++i) {
-        // read string id
-        char p_id[8];
-        ERRCHK(stream_read_prim(stream, p_id, sizeof(p_id)));
-
-        // get id of parameter with this string id
-        instr_param_id param_id = INSTR_INVALID_ID;
-        const bpbxsyn_param_info_s *info = NULL;
-        for (uint32_t j = 0; j < all_param_count; ++j) {
-            instr_param_id id = instr_get_param_id(&plug->instrument, j,
-                                                   NULL);
-            
-            assert(id != INSTR_INVALID_ID);
-            if (id == INSTR_INVALID_ID)
-                goto error;
-            
-            const bpbxsyn_param_info_s *vinfo = instr_get_param_info(&plug->instrument, id);
-            if (!vinfo)
-                goto error;
-            
-            if (!memcmp(vinfo->id, p_id, sizeof(p_id))) {
-                param_id = id;
-                break;
-            }
-        }
+    state_buffer_free(&buf);
+    resync_gui(plug);
+    return true;
 
-        if (param_id == INSTR_INVALID_ID)
-            goto error;
+    error:
+        state_buffer_free(&buf);
+        resync_gui(plug);
+        return false;
+}
 
-        // read value
-        double value;
-        ERRCHK(stream_read_prim(stream, &value, sizeof(value)));
-        if (!instr_set_param(&plug->instrument, param_id, &value))
-            goto error;
-    }
+bool plugin_load_preset(plugin_s *plug, const preset_bank_s *bank,
+                        uint32_t index)
+{
+    const void *data;
+    size_t size;
+    uint32_t save_version;
+    preset_bank_data(bank, index, &data, &size, &save_version);
+    if (save_version > STATE_SAVE_VER) return false;
 
-    // read envelopes
-    uint8_t envelope_count;
-    ERRCHK(stream_read_prim(stream, &envelope_count, sizeof(envelope_count)));
+    // read straight from the mapped bank
+    state_buffer_s buf;
+    state_buffer_view(&buf, data, size);
 
-    bpbxsyn_synth_clear_envelopes(plug->instrument.synth);
-    for (uint8_t i = 0; i < envelope_count; ++i) {
-        bpbxsyn_envelope_s *env = bpbxsyn_synth_add_envelope(plug->instrument.synth);
-        ERRCHK(stream_read_prim(stream, &env->index, sizeof(env->index)));
-        ERRCHK(stream_read_prim(stream, &env->curve_preset, sizeof(env->curve_preset)));
-    }
+    instr_shadow_s *shadow =
+        instr_state_load(&plug->instrument, &buf, save_version);
+    if (!shadow) return false;
 
-    if (plug->gui) gui_sync_state(plug->gui);
+    if (!publish_state(plug, shadow)) return false;
+    resync_gui(plug);
+    if (plug->host_state) plug->host_state->mark_dirty(plug->host);
     return true;
-
-    error:
-        if (plug->gui) gui_sync_state(plug->gui);
-        return false;
 }
\ No newline at end of file
@@ -4,7 +4,12 @@
 #include <beepbox_synth.h>
 #include <clap/clap.h>
 #include "include/instrument.h"
+#include "include/preset_bank.h"
+#include "include/synth_arena.h"
 #include "instrument_impl.h"
+#include "atomic_bool.h"
+#include "main_queue.h"
+#include "include/log_ring.h"
 #include <plugin_gui.h>
 
 typedef struct {
@@ -22,13 +27,26 @@ typedef struct {
     const clap_host_state_t *host_state;
     const clap_host_track_info_t *host_track_info;
     const clap_host_context_menu_t *host_context_menu;
+    const clap_host_preset_load_t *host_preset_load;
 
+    // set if this instance holds a reference to the static data
+    bool has_static_ref;
+
+    // allocations of ctx go to arena
+    synth_arena_s *arena;
     bpbxsyn_context_s *ctx;
     instrument_s instrument;
 
-    #ifndef _NDEBUG
-    size_t mem_allocated;
-    #endif
+    // work deferred from the audio thread to the main thread
+    main_queue_s main_queue;
+
+    // log messages, delivered on the main thread. NULL if the host has no
+    // logger.
+    log_ring_s *log_ring;
+
+    // index plus one of the preset picked in the gui, which is loaded on the
+    // main thread. 0 if none is pending.
+    atomic_uint pending_preset;
 } plugin_s;
 
 typedef enum {
@@ -37,7 +55,9 @@ typedef enum {
     NO_RECURSION = 4,
 } event_send_flags_e;
 
-void plugin_static_init(void);
+// reference-counted setup of process-wide data shared by all instances.
+// must be called from the main thread.
+bool plugin_static_init(void);
 void plugin_static_deinit(void);
 
 void plugin_create(plugin_s *plug, bpbxsyn_synth_type_e type);
@@ -47,6 +67,9 @@ void plugin_destroy(plugin_s *plug);
 bool plugin_activate(plugin_s *plug, double sample_rate,
                      uint32_t min_frames_count, uint32_t max_frames_count);
 bool plugin_deactivate(plugin_s *plug);
+void plugin_stop_processing(plugin_s *plug);
+void plugin_set_render_mode(plugin_s *plug, bool offline);
+void plugin_on_main_thread(plugin_s *plug);
 
 void plugin_process_gui_events(plugin_s *plug,
                                const clap_output_events_t *out_events);
@@ -73,7 +96,21 @@ bool plugin_params_text_to_value(const plugin_s *plugin, clap_id param_id,
                                  const char *param_value_text,
                                  double *out_value);
 
+// conversions between cbeepsynth parameter info and clap, shared by the
+// single and multi-timbral plugins
+bool param_info_to_clap(const bpbxsyn_param_info_s *info, clap_id id,
+                        bool is_inactive, clap_param_info_t *param_info);
+bool param_value_to_text(const bpbxsyn_param_info_s *info, double value,
+                         char *out_buf, uint32_t out_buf_capacity);
+bool param_text_to_value(const bpbxsyn_param_info_s *info,
+                         const char *param_value_text, double *out_value);
+
 bool plugin_state_save(const plugin_s *plugin, const clap_ostream_t *stream);
 bool plugin_state_load(plugin_s *plugin, const clap_istream_t *stream);
 
+// load a preset through the same path as plugin_state_load. main thread
+// only.
+bool plugin_load_preset(plugin_s *plug, const preset_bank_s *bank,
+                        uint32_t index);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,538 @@
+#include "include/preset_bank.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#define HEADER_SIZE 32
+#define RECORD_SIZE 24
+
+// record field offsets
+#define RECORD_NAME 0
+#define RECORD_CATEGORY 4
+#define RECORD_DATA_OFFSET 8
+#define RECORD_DATA_SIZE 12
+#define RECORD_SYNTH_TYPE 16
+
+struct preset_bank {
+    const uint8_t *data;
+    size_t size;
+
+    uint32_t save_version;
+    uint32_t count;
+    const uint8_t *records;
+    const uint8_t *by_name;
+    const uint8_t *by_category;
+    const uint8_t *by_type;
+    const char *strings;
+    uint32_t strings_size;
+
+    // set for banks opened through preset_bank_get
+    char *path;
+    struct preset_bank *next;
+};
+
+static preset_bank_s *shared_banks = NULL;
+
+static inline uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+        ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void write_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline const uint8_t* record(const preset_bank_s *bank,
+                                    uint32_t index)
+{
+    return bank->records + (size_t)index * RECORD_SIZE;
+}
+
+static inline uint32_t index_at(const uint8_t *order, uint32_t i) {
+    return read_u32(order + (size_t)i * 4);
+}
+
+static inline const char* record_name(const preset_bank_s *bank,
+                                      uint32_t index)
+{
+    return bank->strings + read_u32(record(bank, index) + RECORD_NAME);
+}
+
+static inline const char* record_category(const preset_bank_s *bank,
+                                          uint32_t index)
+{
+    return bank->strings + read_u32(record(bank, index) + RECORD_CATEGORY);
+}
+
+static inline int record_type(const preset_bank_s *bank, uint32_t index) {
+    return record(bank, index)[RECORD_SYNTH_TYPE];
+}
+
+/////////////
+// mapping //
+/////////////
+
+static bool map_file(const char *path, const uint8_t **data, size_t *size) {
+#ifdef _WIN32
+    wchar_t wpath[MAX_PATH];
+    if (!MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_PATH))
+        return false;
+
+    HANDLE file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0 ||
+        (uint64_t)file_size.QuadPart > SIZE_MAX)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) return false;
+
+    // the view keeps the mapping alive
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) return false;
+
+    *data = view;
+    *size = (size_t)file_size.QuadPart;
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) return false;
+
+    *data = view;
+    *size = (size_t)st.st_size;
+    return true;
+#endif
+}
+
+static void unmap_file(const uint8_t *data, size_t size) {
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+////////////////
+// validation //
+////////////////
+
+// orderings compare names last, so that equal names sort by the previous
+// keys first. names are the load keys of presets and must be unique, which
+// makes every ordering strict.
+static int compare_name(const preset_bank_s *bank, uint32_t a, uint32_t b) {
+    return strcmp(record_name(bank, a), record_name(bank, b));
+}
+
+static int compare_category(const preset_bank_s *bank, uint32_t a,
+                            uint32_t b)
+{
+    int c = strcmp(record_category(bank, a), record_category(bank, b));
+    return c ? c : compare_name(bank, a, b);
+}
+
+static int compare_type(const preset_bank_s *bank, uint32_t a, uint32_t b) {
+    int c = record_type(bank, a) - record_type(bank, b);
+    return c ? c : compare_name(bank, a, b);
+}
+
+static bool check_order(const preset_bank_s *bank, const uint8_t *order,
+                        int (*compare)(const preset_bank_s*, uint32_t,
+                                       uint32_t))
+{
+    for (uint32_t i = 0; i < bank->count; ++i) {
+        if (index_at(order, i) >= bank->count)
+            return false;
+
+        if (i > 0 && compare(bank, index_at(order, i - 1),
+                             index_at(order, i)) >= 0)
+            return false;
+    }
+
+    return true;
+}
+
+// check every offset in the file once, so that lookups can trust them
+static bool parse_bank(preset_bank_s *bank) {
+    const uint8_t *data = bank->data;
+    if (bank->size < HEADER_SIZE) return false;
+    if (memcmp(data, "BPBXBANK", 8)) return false;
+    if (read_u32(data + 8) != PRESET_BANK_FORMAT_VER) return false;
+
+    bank->save_version = read_u32(data + 12);
+    bank->count = read_u32(data + 16);
+
+    const uint64_t strings_offset = read_u32(data + 20);
+    const uint64_t strings_size = read_u32(data + 24);
+    const uint64_t tables_size =
+        (uint64_t)bank->count * (RECORD_SIZE + 3 * sizeof(uint32_t));
+
+    if (HEADER_SIZE + tables_size > bank->size) return false;
+    if (strings_offset + strings_size > bank->size) return false;
+
+    // every string ends before the end of the string table
+    if (strings_size == 0 ||
+        data[strings_offset + strings_size - 1] != '\0')
+        return false;
+
+    bank->records = data + HEADER_SIZE;
+    bank->by_name = bank->records + (size_t)bank->count * RECORD_SIZE;
+    bank->by_category = bank->by_name + (size_t)bank->count * 4;
+    bank->by_type = bank->by_category + (size_t)bank->count * 4;
+    bank->strings = (const char*)data + strings_offset;
+    bank->strings_size = (uint32_t)strings_size;
+
+    for (uint32_t i = 0; i < bank->count; ++i) {
+        const uint8_t *rec = record(bank, i);
+        if (read_u32(rec + RECORD_NAME) >= strings_size) return false;
+        if (read_u32(rec + RECORD_CATEGORY) >= strings_size) return false;
+
+        const uint64_t data_offset = read_u32(rec + RECORD_DATA_OFFSET);
+        const uint64_t data_size = read_u32(rec + RECORD_DATA_SIZE);
+        if (data_offset + data_size > bank->size) return false;
+
+        if (rec[RECORD_SYNTH_TYPE] >= BPBXSYN_SYNTH_COUNT) return false;
+    }
+
+    return check_order(bank, bank->by_name, compare_name) &&
+        check_order(bank, bank->by_category, compare_category) &&
+        check_order(bank, bank->by_type, compare_type);
+}
+
+preset_bank_s* preset_bank_open(const char *path) {
+    preset_bank_s *bank = calloc(1, sizeof(preset_bank_s));
+    if (!bank) return NULL;
+
+    if (!map_file(path, &bank->data, &bank->size)) {
+        free(bank);
+        return NULL;
+    }
+
+    if (!parse_bank(bank)) {
+        preset_bank_close(bank);
+        return NULL;
+    }
+
+    return bank;
+}
+
+void preset_bank_close(preset_bank_s *bank) {
+    if (!bank) return;
+
+    unmap_file(bank->data, bank->size);
+    free(bank->path);
+    free(bank);
+}
+
+preset_bank_s* preset_bank_get(const char *path) {
+    for (preset_bank_s *bank = shared_banks; bank; bank = bank->next) {
+        if (!strcmp(bank->path, path))
+            return bank;
+    }
+
+    const size_t path_len = strlen(path);
+    char *path_copy = malloc(path_len + 1);
+    if (!path_copy) return NULL;
+    memcpy(path_copy, path, path_len + 1);
+
+    preset_bank_s *bank = preset_bank_open(path);
+    if (!bank) {
+        free(path_copy);
+        return NULL;
+    }
+
+    bank->path = path_copy;
+    bank->next = shared_banks;
+    shared_banks = bank;
+    return bank;
+}
+
+void preset_bank_close_all(void) {
+    while (shared_banks) {
+        preset_bank_s *next = shared_banks->next;
+        preset_bank_close(shared_banks);
+        shared_banks = next;
+    }
+}
+
+/////////////
+// lookups //
+/////////////
+
+uint32_t preset_bank_count(const preset_bank_s *bank) {
+    return bank->count;
+}
+
+void preset_bank_info(const preset_bank_s *bank, uint32_t index,
+                      preset_info_s *info)
+{
+    assert(index < bank->count);
+
+    *info = (preset_info_s) {
+        .name = record_name(bank, index),
+        .category = record_category(bank, index),
+        .type = (bpbxsyn_synth_type_e)record_type(bank, index)
+    };
+}
+
+void preset_bank_data(const preset_bank_s *bank, uint32_t index,
+                      const void **data, size_t *size,
+                      uint32_t *save_version)
+{
+    assert(index < bank->count);
+
+    const uint8_t *rec = record(bank, index);
+    *data = bank->data + read_u32(rec + RECORD_DATA_OFFSET);
+    *size = read_u32(rec + RECORD_DATA_SIZE);
+    *save_version = bank->save_version;
+}
+
+uint32_t preset_bank_find(const preset_bank_s *bank, const char *name) {
+    uint32_t lo = 0;
+    uint32_t hi = bank->count;
+
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        const uint32_t index = index_at(bank->by_name, mid);
+
+        const int c = strcmp(record_name(bank, index), name);
+        if (c == 0) return index;
+
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return PRESET_BANK_NONE;
+}
+
+uint32_t preset_bank_by_category(const preset_bank_s *bank, uint32_t i) {
+    assert(i < bank->count);
+    return index_at(bank->by_category, i);
+}
+
+// first position in the type order whose type is not less than the given one
+static uint32_t type_lower_bound(const preset_bank_s *bank, int type) {
+    uint32_t lo = 0;
+    uint32_t hi = bank->count;
+
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (record_type(bank, index_at(bank->by_type, mid)) < type)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+uint32_t preset_bank_type_range(const preset_bank_s *bank,
+                                bpbxsyn_synth_type_e type, uint32_t *first)
+{
+    const uint32_t start = type_lower_bound(bank, (int)type);
+    const uint32_t end = type_lower_bound(bank, (int)type + 1);
+
+    *first = start;
+    return end - start;
+}
+
+uint32_t preset_bank_by_type(const preset_bank_s *bank, uint32_t i) {
+    assert(i < bank->count);
+    return index_at(bank->by_type, i);
+}
+
+/////////////
+// writing //
+/////////////
+
+typedef int (*compare_f)(const preset_bank_s*, uint32_t, uint32_t);
+
+// stable bottom-up merge sort of record indices
+static void sort_order(const preset_bank_s *bank, uint32_t *order,
+                       uint32_t *tmp, compare_f compare)
+{
+    const uint32_t count = bank->count;
+    for (uint32_t width = 1; width < count; width *= 2) {
+        for (uint32_t lo = 0; lo < count; lo += 2 * width) {
+            const uint32_t mid = lo + width < count ? lo + width : count;
+            const uint32_t hi = mid + width < count ? mid + width : count;
+
+            uint32_t a = lo, b = mid, k = lo;
+            while (a < mid && b < hi) {
+                if (compare(bank, order[b], order[a]) < 0)
+                    tmp[k++] = order[b++];
+                else
+                    tmp[k++] = order[a++];
+            }
+            while (a < mid) tmp[k++] = order[a++];
+            while (b < hi) tmp[k++] = order[b++];
+        }
+
+        memcpy(order, tmp, (size_t)count * sizeof(uint32_t));
+    }
+}
+
+static void write_order(const preset_bank_s *bank, uint8_t *table,
+                        uint32_t *order, uint32_t *tmp, compare_f compare)
+{
+    for (uint32_t i = 0; i < bank->count; ++i)
+        order[i] = i;
+
+    sort_order(bank, order, tmp, compare);
+
+    for (uint32_t i = 0; i < bank->count; ++i)
+        write_u32(table + (size_t)i * 4, order[i]);
+}
+
+static bool write_file(const char *path, const uint8_t *data, size_t size) {
+#ifdef _WIN32
+    wchar_t wpath[MAX_PATH];
+    if (!MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_PATH))
+        return false;
+
+    FILE *file = _wfopen(wpath, L"wb");
+#else
+    FILE *file = fopen(path, "wb");
+#endif
+    if (!file) return false;
+
+    const bool ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+// lay out the whole file in memory, then run it through the same checks
+// as preset_bank_open before writing it
+static uint8_t* build_bank(const preset_bank_entry_s *presets,
+                           uint32_t count, uint32_t save_version,
+                           size_t *out_size)
+{
+    // the string table starts with an empty string, which presets without
+    // a category point to
+    uint64_t strings_size = 1;
+    uint64_t data_size = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        strings_size += strlen(presets[i].name) + 1;
+        if (presets[i].category && presets[i].category[0])
+            strings_size += strlen(presets[i].category) + 1;
+        data_size += presets[i].size;
+    }
+
+    const uint64_t strings_offset =
+        HEADER_SIZE + (uint64_t)count * (RECORD_SIZE + 3 * sizeof(uint32_t));
+    const uint64_t data_offset = strings_offset + strings_size;
+    const uint64_t size = data_offset + data_size;
+    if (size > UINT32_MAX) return NULL;
+
+    uint8_t *image = calloc(1, (size_t)size);
+    uint32_t *order = malloc(((size_t)count + 1) * 2 * sizeof(uint32_t));
+    if (!image || !order) goto error;
+
+    memcpy(image, "BPBXBANK", 8);
+    write_u32(image + 8, PRESET_BANK_FORMAT_VER);
+    write_u32(image + 12, save_version);
+    write_u32(image + 16, count);
+    write_u32(image + 20, (uint32_t)strings_offset);
+    write_u32(image + 24, (uint32_t)strings_size);
+
+    uint32_t string_pos = 1;
+    uint32_t data_pos = (uint32_t)data_offset;
+    for (uint32_t i = 0; i < count; ++i) {
+        const preset_bank_entry_s *preset = &presets[i];
+        uint8_t *rec = image + HEADER_SIZE + (size_t)i * RECORD_SIZE;
+
+        size_t len = strlen(preset->name) + 1;
+        memcpy(image + strings_offset + string_pos, preset->name, len);
+        write_u32(rec + RECORD_NAME, string_pos);
+        string_pos += (uint32_t)len;
+
+        if (preset->category && preset->category[0]) {
+            len = strlen(preset->category) + 1;
+            memcpy(image + strings_offset + string_pos, preset->category, len);
+            write_u32(rec + RECORD_CATEGORY, string_pos);
+            string_pos += (uint32_t)len;
+        }
+
+        if (preset->size)
+            memcpy(image + data_pos, preset->data, preset->size);
+        write_u32(rec + RECORD_DATA_OFFSET, data_pos);
+        write_u32(rec + RECORD_DATA_SIZE, (uint32_t)preset->size);
+        data_pos += (uint32_t)preset->size;
+
+        if ((unsigned)preset->type >= BPBXSYN_SYNTH_COUNT) goto error;
+        rec[RECORD_SYNTH_TYPE] = (uint8_t)preset->type;
+    }
+
+    // enough of the bank for the orderings to compare records
+    preset_bank_s bank = {
+        .count = count,
+        .records = image + HEADER_SIZE,
+        .strings = (const char*)image + strings_offset,
+    };
+
+    uint8_t *tables = image + HEADER_SIZE + (size_t)count * RECORD_SIZE;
+    uint32_t *tmp = order + count + 1;
+    write_order(&bank, tables, order, tmp, compare_name);
+    write_order(&bank, tables + (size_t)count * 4, order, tmp,
+                compare_category);
+    write_order(&bank, tables + (size_t)count * 8, order, tmp, compare_type);
+
+    // rejects duplicate names
+    bank.data = image;
+    bank.size = (size_t)size;
+    if (!parse_bank(&bank)) goto error;
+
+    free(order);
+    *out_size = (size_t)size;
+    return image;
+
+    error:
+        free(order);
+        free(image);
+        return NULL;
+}
+
+bool preset_bank_write(const char *path, const preset_bank_entry_s *presets,
+                       uint32_t count, uint32_t save_version)
+{
+    size_t size;
+    uint8_t *image = build_bank(presets, count, save_version, &size);
+    if (!image) return false;
+
+    const bool ok = write_file(path, image, size);
+    free(image);
+    return ok;
+}
@@ -0,0 +1,372 @@
+#include "state.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cbeepsynth/synth/include/beepbox_synth.h>
+#include "system.h"
+#include "instrument_impl.h"
+#include "instr_tables.h"
+
+#define STATE_BUFFER_MIN_CAPACITY 1024
+#define STATE_READ_CHUNK 4096
+
+void state_buffer_init(state_buffer_s *buf) {
+    *buf = (state_buffer_s) { 0 };
+}
+
+void state_buffer_free(state_buffer_s *buf) {
+    free(buf->data);
+    *buf = (state_buffer_s) { 0 };
+}
+
+void state_buffer_view(state_buffer_s *buf, const void *data, size_t size) {
+    *buf = (state_buffer_s) {
+        .data = (uint8_t*)data,
+        .size = size,
+    };
+}
+
+static bool state_buffer_reserve(state_buffer_s *buf, size_t size) {
+    if (size <= buf->capacity) return true;
+
+    size_t new_capacity =
+        buf->capacity ? buf->capacity : STATE_BUFFER_MIN_CAPACITY;
+    while (new_capacity < size)
+        new_capacity *= 2;
+
+    uint8_t *new_data = realloc(buf->data, new_capacity);
+    if (!new_data) return false;
+
+    buf->data = new_data;
+    buf->capacity = new_capacity;
+    return true;
+}
+
+bool state_buffer_flush(const state_buffer_s *buf,
+                        const clap_ostream_t *stream)
+{
+    // the host may accept less than was given
+    size_t written = 0;
+    while (written < buf->size) {
+        int64_t res = stream->write(stream, buf->data + written,
+                                    buf->size - written);
+        if (res <= 0) return false;
+        written += (size_t)res;
+    }
+
+    return true;
+}
+
+bool state_buffer_fill(state_buffer_s *buf, const clap_istream_t *stream) {
+    for (;;) {
+        if (!state_buffer_reserve(buf, buf->size + STATE_READ_CHUNK))
+            return false;
+
+        int64_t res = stream->read(stream, buf->data + buf->size,
+                                   buf->capacity - buf->size);
+        if (res < 0) return false;
+        if (res == 0) break;
+        buf->size += (size_t)res;
+    }
+
+    return true;
+}
+
+bool state_write(state_buffer_s *buf, const void *data, size_t data_size) {
+    if (!state_buffer_reserve(buf, buf->size + data_size))
+        return false;
+
+    memcpy(buf->data + buf->size, data, data_size);
+    buf->size += data_size;
+    return true;
+}
+
+bool state_read(state_buffer_s *buf, void *data, size_t data_size) {
+    if (data_size > buf->size - buf->pos)
+        return false;
+
+    memcpy(data, buf->data + buf->pos, data_size);
+    buf->pos += data_size;
+    return true;
+}
+
+bool state_write_prim(state_buffer_s *buf, const void *data, size_t data_size) {
+    if (endianness() == LITTLE_ENDIAN)
+        return state_write(buf, data, data_size);
+
+    if (!state_buffer_reserve(buf, buf->size + data_size))
+        return false;
+
+    const uint8_t *src = data;
+    for (size_t i = 0; i < data_size; ++i) {
+        buf->data[buf->size + i] = src[data_size - 1 - i];
+    }
+
+    buf->size += data_size;
+    return true;
+}
+
+bool state_read_prim(state_buffer_s *buf, void *data, size_t data_size) {
+    if (endianness() == LITTLE_ENDIAN)
+        return state_read(buf, data, data_size);
+
+    if (data_size > buf->size - buf->pos)
+        return false;
+
+    uint8_t *dst = data;
+    for (size_t i = 0; i < data_size; ++i) {
+        dst[i] = buf->data[buf->pos + data_size - 1 - i];
+    }
+
+    buf->pos += data_size;
+    return true;
+}
+
+bool state_write_varint(state_buffer_s *buf, uint32_t value) {
+    uint8_t bytes[5];
+    size_t count = 0;
+
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value) byte |= 0x80;
+        bytes[count++] = byte;
+    } while (value);
+
+    return state_write(buf, bytes, count);
+}
+
+bool state_read_varint(state_buffer_s *buf, uint32_t *value) {
+    uint32_t result = 0;
+
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t byte;
+        if (!state_read(buf, &byte, sizeof(byte))) return false;
+
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+
+    // too many continuation bytes
+    return false;
+}
+
+#define ERRCHK(v) if (!(v)) goto error
+
+// returns true if the param at the given layout index is written to and
+// read from the state of the instrument
+static bool is_saved_param(const instrument_s *instr,
+                           const instr_param_layout_s *layout,
+                           uint32_t index)
+{
+    const instr_param_slot_s *slot = &layout->params[index];
+    if (slot->inactive) return false;
+
+    // instrument was created without this module
+    instr_module_e module;
+    instr_local_id(slot->id, &module, NULL);
+    if (!instr_has_module(instr, module))
+        return false;
+
+    // don't write the synth type parameter, because we already do that in
+    // the header
+    if (slot->id == instr_global_id(INSTR_MODULE_CONTROL,
+                                    INSTR_CPARAM_SYNTH_TYPE))
+        return false;
+
+    return true;
+}
+
+bool instr_state_save(const instrument_s *instr, state_buffer_s *buf) {
+    // the instrument may be processing, and a loaded state may not be
+    // applied yet. the published state has both covered.
+    instr_snapshot_s *snapshot = instr_snapshot_new();
+    if (!snapshot) return false;
+    instr_read_snapshot(instr, snapshot);
+
+    const instr_param_layout_s *layout = instr_param_layout(snapshot->type);
+    assert(layout);
+    if (!layout) goto error;
+
+    // write instrument type
+    uint8_t type = (uint8_t)snapshot->type;
+    ERRCHK(state_write_prim(buf, &type, sizeof(type)));
+
+    // only write parameters that differ from their default value. inactive
+    // modules are still written to pass the clap-validator state
+    // reproducibility test.
+    instr_param_id ids[INSTR_PARAM_COUNT];
+    double values[INSTR_PARAM_COUNT];
+    uint32_t write_param_count = 0;
+
+    for (uint32_t i = 0; i < layout->count; ++i) {
+        if (!is_saved_param(instr, layout, i)) continue;
+
+        if (!snapshot->readable[i]) goto error;
+
+        const double value = snapshot->values[i];
+        if (value == layout->params[i].info->default_value)
+            continue;
+
+        ids[write_param_count] = layout->params[i].id;
+        values[write_param_count] = value;
+        ++write_param_count;
+    }
+
+    ERRCHK(state_write_varint(buf, write_param_count));
+
+    for (uint32_t i = 0; i < write_param_count; ++i) {
+        ERRCHK(state_write_varint(buf, ids[i]));
+        ERRCHK(state_write_prim(buf, &values[i], sizeof(values[i])));
+    }
+
+    // write envelope data
+    uint8_t envelope_count = (uint8_t)snapshot->envelope_count;
+    ERRCHK(state_write_prim(buf, &envelope_count, sizeof(envelope_count)));
+
+    for (uint8_t i = 0; i < envelope_count; ++i) {
+        const bpbxsyn_envelope_s *env = &snapshot->envelopes[i];
+        ERRCHK(state_write_prim(buf, &env->index, sizeof(env->index)));
+        ERRCHK(state_write_prim(buf, &env->curve_preset, sizeof(env->curve_preset)));
+    }
+
+    instr_snapshot_free(snapshot);
+    return true;
+    error:
+        instr_snapshot_free(snapshot);
+        return false;
+}
+
+// revision 0: string id and value of every saved param. params that are
+// missing keep their current value.
+static bool read_params_v0(state_buffer_s *buf,
+                           const instr_param_layout_s *layout,
+                           instr_param_value_s *values, uint32_t *out_count)
+{
+    uint32_t param_count;
+    ERRCHK(state_read_prim(buf, &param_count, sizeof(param_count)));
+
+    // every param is saved at most once
+    if (param_count > INSTR_PARAM_COUNT)
+        goto error;
+
+    for (uint32_t i = 0; i < param_count; ++i) {
+        // read string id
+        char p_id[8];
+        ERRCHK(state_read(buf, p_id, sizeof(p_id)));
+
+        // get id of parameter with this string id
+        const instr_param_key_s *key = instr_param_find(layout, p_id);
+        if (!key)
+            goto error;
+
+        // read value
+        values[i].id = key->id;
+        values[i].info = key->info;
+        ERRCHK(state_read_prim(buf, &values[i].value,
+                               sizeof(values[i].value)));
+    }
+
+    *out_count = param_count;
+    return true;
+    error:
+        return false;
+}
+
+// revision 1: params that differ from their default, addressed by param
+// id. every other saved param is reset to its default.
+static bool read_sparse_params(const instrument_s *instr, state_buffer_s *buf,
+                               const instr_param_layout_s *layout,
+                               instr_param_value_s *values,
+                               uint32_t *out_count)
+{
+    // position in values of each param index, or -1 if it is not saved
+    int16_t value_pos[INSTR_PARAM_COUNT];
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < layout->count; ++i) {
+        if (!is_saved_param(instr, layout, i)) {
+            value_pos[i] = -1;
+            continue;
+        }
+
+        value_pos[i] = (int16_t)count;
+        values[count++] = (instr_param_value_s) {
+            .id = layout->params[i].id,
+            .info = layout->params[i].info,
+            .value = layout->params[i].info->default_value
+        };
+    }
+
+    uint32_t param_count;
+    ERRCHK(state_read_varint(buf, &param_count));
+    if (param_count > count)
+        goto error;
+
+    for (uint32_t i = 0; i < param_count; ++i) {
+        uint32_t id;
+        ERRCHK(state_read_varint(buf, &id));
+
+        const uint32_t index = instr_param_index(layout, id);
+        if (index == UINT32_MAX || value_pos[index] == -1)
+            goto error;
+
+        instr_param_value_s *v = &values[value_pos[index]];
+        ERRCHK(state_read_prim(buf, &v->value, sizeof(v->value)));
+    }
+
+    *out_count = count;
+    return true;
+    error:
+        return false;
+}
+
+instr_shadow_s* instr_state_load(const instrument_s *instr,
+                                 state_buffer_s *buf, uint32_t save_version)
+{
+    instr_shadow_s *shadow = NULL;
+
+    // read instrument type
+    uint8_t inst_type;
+    ERRCHK(state_read_prim(buf, &inst_type, sizeof(inst_type)));
+
+    shadow = instr_shadow_new(instr, inst_type);
+    if (!shadow) goto error;
+
+    const instr_param_layout_s *layout = instr_param_layout(shadow->type);
+    assert(layout);
+    if (!layout) goto error;
+
+    instr_param_value_s values[INSTR_PARAM_COUNT];
+    uint32_t value_count;
+
+    if (save_version == 0) {
+        ERRCHK(read_params_v0(buf, layout, values, &value_count));
+    } else {
+        ERRCHK(read_sparse_params(instr, buf, layout, values, &value_count));
+    }
+
+    if (!instr_shadow_set_params(shadow, values, value_count))
+        goto error;
+
+    // read envelopes
+    uint8_t envelope_count;
+    ERRCHK(state_read_prim(buf, &envelope_count, sizeof(envelope_count)));
+
+    bpbxsyn_synth_clear_envelopes(shadow->synth);
+    for (uint8_t i = 0; i < envelope_count; ++i) {
+        bpbxsyn_envelope_s *env = bpbxsyn_synth_add_envelope(shadow->synth);
+        ERRCHK(state_read_prim(buf, &env->index, sizeof(env->index)));
+        ERRCHK(state_read_prim(buf, &env->curve_preset, sizeof(env->curve_preset)));
+    }
+
+    return shadow;
+    error:
+        instr_shadow_free(shadow);
+        return NULL;
+}
@@ -0,0 +1,65 @@
+// serialization of plugin state to and from clap streams.
+//
+// state is built up in a memory buffer and handed to the host with as few
+// stream calls as possible. likewise, saved state is read into a buffer in
+// full before it is parsed.
+#ifndef _bpbxclap_state_h_
+#define _bpbxclap_state_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <clap/clap.h>
+#include "include/instrument.h"
+#include "instrument_impl.h"
+
+// revision 0 stored the string id and value of every param. revision 1
+// only stores params that differ from their default value, addressed by
+// their param id.
+#define STATE_SAVE_VER 1
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+
+    // read position
+    size_t pos;
+} state_buffer_s;
+
+void state_buffer_init(state_buffer_s *buf);
+void state_buffer_free(state_buffer_s *buf);
+
+// read-only view of memory owned elsewhere, such as a mapped preset bank.
+// the buffer must not be written to or freed.
+void state_buffer_view(state_buffer_s *buf, const void *data, size_t size);
+
+// write the entire buffer to the stream
+bool state_buffer_flush(const state_buffer_s *buf, const clap_ostream_t *stream);
+
+// read the stream until its end into the buffer
+bool state_buffer_fill(state_buffer_s *buf, const clap_istream_t *stream);
+
+bool state_write(state_buffer_s *buf, const void *data, size_t data_size);
+bool state_read(state_buffer_s *buf, void *data, size_t data_size);
+
+// write primitive type in little-endian
+bool state_write_prim(state_buffer_s *buf, const void *data, size_t data_size);
+
+// read primitive type in little-endian
+bool state_read_prim(state_buffer_s *buf, void *data, size_t data_size);
+
+// unsigned LEB128, 7 bits per byte
+bool state_write_varint(state_buffer_s *buf, uint32_t value);
+bool state_read_varint(state_buffer_s *buf, uint32_t *value);
+
+// write the synth type, parameters and envelopes of an instrument
+bool instr_state_save(const instrument_s *instr, state_buffer_s *buf);
+
+// read data written by instr_state_save with the given save revision into
+// a shadow of the instrument, to be applied with instr_publish_shadow.
+// returns NULL on failure, in which case the instrument is left as is.
+instr_shadow_s* instr_state_load(const instrument_s *instr,
+                                 state_buffer_s *buf, uint32_t save_version);
+
+#endif
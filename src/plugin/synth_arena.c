@@ -0,0 +1,295 @@
+// for posix_memalign
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#   define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "include/synth_arena.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "atomic_bool.h"
+
+#ifdef _WIN32
+#   include <malloc.h>
+#endif
+
+// chunks are aligned to their size, so the header of the chunk a block
+// belongs to is found by masking the address of the block
+#define CHUNK_SIZE (64 * 1024)
+#define CHUNK_HEADER_SIZE SYNTH_ARENA_ALIGNMENT
+
+// size classes are 64, 128, ..., 4096 bytes
+#define CLASS_COUNT 7
+
+// size class of chunks holding a single large block
+#define CLASS_LARGE UINT32_MAX
+
+typedef struct chunk {
+    struct chunk *next;
+    uint32_t size_class;
+
+    // size of the whole allocation, header included
+    size_t size;
+} chunk_s;
+
+typedef struct free_block {
+    struct free_block *next;
+} free_block_s;
+
+struct synth_arena {
+    // chunks of the size classes. large chunks are not tracked.
+    chunk_s *chunks;
+
+    free_block_s *free_lists[CLASS_COUNT];
+
+    // unused space at the end of the newest chunk of each class
+    uint8_t *bump[CLASS_COUNT];
+    uint8_t *bump_end[CLASS_COUNT];
+
+#ifdef PLUGIN_ALLOC_STATS
+    // written under the lock. readers go through stats_seq instead, which
+    // is odd while the stats are being written.
+    synth_arena_stats_s stats;
+    atomic_uint stats_seq;
+#endif
+
+    // held by whichever thread allocates or frees
+    atomic_bool locked;
+};
+
+static_assert(sizeof(chunk_s) <= CHUNK_HEADER_SIZE,
+              "chunk header does not fit");
+
+// size need not be a multiple of the chunk size
+static void* chunk_alloc(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, CHUNK_SIZE);
+#else
+    void *ptr;
+    if (posix_memalign(&ptr, CHUNK_SIZE, size)) return NULL;
+    return ptr;
+#endif
+}
+
+static void chunk_free(void *ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+static inline chunk_s* block_chunk(void *ptr) {
+    return (chunk_s*)((uintptr_t)ptr & ~(uintptr_t)(CHUNK_SIZE - 1));
+}
+
+static inline size_t class_size(int size_class) {
+    return (size_t)SYNTH_ARENA_ALIGNMENT << size_class;
+}
+
+static int find_class(size_t size) {
+    int size_class = 0;
+    while (class_size(size_class) < size) {
+        if (++size_class == CLASS_COUNT)
+            return -1;
+    }
+
+    return size_class;
+}
+
+#ifdef PLUGIN_ALLOC_STATS
+static inline void stats_begin_write(synth_arena_s *arena) {
+    const uint32_t s = atomic_load(&arena->stats_seq);
+    atomic_store(&arena->stats_seq, s + 1);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void stats_end_write(synth_arena_s *arena) {
+    atomic_store(&arena->stats_seq, atomic_load(&arena->stats_seq) + 1);
+}
+
+// in-use bytes change by size, reserved bytes by reserved
+static void stats_update(synth_arena_s *arena, ptrdiff_t size,
+                         ptrdiff_t reserved)
+{
+    synth_arena_stats_s *stats = &arena->stats;
+    stats_begin_write(arena);
+
+    stats->current_bytes += (size_t)size;
+    stats->reserved_bytes += (size_t)reserved;
+    if (size > 0) {
+        if (stats->current_bytes > stats->peak_bytes)
+            stats->peak_bytes = stats->current_bytes;
+        ++stats->alloc_count;
+    }
+
+    stats_end_write(arena);
+}
+
+#   define STATS_ALLOC(arena, size) stats_update(arena, (ptrdiff_t)(size), 0)
+#   define STATS_FREE(arena, size) stats_update(arena, -(ptrdiff_t)(size), 0)
+#   define STATS_RESERVE(arena, size) stats_update(arena, 0, (ptrdiff_t)(size))
+#   define STATS_RELEASE(arena, size) stats_update(arena, 0, -(ptrdiff_t)(size))
+#else
+#   define STATS_ALLOC(arena, size)
+#   define STATS_FREE(arena, size)
+#   define STATS_RESERVE(arena, size)
+#   define STATS_RELEASE(arena, size)
+#endif
+
+// only contended while the host renders offline, see synth_arena.h
+static inline void arena_lock(synth_arena_s *arena) {
+    while (atomic_exchange(&arena->locked, true)) {}
+}
+
+static inline void arena_unlock(synth_arena_s *arena) {
+    atomic_store(&arena->locked, false);
+}
+
+static void* alloc_large(synth_arena_s *arena, size_t size) {
+    (void)arena;
+
+    // the chunk alignment lets arena_free find the header
+    const size_t total = size + CHUNK_HEADER_SIZE;
+    if (total < size) return NULL;
+
+    chunk_s *chunk = chunk_alloc(total);
+    if (!chunk) return NULL;
+
+    *chunk = (chunk_s) {
+        .size_class = CLASS_LARGE,
+        .size = total,
+    };
+
+    STATS_RESERVE(arena, total);
+    STATS_ALLOC(arena, total);
+    return (uint8_t*)chunk + CHUNK_HEADER_SIZE;
+}
+
+static bool add_chunk(synth_arena_s *arena, int size_class) {
+    chunk_s *chunk = chunk_alloc(CHUNK_SIZE);
+    if (!chunk) return false;
+
+    *chunk = (chunk_s) {
+        .next = arena->chunks,
+        .size_class = (uint32_t)size_class,
+        .size = CHUNK_SIZE,
+    };
+    arena->chunks = chunk;
+
+    arena->bump[size_class] = (uint8_t*)chunk + CHUNK_HEADER_SIZE;
+    arena->bump_end[size_class] = (uint8_t*)chunk + CHUNK_SIZE;
+
+    STATS_RESERVE(arena, CHUNK_SIZE);
+    return true;
+}
+
+static void* alloc_block(synth_arena_s *arena, size_t size) {
+    if (size == 0) size = 1;
+
+    const int size_class = find_class(size);
+    if (size_class == -1)
+        return alloc_large(arena, size);
+
+    const size_t block_size = class_size(size_class);
+
+    free_block_s *block = arena->free_lists[size_class];
+    if (block) {
+        arena->free_lists[size_class] = block->next;
+        STATS_ALLOC(arena, block_size);
+        return block;
+    }
+
+    if (arena->bump_end[size_class] - arena->bump[size_class] <
+        (ptrdiff_t)block_size)
+    {
+        if (!add_chunk(arena, size_class)) return NULL;
+    }
+
+    void *ptr = arena->bump[size_class];
+    arena->bump[size_class] += block_size;
+
+    STATS_ALLOC(arena, block_size);
+    return ptr;
+}
+
+static void* arena_alloc(size_t size, void *userdata) {
+    synth_arena_s *arena = userdata;
+    arena_lock(arena);
+    void *ptr = alloc_block(arena, size);
+    arena_unlock(arena);
+    return ptr;
+}
+
+static void free_block(synth_arena_s *arena, void *ptr) {
+    chunk_s *chunk = block_chunk(ptr);
+
+    if (chunk->size_class == CLASS_LARGE) {
+        STATS_FREE(arena, chunk->size);
+        STATS_RELEASE(arena, chunk->size);
+        chunk_free(chunk);
+        return;
+    }
+
+    assert(chunk->size_class < CLASS_COUNT);
+    STATS_FREE(arena, class_size(chunk->size_class));
+
+    free_block_s *block = ptr;
+    block->next = arena->free_lists[chunk->size_class];
+    arena->free_lists[chunk->size_class] = block;
+}
+
+static void arena_free(void *ptr, void *userdata) {
+    if (!ptr) return;
+
+    synth_arena_s *arena = userdata;
+    arena_lock(arena);
+    free_block(arena, ptr);
+    arena_unlock(arena);
+}
+
+synth_arena_s* synth_arena_new(void) {
+    synth_arena_s *arena = calloc(1, sizeof(synth_arena_s));
+    if (!arena) return NULL;
+
+    atomic_store(&arena->locked, false);
+    return arena;
+}
+
+void synth_arena_free(synth_arena_s *arena) {
+    if (!arena) return;
+
+    chunk_s *chunk = arena->chunks;
+    while (chunk) {
+        chunk_s *next = chunk->next;
+        chunk_free(chunk);
+        chunk = next;
+    }
+
+    free(arena);
+}
+
+bpbxsyn_allocator_s synth_arena_allocator(synth_arena_s *arena) {
+    return (bpbxsyn_allocator_s) {
+        .alloc = arena_alloc,
+        .free = arena_free,
+        .userdata = arena
+    };
+}
+
+#ifdef PLUGIN_ALLOC_STATS
+void synth_arena_get_stats(const synth_arena_s *arena,
+                           synth_arena_stats_s *stats)
+{
+    for (;;) {
+        const uint32_t seq = atomic_load(&arena->stats_seq);
+        if (seq & 1) continue;
+
+        *stats = arena->stats;
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load(&arena->stats_seq) == seq) return;
+    }
+}
+#endif
@@ -0,0 +1,191 @@
+#include "worker_pool.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#if __STDC_VERSION__ >= 201112L && !defined (__STDC_NO_THREADS__) && defined (CLAP_HAS_THREADS_H)
+#   define WORKER_POOL_HAS_THREADS
+#   include <threads.h>
+#endif
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#else
+#   include <unistd.h>
+#endif
+
+#include "system.h"
+
+uint32_t worker_pool_hardware_threads(void) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+#else
+    return 1;
+#endif
+}
+
+#ifdef WORKER_POOL_HAS_THREADS
+
+struct worker_pool {
+    // worker threads, not counting the thread calling worker_pool_run
+    thrd_t *threads;
+    uint32_t thread_count;
+
+    mtx_t lock;
+    cnd_t work_cnd;
+    cnd_t done_cnd;
+
+    // everything below is guarded by lock
+    bool quit;
+    uint64_t generation;
+    uint32_t busy_workers;
+
+    worker_job_fn fn;
+    void *userdata;
+    uint32_t job_count;
+    uint32_t next_job;
+};
+
+// claim and run jobs of the current generation until none are left. called
+// and returns with the lock held.
+static void run_jobs(worker_pool_s *pool) {
+    while (pool->next_job < pool->job_count) {
+        const uint32_t job = pool->next_job++;
+        worker_job_fn fn = pool->fn;
+        void *userdata = pool->userdata;
+
+        mtx_unlock(&pool->lock);
+        fn(userdata, job);
+        mtx_lock(&pool->lock);
+    }
+}
+
+static int worker_main(void *arg) {
+    worker_pool_s *pool = arg;
+
+    // workers run audio processing, so treat denormals the same way the
+    // audio thread does
+    fp_env env = disable_denormals();
+
+    mtx_lock(&pool->lock);
+    uint64_t seen_generation = pool->generation;
+
+    for (;;) {
+        while (!pool->quit && pool->generation == seen_generation)
+            cnd_wait(&pool->work_cnd, &pool->lock);
+
+        if (pool->quit) break;
+        seen_generation = pool->generation;
+
+        ++pool->busy_workers;
+        run_jobs(pool);
+        if (--pool->busy_workers == 0)
+            cnd_signal(&pool->done_cnd);
+    }
+
+    mtx_unlock(&pool->lock);
+    enable_denormals(env);
+    return 0;
+}
+
+worker_pool_s* worker_pool_new(uint32_t thread_count) {
+    if (thread_count < 2) return NULL;
+
+    worker_pool_s *pool = calloc(1, sizeof(worker_pool_s));
+    if (!pool) return NULL;
+
+    pool->threads = calloc(thread_count - 1, sizeof(thrd_t));
+    if (!pool->threads) goto error;
+
+    if (mtx_init(&pool->lock, mtx_plain) != thrd_success) goto error;
+    cnd_init(&pool->work_cnd);
+    cnd_init(&pool->done_cnd);
+
+    for (uint32_t i = 0; i < thread_count - 1; ++i) {
+        if (thrd_create(&pool->threads[i], worker_main, pool) != thrd_success)
+            break;
+
+        ++pool->thread_count;
+    }
+
+    if (pool->thread_count == 0) {
+        worker_pool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+
+    error:
+        free(pool->threads);
+        free(pool);
+        return NULL;
+}
+
+void worker_pool_free(worker_pool_s *pool) {
+    if (!pool) return;
+
+    mtx_lock(&pool->lock);
+    pool->quit = true;
+    cnd_broadcast(&pool->work_cnd);
+    mtx_unlock(&pool->lock);
+
+    for (uint32_t i = 0; i < pool->thread_count; ++i) {
+        thrd_join(pool->threads[i], NULL);
+    }
+
+    cnd_destroy(&pool->done_cnd);
+    cnd_destroy(&pool->work_cnd);
+    mtx_destroy(&pool->lock);
+
+    free(pool->threads);
+    free(pool);
+}
+
+void worker_pool_run(worker_pool_s *pool, worker_job_fn fn, void *userdata,
+                     uint32_t job_count)
+{
+    mtx_lock(&pool->lock);
+    pool->fn = fn;
+    pool->userdata = userdata;
+    pool->job_count = job_count;
+    pool->next_job = 0;
+    ++pool->generation;
+    cnd_broadcast(&pool->work_cnd);
+
+    run_jobs(pool);
+
+    // a job that is still running belongs to a busy worker
+    while (pool->busy_workers > 0)
+        cnd_wait(&pool->done_cnd, &pool->lock);
+
+    mtx_unlock(&pool->lock);
+}
+
+#else
+
+worker_pool_s* worker_pool_new(uint32_t thread_count) {
+    (void)thread_count;
+    return NULL;
+}
+
+void worker_pool_free(worker_pool_s *pool) {
+    (void)pool;
+    assert(!pool);
+}
+
+void worker_pool_run(worker_pool_s *pool, worker_job_fn fn, void *userdata,
+                     uint32_t job_count)
+{
+    (void)pool;
+    for (uint32_t i = 0; i < job_count; ++i) {
+        fn(userdata, i);
+    }
+}
+
+#endif
@@ -0,0 +1,26 @@
+// fixed set of worker threads for splitting processing across cores. the
+// pool is only available if the platform provides C11 threads, otherwise
+// worker_pool_new returns NULL and callers run their jobs serially.
+#ifndef _bpbxclap_worker_pool_h_
+#define _bpbxclap_worker_pool_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct worker_pool worker_pool_s;
+typedef void (*worker_job_fn)(void *userdata, uint32_t job_index);
+
+// number of threads the pool should use, including the calling thread
+uint32_t worker_pool_hardware_threads(void);
+
+// create a pool that runs jobs on thread_count threads in total, one of
+// them being the thread that calls worker_pool_run.
+worker_pool_s* worker_pool_new(uint32_t thread_count);
+void worker_pool_free(worker_pool_s *pool);
+
+// run fn for every job index in [0, job_count) and wait until all of them
+// have finished. the calling thread runs jobs as well.
+void worker_pool_run(worker_pool_s *pool, worker_job_fn fn, void *userdata,
+                     uint32_t job_count);
+
+#endif
@@ -0,0 +1,78 @@
+#include <cassert>
+#include "geometry_cache.hpp"
+
+GeometryCache::GeometryCache() :
+    key(0),
+    valid(false),
+    recordList(nullptr)
+{}
+
+bool GeometryCache::replay(ImDrawList *drawList, ImVec2 origin, uint64_t key) {
+    if (!valid || key != this->key) return false;
+    if (vertices.Size == 0) return true;
+
+    // may start a new draw command if the indices would overflow, so the
+    // base index is read afterwards
+    drawList->PrimReserve(indices.Size, vertices.Size);
+    const unsigned int baseIndex = drawList->_VtxCurrentIdx;
+
+    ImDrawVert *vtx = drawList->_VtxWritePtr;
+    for (int i = 0; i < vertices.Size; i++) {
+        vtx[i] = vertices[i];
+        vtx[i].pos.x += origin.x;
+        vtx[i].pos.y += origin.y;
+    }
+
+    ImDrawIdx *idx = drawList->_IdxWritePtr;
+    for (int i = 0; i < indices.Size; i++)
+        idx[i] = (ImDrawIdx)(baseIndex + indices[i]);
+
+    drawList->_VtxWritePtr += vertices.Size;
+    drawList->_IdxWritePtr += indices.Size;
+    drawList->_VtxCurrentIdx += (unsigned int)vertices.Size;
+    return true;
+}
+
+void GeometryCache::begin(ImDrawList *drawList, ImVec2 origin, uint64_t key) {
+    assert(!recordList);
+
+    this->key = key;
+    valid = false;
+
+    recordList = drawList;
+    recordOrigin = origin;
+    recordVtxStart = drawList->VtxBuffer.Size;
+    recordIdxStart = drawList->IdxBuffer.Size;
+    recordCmdCount = drawList->CmdBuffer.Size;
+    recordVtxIndex = drawList->_VtxCurrentIdx;
+}
+
+void GeometryCache::end() {
+    assert(recordList);
+    ImDrawList *drawList = recordList;
+    recordList = nullptr;
+
+    vertices.resize(0);
+    indices.resize(0);
+
+    // the indices are only relative to one vertex offset
+    if (drawList->CmdBuffer.Size != recordCmdCount ||
+        drawList->_VtxCurrentIdx < recordVtxIndex)
+        return;
+
+    const int vtxCount = drawList->VtxBuffer.Size - recordVtxStart;
+    const int idxCount = drawList->IdxBuffer.Size - recordIdxStart;
+
+    vertices.resize(vtxCount);
+    for (int i = 0; i < vtxCount; i++) {
+        vertices[i] = drawList->VtxBuffer[recordVtxStart + i];
+        vertices[i].pos.x -= recordOrigin.x;
+        vertices[i].pos.y -= recordOrigin.y;
+    }
+
+    indices.resize(idxCount);
+    for (int i = 0; i < idxCount; i++)
+        indices[i] = (ImDrawIdx)(drawList->IdxBuffer[recordIdxStart + i] - recordVtxIndex);
+
+    valid = true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <imgui.h>
+
+// hash of everything the geometry of a widget depends on
+class GeometryKey {
+private:
+    uint64_t hash;
+
+public:
+    GeometryKey() : hash(0xcbf29ce484222325ull) {}
+
+    // fnv-1a over the bytes of the value
+    template <typename T>
+    GeometryKey& add(const T &value) {
+        unsigned char bytes[sizeof(T)];
+        memcpy(bytes, &value, sizeof(T));
+
+        for (size_t i = 0; i < sizeof(T); i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+
+        return *this;
+    }
+
+    inline uint64_t value() const { return hash; }
+}; // class GeometryKey
+
+// vertices and indices that a widget added to a draw list, kept to be
+// appended again on later frames as long as the key stays the same.
+// positions are stored relative to the origin of the widget, so the widget
+// can move without being rebuilt.
+//
+// geometry that switches draw commands, such as by pushing a clip rect, is
+// not cached.
+class GeometryCache {
+private:
+    ImVector<ImDrawVert> vertices;
+    ImVector<ImDrawIdx> indices;
+    uint64_t key;
+    bool valid;
+
+    // state of the draw list when recording began
+    ImDrawList *recordList;
+    ImVec2 recordOrigin;
+    int recordVtxStart;
+    int recordIdxStart;
+    int recordCmdCount;
+    unsigned int recordVtxIndex;
+
+public:
+    GeometryCache();
+
+    // append the cached geometry if it was recorded with the same key.
+    // otherwise, the widget has to draw itself between begin and end.
+    bool replay(ImDrawList *drawList, ImVec2 origin, uint64_t key);
+
+    void begin(ImDrawList *drawList, ImVec2 origin, uint64_t key);
+    void end();
+}; // class GeometryCache
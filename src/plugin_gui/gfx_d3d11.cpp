@@ -79,6 +79,7 @@ void gfx::realizeWindow(platform::Window *window) {
 
 void gfx::shutdownWindow(platform::Window *window) {
     ImGui_ImplDX11_Shutdown();
+    window->fontTexture = ImTextureID();
 
     if (window->gfxData->swapchain)
         window->gfxData->swapchain->Release();
@@ -87,7 +88,12 @@ void gfx::shutdownWindow(platform::Window *window) {
 }
 
 void gfx::beginFrame(platform::Window *window) {
+    // the backend uploads the shared atlas on its first frame and points
+    // the atlas at its texture, which the other windows cannot use
+    ImFontAtlas *fonts = ImGui::GetIO().Fonts;
+    if (window->fontTexture) fonts->SetTexID(window->fontTexture);
     ImGui_ImplDX11_NewFrame();
+    window->fontTexture = fonts->TexID;
 }
 
 void gfx::endFrame(platform::Window *window) {
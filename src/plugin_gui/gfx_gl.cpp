@@ -27,10 +27,16 @@ void gfx::realizeWindow(platform::Window *window) {
 
 void gfx::shutdownWindow(platform::Window *window) {
     ImGui_ImplOpenGL3_Shutdown();
+    window->fontTexture = ImTextureID();
 }
 
 void gfx::beginFrame(platform::Window *window) {
+    // the backend uploads the shared atlas on its first frame and points
+    // the atlas at its texture, which the other windows cannot use
+    ImFontAtlas *fonts = ImGui::GetIO().Fonts;
+    if (window->fontTexture) fonts->SetTexID(window->fontTexture);
     ImGui_ImplOpenGL3_NewFrame();
+    window->fontTexture = fonts->TexID;
 }
 
 void gfx::endFrame(platform::Window *window) {
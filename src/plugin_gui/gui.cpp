@@ -22,6 +22,16 @@ typedef struct plugin_gui_s {
 
 void gui_event_enqueue(plugin_gui_s *iface, gui_event_queue_item_s item) {
     iface->control.plugin_to_gui.enqueue(item);
+    iface->control.notifyPluginEvent();
+}
+
+void gui_param_changed(plugin_gui_s *iface, instr_param_id id, double value) {
+    iface->control.pluginParamChange(id, value);
+}
+
+void gui_wake(plugin_gui_s *iface) {
+    if (iface->control.takeWake())
+        platform::wake(iface->window);
 }
 
 bool gui_event_dequeue(plugin_gui_s *iface, gui_event_queue_item_s *item) {
@@ -74,13 +84,9 @@ static uint8_t feedbackSymbol[] = {
 };
 
 #define GET_PIXEL(x, y) (((y) * width) + (x)) * 4
-static void symbol_patch(unsigned char *pixels, int width, int height, void *userdata) {
-    int *idList = (int*)userdata;
-
-    ImGuiIO &io = ImGui::GetIO();
-
+static void symbol_patch(ImFontAtlas *fonts, unsigned char *pixels, int width, int height, const int *idList) {
     // left arrow
-    ImFontAtlasCustomRect *rect = io.Fonts->GetCustomRectByIndex(idList[0]);
+    ImFontAtlasCustomRect *rect = fonts->GetCustomRectByIndex(idList[0]);
     
     for (int y = 0; y < 12; y++) {
         for (int x = 0; x < 6; x++) {
@@ -94,7 +100,7 @@ static void symbol_patch(unsigned char *pixels, int width, int height, void *use
     }
 
     // right arrow
-    rect = io.Fonts->GetCustomRectByIndex(idList[1]);
+    rect = fonts->GetCustomRectByIndex(idList[1]);
     for (int y = 0; y < 12; y++) {
         for (int x = 0; x < 6; x++) {
             int pixIndex = GET_PIXEL(rect->X + x, rect->Y + y);
@@ -107,7 +113,7 @@ static void symbol_patch(unsigned char *pixels, int width, int height, void *use
     }
 
     // loop symbol
-    rect = io.Fonts->GetCustomRectByIndex(idList[2]);
+    rect = fonts->GetCustomRectByIndex(idList[2]);
     for (int y = 0; y < 12; y++) {
         for (int x = 0; x < 6; x++) {
             int pixIndex = GET_PIXEL(rect->X + x, rect->Y + y);
@@ -120,24 +126,32 @@ static void symbol_patch(unsigned char *pixels, int width, int height, void *use
     }
 }
 
-static void setUpGraphics(platform::Window *window) {
+// built once while any gui is open, and shared by the imgui contexts of
+// all windows
+static ImFontAtlas *sharedFonts = nullptr;
+
+static ImFontAtlas* buildFonts() {
+    ImFontAtlas *fonts = IM_NEW(ImFontAtlas)();
+
     // patch symbols to font atlas
-    ImGuiIO &io = ImGui::GetIO();
-    
-    ImFont *font = io.Fonts->AddFontDefault();
+    ImFont *font = fonts->AddFontDefault();
 
     int glyphIds[3];
-    glyphIds[0] = io.Fonts->AddCustomRectFontGlyph(font, 0x2190, 6, 12, 7.f, ImVec2(0.f, 2.f)); // left arrow
-    glyphIds[1] = io.Fonts->AddCustomRectFontGlyph(font, 0x2192, 6, 12, 7.f, ImVec2(0.f, 2.f)); // right arrow
-    glyphIds[2] = io.Fonts->AddCustomRectFontGlyph(font, 0x27F2, 6, 12, 7.f, ImVec2(0.f, 2.f)); // loop symbol
-    io.Fonts->Build();
+    glyphIds[0] = fonts->AddCustomRectFontGlyph(font, 0x2190, 6, 12, 7.f, ImVec2(0.f, 2.f)); // left arrow
+    glyphIds[1] = fonts->AddCustomRectFontGlyph(font, 0x2192, 6, 12, 7.f, ImVec2(0.f, 2.f)); // right arrow
+    glyphIds[2] = fonts->AddCustomRectFontGlyph(font, 0x27F2, 6, 12, 7.f, ImVec2(0.f, 2.f)); // loop symbol
+    fonts->Build();
 
     uint8_t *pixels;
     int width;
     int height;
-    io.Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
-    symbol_patch(pixels, width, height, (void*)glyphIds);
+    fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+    symbol_patch(fonts, pixels, width, height, glyphIds);
+
+    return fonts;
+}
 
+static void setUpGraphics(platform::Window *window) {
     plugin_gui_s *gui = (plugin_gui_s*) platform::getUserdata(window);
     gui->control.graphicsInit();
 }
@@ -314,9 +328,13 @@ plugin_gui_s* gui_create(const gui_creation_params_s *params) {
     plugin_gui_s *gui = new plugin_gui_s(params->plugin, params->host, params->instrument);
     gui->control.popupContextMenu = params->show_context_menu;
     gui->control.pluginUserdata = params->userdata;
+    gui->control.setPresets(params->presets, params->load_preset);
+    gui->control.synthArena = params->arena;
 
     if (openGuiCount == 0) {
-        platform::setup();
+        sharedFonts = buildFonts();
+        PluginController::loadSharedImages();
+        platform::setup(sharedFonts);
     }
     
     gui->window = platform::createWindow(GUI_DEFAULT_WIDTH, GUI_DEFAULT_HEIGHT, "BeepBox", eventHandler, drawHandler);
@@ -331,11 +349,13 @@ void gui_destroy(plugin_gui_s *gui) {
 
     if (--openGuiCount == 0) {
         platform::shutdown();
-    }
-}
+        PluginController::freeSharedImages();
 
-void gui_sync_state(plugin_gui_s *gui) {
-    gui->control.sync();
+        // imgui only unlocks atlases owned by a context
+        sharedFonts->Locked = false;
+        IM_DELETE(sharedFonts);
+        sharedFonts = nullptr;
+    }
 }
 
 bool gui_get_size(const plugin_gui_s *iface, uint32_t *width, uint32_t *height) {
@@ -369,6 +389,11 @@ void gui_suggest_title(plugin_gui_s *iface, const char *title) {
 }
 
 bool gui_show(plugin_gui_s *iface) {
+    // plugin events are not read while hidden. the gui thread rereads the
+    // whole state instead.
+    gui_event_queue_item_s item = {};
+    item.type = GUI_EVENT_RESYNC;
+    gui_event_enqueue(iface, item);
     platform::setVisible(iface->window, true);
     return true;
 }
@@ -7,6 +7,8 @@
 #include <clap/include/clap/ext/log.h>
 #include <cbeepsynth/synth/include/beepbox_synth.h>
 #include <plugin/include/instrument.h>
+#include <plugin/include/preset_bank.h>
+#include <plugin/include/synth_arena.h>
 
 #ifdef __cplusplus
 #include <cstdint>
@@ -61,6 +63,7 @@ typedef struct {
 
 typedef struct plugin_gui_s plugin_gui_s;
 typedef void (*show_context_menu_f)(int x, int y, uint32_t param, void *userdata);
+typedef void (*load_preset_f)(uint32_t index, void *userdata);
 
 typedef struct {
     const char *api;
@@ -71,11 +74,29 @@ typedef struct {
     instrument_s *instrument;
 
     show_context_menu_f show_context_menu;
+
+    // presets listed in the presets menu, may be NULL. load_preset is
+    // called from the gui thread with an index into this bank.
+    const preset_bank_s *presets;
+    load_preset_f load_preset;
+
+    // allocator of the synth, whose statistics are shown in the about
+    // window when built with PLUGIN_ALLOC_STATS
+    const synth_arena_s *arena;
+
     void *userdata;
 } gui_creation_params_s;
 
 void gui_event_enqueue(plugin_gui_s *iface, gui_event_queue_item_s item);
 bool gui_event_dequeue(plugin_gui_s *iface, gui_event_queue_item_s *item);
+
+// param changes from the plugin skip the event queue. only the newest
+// value of each param is kept until the gui reads it. id must be untyped.
+void gui_param_changed(plugin_gui_s *iface, instr_param_id id, double value);
+
+// enqueueing events asks the host for a main thread callback, from which
+// this must be called to redraw the gui
+void gui_wake(plugin_gui_s *iface);
 void gui_update_color(plugin_gui_s *gui, clap_color_t color);
 
 bool gui_is_api_supported(const char *api, bool is_floating);
@@ -83,7 +104,6 @@ bool gui_get_preferred_api(const char **api, bool *is_floating);
 
 plugin_gui_s* gui_create(const gui_creation_params_s *params);
 void gui_destroy(plugin_gui_s *iface);
-void gui_sync_state(plugin_gui_s *gui);
 
 bool gui_get_size(const plugin_gui_s *iface, uint32_t *width, uint32_t *height);
 bool gui_set_parent(plugin_gui_s *iface, const clap_window_t *window);
@@ -93,7 +113,13 @@ void gui_suggest_title(plugin_gui_s *iface, const char *title);
 bool gui_show(plugin_gui_s *iface);
 bool gui_hide(plugin_gui_s *iface);
 
-void gui_set_log_func(void (*log_func)(const clap_host_t *host, clap_log_severity severity, const char *msg), const clap_host_t *host);
+// messages logged by the editors go to the newest host that was added and
+// not removed yet. a plugin removes its host before it is destroyed.
+void gui_add_log_host(void (*log_func)(const clap_host_t *host, clap_log_severity severity, const char *msg), const clap_host_t *host);
+void gui_remove_log_host(const clap_host_t *host);
+
+// deliver the messages logged by the editors. called from the main thread.
+void gui_flush_log(void);
 
 #ifdef __cplusplus
 }
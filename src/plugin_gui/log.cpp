@@ -3,8 +3,11 @@
 
 #include <cstdarg>
 #include <cstdio>
+#include <mutex>
+#include <vector>
 #include "clap/include/clap/host.h"
 #include "include/plugin_gui.h"
+#include <plugin/include/log_ring.h>
 #include "log.hpp"
 
 typedef void (*log_func_f)(const clap_host_t *host, clap_log_severity severity, const char *msg);
@@ -39,12 +42,82 @@ static void default_log_func(const clap_host_t *host, clap_log_severity severity
     printf("%s\n", msg);
 }
 
-static log_func_f active_log_func = default_log_func;
-static const clap_host_t *log_host = nullptr;
+struct LogTarget {
+    log_func_f func;
+    const clap_host_t *host;
+};
 
-void gui_set_log_func(void (*log_func)(const clap_host_t *host, clap_log_severity severity, const char *msg), const clap_host_t *host) {
-    active_log_func = log_func;
-    log_host = host;
+// plugin instances that messages can be sent to. the newest one gets them,
+// and when it is destroyed the one before it takes over.
+static std::mutex log_mutex;
+
+static std::vector<LogTarget>& log_targets() {
+    static std::vector<LogTarget> *targets = new std::vector<LogTarget>();
+    return *targets;
+}
+
+// shared by every editor. never freed, as messages may still be pushed
+// while the library unloads.
+static log_ring_s* gui_log_ring() {
+    static log_ring_s *ring = log_ring_new();
+    return ring;
+}
+
+static void flush_locked() {
+    log_ring_s *ring = gui_log_ring();
+    if (!ring) return;
+
+    const std::vector<LogTarget> &targets = log_targets();
+    if (targets.empty())
+        log_ring_flush(ring, nullptr, default_log_func);
+    else
+        log_ring_flush(ring, targets.back().host, targets.back().func);
+}
+
+void gui_add_log_host(void (*log_func)(const clap_host_t *host, clap_log_severity severity, const char *msg), const clap_host_t *host) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    flush_locked();
+    log_targets().push_back({ log_func, host });
+}
+
+void gui_remove_log_host(const clap_host_t *host) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+
+    // pending messages may be meant for this host, which is still valid
+    flush_locked();
+
+    std::vector<LogTarget> &targets = log_targets();
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].host == host) {
+            targets.erase(targets.begin() + i);
+            break;
+        }
+    }
+}
+
+void gui_flush_log(void) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    flush_locked();
+}
+
+// the host logger is only called from the main thread, when a plugin
+// flushes the ring. without a host there is nothing to wait on, so the
+// default logger is called directly.
+static void deliver(clap_log_severity severity, const char *msg) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+
+    log_ring_s *ring = gui_log_ring();
+    const std::vector<LogTarget> &targets = log_targets();
+    if (targets.empty() || !ring) {
+        default_log_func(nullptr, severity, msg);
+        return;
+    }
+
+    // the host stays valid until gui_remove_log_host, which waits on the
+    // lock
+    const clap_host_t *host = targets.back().host;
+    if (log_ring_push(ring, severity, LOG_MSG_TEXT, nullptr, msg))
+        host->request_callback(host);
 }
 
 void log_debug(const char *fmt, ...) {
@@ -55,7 +128,7 @@ void log_debug(const char *fmt, ...) {
     vsnprintf(buf, 512, fmt, arg);
     va_end(arg);
 
-    active_log_func(log_host, CLAP_LOG_DEBUG, buf);
+    deliver(CLAP_LOG_DEBUG, buf);
 }
 
 void log_info(const char *fmt, ...) {
@@ -66,7 +139,7 @@ void log_info(const char *fmt, ...) {
     vsnprintf(buf, 512, fmt, arg);
     va_end(arg);
 
-    active_log_func(log_host, CLAP_LOG_INFO, buf);
+    deliver(CLAP_LOG_INFO, buf);
 }
 
 void log_warn(const char *fmt, ...) {
@@ -77,7 +150,7 @@ void log_warn(const char *fmt, ...) {
     vsnprintf(buf, 512, fmt, arg);
     va_end(arg);
 
-    active_log_func(log_host, CLAP_LOG_WARNING, buf);
+    deliver(CLAP_LOG_WARNING, buf);
 }
 
 void log_error(const char *fmt, ...) {
@@ -88,5 +161,5 @@ void log_error(const char *fmt, ...) {
     vsnprintf(buf, 512, fmt, arg);
     va_end(arg);
 
-    active_log_func(log_host, CLAP_LOG_ERROR, buf);
+    deliver(CLAP_LOG_ERROR, buf);
 }
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include <cassert>
+#include <algorithm>
+#include "param_store.hpp"
+
+static uint32_t moduleParamCount(instr_module_e module) {
+    switch (module) {
+        case INSTR_MODULE_SYNTH: {
+            uint32_t count = BPBXSYN_BASE_PARAM_COUNT;
+            for (int t = 0; t < BPBXSYN_SYNTH_COUNT; ++t) {
+                const bpbxsyn_synth_type_e type = instr_synth_type_values[t];
+                if (type == -1) continue;
+                count = std::max(count, (uint32_t)bpbxsyn_synth_param_count(type));
+            }
+
+            return count;
+        }
+
+        case INSTR_MODULE_CONTROL:    return INSTR_CPARAM_COUNT;
+        case INSTR_MODULE_PANNING:    return BPBXSYN_PANNING_PARAM_COUNT;
+        case INSTR_MODULE_DISTORTION: return BPBXSYN_DISTORTION_PARAM_COUNT;
+        case INSTR_MODULE_BITCRUSHER: return BPBXSYN_BITCRUSHER_PARAM_COUNT;
+        case INSTR_MODULE_CHORUS:     return BPBXSYN_CHORUS_PARAM_COUNT;
+        case INSTR_MODULE_ECHO:       return BPBXSYN_ECHO_PARAM_COUNT;
+        case INSTR_MODULE_REVERB:     return BPBXSYN_REVERB_PARAM_COUNT;
+        case INSTR_MODULE_EQ:         return BPBXSYN_EQ_PARAM_COUNT;
+        case INSTR_MODULE_VOLUME:     return BPBXSYN_VOLUME_PARAM_COUNT;
+
+        default: return 0;
+    }
+}
+
+const uint32_t* ParamStore::moduleBases() {
+    static uint32_t bases[INSTR_MODULE_COUNT + 1];
+    static bool initialized = false;
+
+    // only ever built on the gui thread
+    if (!initialized) {
+        bases[0] = 0;
+        for (int i = 0; i < INSTR_MODULE_COUNT; ++i)
+            bases[i + 1] = bases[i] + moduleParamCount((instr_module_e)i);
+
+        initialized = true;
+    }
+
+    return bases;
+}
+
+ParamStore::ParamStore() {
+    const uint32_t count = moduleBases()[INSTR_MODULE_COUNT];
+    values.resize(count, 0.0);
+    dirtyBits.resize((count + 63) / 64, 0);
+    markAllDirty();
+}
+
+uint32_t ParamStore::index(instr_param_id id) {
+    if (id == INSTR_INVALID_ID) return INVALID_INDEX;
+
+    instr_module_e module;
+    instr_param_id local;
+    instr_local_id(instr_untyped_param_id(id), &module, &local);
+    if (module >= INSTR_MODULE_COUNT) return INVALID_INDEX;
+
+    const uint32_t *bases = moduleBases();
+    const uint32_t i = bases[module] + local;
+    if (i >= bases[module + 1]) return INVALID_INDEX;
+
+    return i;
+}
+
+double ParamStore::operator[](instr_param_id id) const {
+    const uint32_t i = index(id);
+    assert(i != INVALID_INDEX);
+    if (i == INVALID_INDEX) return 0.0;
+
+    return values[i];
+}
+
+bool ParamStore::set(instr_param_id id, double value) {
+    const uint32_t i = index(id);
+    assert(i != INVALID_INDEX);
+    if (i == INVALID_INDEX) return false;
+
+    return setAt(i, value);
+}
+
+bool ParamStore::setAt(uint32_t i, double value) {
+    if (values[i] == value) return false;
+
+    values[i] = value;
+    dirtyBits[i / 64] |= (uint64_t)1 << (i % 64);
+    anyDirty = true;
+    return true;
+}
+
+bool ParamStore::isDirty(instr_param_id id) const {
+    const uint32_t i = index(id);
+    if (i == INVALID_INDEX) return false;
+
+    return (dirtyBits[i / 64] >> (i % 64)) & 1;
+}
+
+bool ParamStore::isDirty(instr_param_id id, uint32_t count) const {
+    if (!anyDirty || count == 0) return false;
+
+    const uint32_t first = index(id);
+    if (first == INVALID_INDEX) return false;
+    assert(index(id + count - 1) == first + count - 1);
+
+    for (uint32_t i = first; i < first + count; ++i) {
+        if ((dirtyBits[i / 64] >> (i % 64)) & 1)
+            return true;
+    }
+
+    return false;
+}
+
+void ParamStore::markAllDirty() {
+    std::fill(dirtyBits.begin(), dirtyBits.end(), ~(uint64_t)0);
+    anyDirty = true;
+}
+
+void ParamStore::clearDirty() {
+    if (!anyDirty) return;
+
+    std::fill(dirtyBits.begin(), dirtyBits.end(), 0);
+    anyDirty = false;
+}
+
+// stored from the audio thread
+static_assert(std::atomic<double>::is_always_lock_free, "atomic doubles are not lock-free");
+
+ParamShadow::ParamShadow() :
+    values(ParamStore::moduleBases()[INSTR_MODULE_COUNT]),
+    dirtyBits((values.size() + 63) / 64)
+{
+    for (auto &v : values)
+        v.store(0.0, std::memory_order_relaxed);
+    for (auto &bits : dirtyBits)
+        bits.store(0, std::memory_order_relaxed);
+}
+
+void ParamShadow::store(instr_param_id id, double value) {
+    const uint32_t i = ParamStore::index(id);
+    if (i == ParamStore::INVALID_INDEX) return;
+
+    values[i].store(value, std::memory_order_relaxed);
+    dirtyBits[i / 64].fetch_or((uint64_t)1 << (i % 64), std::memory_order_release);
+}
+
+bool ParamShadow::apply(ParamStore &store) {
+    bool changed = false;
+
+    for (size_t w = 0; w < dirtyBits.size(); ++w) {
+        // a store made after this reads the newest value, and raises the
+        // bit again to be applied once more next time
+        uint64_t bits = dirtyBits[w].exchange(0, std::memory_order_acquire);
+
+        for (uint32_t b = 0; bits; ++b, bits >>= 1) {
+            if (!(bits & 1)) continue;
+
+            const uint32_t i = (uint32_t)w * 64 + b;
+            if (store.setAt(i, values[i].load(std::memory_order_relaxed)))
+                changed = true;
+        }
+    }
+
+    return changed;
+}
+
+void ParamShadow::discard() {
+    for (auto &bits : dirtyBits)
+        bits.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include "include/plugin_gui.h"
+
+// copy of the instrument params kept by the gui. params are stored in a
+// dense array, indexed by the position of the module of the param plus its
+// local index. synth params are addressed by their untyped id, with room
+// for the synth type that has the most params.
+//
+// a param is flagged as dirty when its value changes, until clearDirty is
+// called at the end of the frame, so that anything derived from params
+// only has to be recomputed when they changed.
+class ParamStore {
+private:
+    std::vector<double> values;
+    std::vector<uint64_t> dirtyBits;
+    bool anyDirty;
+
+    // compact index of the first param of each module. the last entry is
+    // the total param count.
+    static const uint32_t* moduleBases();
+    friend class ParamShadow;
+
+public:
+    static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+    ParamStore();
+
+    // compact index of an untyped param id, or INVALID_INDEX
+    static uint32_t index(instr_param_id id);
+
+    // unknown params read as 0
+    double operator[](instr_param_id id) const;
+
+    // returns true if the value changed
+    bool set(instr_param_id id, double value);
+    bool setAt(uint32_t index, double value);
+
+    bool isDirty(instr_param_id id) const;
+
+    // check count params starting at id, which must be of the same module
+    bool isDirty(instr_param_id id, uint32_t count) const;
+
+    inline bool isAnyDirty() const { return anyDirty; }
+
+    void markAllDirty();
+    void clearDirty();
+}; // class ParamStore
+
+// newest param values sent from the audio thread. the audio thread stores
+// a value and then raises its bit in the dirty set, and the gui takes the
+// dirty set once per frame and reads only the params in it. nothing is
+// lost when the host automates faster than the gui draws; the gui just
+// skips to the latest value.
+class ParamShadow {
+private:
+    std::vector<std::atomic<double>> values;
+    std::vector<std::atomic<uint64_t>> dirtyBits;
+
+public:
+    ParamShadow();
+
+    // audio thread. id must be untyped.
+    void store(instr_param_id id, double value);
+
+    // gui thread. copies the params that changed since the last call into
+    // the store, returns true if any value in the store changed.
+    bool apply(ParamStore &store);
+
+    // gui thread. forget the pending changes, when the gui is about to read
+    // every param from the instrument.
+    void discard();
+}; // class ParamShadow
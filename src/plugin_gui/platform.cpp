@@ -2,6 +2,9 @@
 
 #include <cstdio>
 #include <cassert>
+#include <chrono>
+#include <vector>
+#include <algorithm>
 #include <imgui/imgui.h>
 #include <imgui/backends/imgui_impl_dx11.h>
 #include <pugl/pugl.h>
@@ -39,15 +42,20 @@
 // interval. clap does have timer support, but I've decided to do this in
 // a event loop thread just in case the host supports guis but not timers,
 // or the timer precision is horrible (minimum precision is 30 Hz)
+//
+// the thread sleeps while no window is shown. the lock is only held while
+// pugl runs, so the main thread can get in between updates.
 #ifndef _WIN32
 #define PUGL_UPDATE_IN_THREAD
 #include <mutex>
 #include <thread>
-#include <chrono>
+#include <condition_variable>
 
 static std::thread *uiUpdateThread = nullptr;
 static bool stopUpdateThread = false;
+static int visibleWindowCount = 0;
 static std::mutex threadMutex;
+static std::condition_variable threadWake;
 
 #define MUTEX_GUARD std::lock_guard mutexGuard(threadMutex)
 #else
@@ -56,8 +64,26 @@ static std::mutex threadMutex;
 
 static PuglWorld *puglWorld;
 static const char *worldClassName = "BeepBoxPluginWindow";
+static ImFontAtlas *sharedFonts;
+
+// every created window, for the scheduler
+static std::vector<platform::Window*> windows;
+
+// time that the windows woken in one update are expected to take to draw,
+// based on their average frame time. the focused window is always drawn.
+static constexpr double SCHEDULER_FRAME_BUDGET = 0.008;
+
+// minimum time between two draws of an unfocused window that was woken
+static constexpr double SCHEDULER_BACKGROUND_INTERVAL = 1.0 / 20.0;
+
+static double schedulerTime() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+void platform::setup(ImFontAtlas *fonts) {
+    sharedFonts = fonts;
 
-void platform::setup() {
     // initialize pugl
     puglWorld = puglNewWorld(PUGL_MODULE, 0);
     puglSetWorldString(puglWorld, PUGL_CLASS_NAME, worldClassName);
@@ -72,6 +98,7 @@ void platform::shutdown() {
             MUTEX_GUARD;
             stopUpdateThread = true;
         }
+        threadWake.notify_one();
         uiUpdateThread->join();
 
         delete uiUpdateThread;
@@ -85,6 +112,7 @@ void platform::shutdown() {
 
     puglFreeWorld(puglWorld);
     puglWorld = nullptr;
+    sharedFonts = nullptr;
 }
 
 static platform::Key puglKey(uint32_t k) {
@@ -157,7 +185,7 @@ static platform::Key puglKey(uint32_t k) {
 
 static void setupGraphics(platform::Window *window) {
     // initialize imgui context
-    ImGuiContext *ctx = ImGui::CreateContext();
+    ImGuiContext *ctx = ImGui::CreateContext(sharedFonts);
     window->imguiCtx = ctx;
     ImGui::SetCurrentContext(ctx);
 
@@ -192,6 +220,39 @@ public:
     ~DebounceHandle() { debounce = false; }
 };
 
+// fnv-1a
+static inline uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+static uint64_t hashDrawData(const ImDrawData *drawData) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    if (!drawData) return hash;
+
+    for (int n = 0; n < drawData->CmdListsCount; n++) {
+        const ImDrawList *list = drawData->CmdLists[n];
+        hash = hashBytes(hash, list->VtxBuffer.Data, list->VtxBuffer.size_in_bytes());
+        hash = hashBytes(hash, list->IdxBuffer.Data, list->IdxBuffer.size_in_bytes());
+
+        for (const ImDrawCmd &cmd : list->CmdBuffer) {
+            const ImTextureID texId = cmd.GetTexID();
+            hash = hashBytes(hash, &cmd.ClipRect, sizeof(cmd.ClipRect));
+            hash = hashBytes(hash, &texId, sizeof(texId));
+            hash = hashBytes(hash, &cmd.ElemCount, sizeof(cmd.ElemCount));
+            hash = hashBytes(hash, &cmd.IdxOffset, sizeof(cmd.IdxOffset));
+            hash = hashBytes(hash, &cmd.VtxOffset, sizeof(cmd.VtxOffset));
+        }
+    }
+
+    return hash;
+}
+
 static PuglStatus puglEventFunc(PuglView *view, const PuglEvent *rawEvent) {
     if (debounce) return PUGL_SUCCESS;
     DebounceHandle _;
@@ -266,15 +327,12 @@ static PuglStatus puglEventFunc(PuglView *view, const PuglEvent *rawEvent) {
             }
             break;
 
-        case PUGL_TIMER:
-            if (rawEvent->timer.id == 0) {
-                platform::Event event;
-                event.type = platform::Event::Idle;
-                window->evCallback(event, window);
-            }
-            break;
-        
         case PUGL_EXPOSE: {
+            const double startTime = schedulerTime();
+
+            // extra frames let imgui settle actions it defers to the next
+            // frame. they stop once the draw data no longer changes, and
+            // only the last frame is rendered.
             for (int i = 0; i <= window->redrawCounter; i++) {
                 // call ImGui new frame
                 gfx::beginFrame(window);
@@ -287,12 +345,26 @@ static PuglStatus puglEventFunc(PuglView *view, const PuglEvent *rawEvent) {
                 // then, the window callback
                 window->drawCallback(window);
 
-                // render the ImGui frame
                 ImGui::Render();
-                gfx::endFrame(window);
+
+                const uint64_t hash = hashDrawData(ImGui::GetDrawData());
+                const bool changed = hash != window->drawDataHash;
+                window->drawDataHash = hash;
+                if (i > 0 && !changed) break;
             }
+
+            // render the ImGui frame
+            gfx::endFrame(window);
             
             window->redrawCounter = 0;
+
+            const double endTime = schedulerTime();
+            platform::FrameStats &stats = window->frameStats;
+            stats.lastMs = (endTime - startTime) * 1000.0;
+            stats.averageMs = stats.frameCount == 0 ? stats.lastMs
+                : stats.averageMs * 0.9 + stats.lastMs * 0.1;
+            stats.frameCount++;
+            window->lastDrawTime = endTime;
             break;
         }
 
@@ -318,26 +390,69 @@ platform::Window* platform::createWindow(int width, int height, const char *name
     puglSetEventFunc(view, puglEventFunc);
 
     gfx::setupWindow(platform);
+    windows.push_back(platform);
 
     return platform;
 }
 
 void platform::closeWindow(Window *platform) {
-    // timers don't automatically destory themselves
-    // when the view it's associated with gets freed?
-    // strange.
-    // (was causing a segfault)
-    puglStopTimer(platform->puglView, 0);
-
     if (platform->puglView)
     {
         MUTEX_GUARD;
+#ifdef PUGL_UPDATE_IN_THREAD
+        if (platform->isVisible) visibleWindowCount--;
+#endif
+        windows.erase(std::find(windows.begin(), windows.end(), platform));
         puglFreeView(platform->puglView);
     }
     
     delete platform;
 }
 
+#ifdef PUGL_UPDATE_IN_THREAD
+// invalidate the woken windows that fit in this update. called with the
+// lock held, before puglUpdate draws them.
+static void scheduleWokenWindows() {
+    const double now = schedulerTime();
+
+    // the windows that waited the longest go first
+    platform::Window *queue[64];
+    size_t queueCount = 0;
+
+    for (platform::Window *window : windows) {
+        if (!window->isRealized || !window->isVisible) continue;
+        if (!window->wakePending.load()) continue;
+
+        // the window the user works in is never held back
+        if (puglHasFocus(window->puglView)) {
+            window->wakePending.store(false);
+            puglObscureView(window->puglView);
+            continue;
+        }
+
+        if (now - window->lastDrawTime < SCHEDULER_BACKGROUND_INTERVAL) continue;
+        if (queueCount < sizeof(queue) / sizeof(*queue))
+            queue[queueCount++] = window;
+    }
+
+    std::sort(queue, queue + queueCount, [](platform::Window *a, platform::Window *b) {
+        return a->lastDrawTime < b->lastDrawTime;
+    });
+
+    // the rest stay pending until the next update
+    double cost = 0.0;
+    for (size_t i = 0; i < queueCount; i++) {
+        platform::Window *window = queue[i];
+        const double frameCost = window->frameStats.averageMs / 1000.0;
+        if (i > 0 && cost + frameCost > SCHEDULER_FRAME_BUDGET) break;
+
+        window->wakePending.store(false);
+        puglObscureView(window->puglView);
+        cost += frameCost;
+    }
+}
+#endif
+
 static bool realizeWindow(platform::Window *window) {
     if (window->isRealized) return true;
 
@@ -348,21 +463,24 @@ static bool realizeWindow(platform::Window *window) {
     }
     window->isRealized = true;
 
-    puglStartTimer(window->puglView, 0, 1.0 / 60.0);
-
     // set up ui update thread if needed
 #ifdef PUGL_UPDATE_IN_THREAD
     if (!uiUpdateThread) {
         uiUpdateThread = new std::thread([] {
-            while (true) {
-                {
-                    MUTEX_GUARD;
-                    if (stopUpdateThread) break;
+            std::unique_lock lock(threadMutex);
 
-                    puglUpdate(puglWorld, 0.0);
+            while (!stopUpdateThread) {
+                if (visibleWindowCount == 0) {
+                    threadWake.wait(lock);
+                    continue;
                 }
 
+                scheduleWokenWindows();
+                puglUpdate(puglWorld, 0.0);
+
+                lock.unlock();
                 std::this_thread::sleep_for(std::chrono::microseconds(8333));
+                lock.lock();
             }
         });
     }
@@ -410,10 +528,22 @@ bool platform::setVisible(Window *window, bool visible) {
             return false;
         }
 
-        return puglShow(window->puglView, PUGL_SHOW_RAISE) == PUGL_SUCCESS;
+        if (puglShow(window->puglView, PUGL_SHOW_RAISE) != PUGL_SUCCESS)
+            return false;
     } else {
-        return puglHide(window->puglView) == PUGL_SUCCESS;
+        if (puglHide(window->puglView) != PUGL_SUCCESS)
+            return false;
     }
+
+#ifdef PUGL_UPDATE_IN_THREAD
+    if (visible != window->isVisible) {
+        visibleWindowCount += visible ? 1 : -1;
+        threadWake.notify_one();
+    }
+#endif
+
+    window->isVisible = visible;
+    return true;
 }
 
 bool platform::setTitle(Window *window, const char *title) {
@@ -426,5 +556,21 @@ bool platform::setTitle(Window *window, const char *title) {
 
 void platform::requestRedraw(Window *window, int extraFrames) {
     puglObscureView(window->puglView);
-    window->redrawCounter = extraFrames;
+    if (extraFrames > window->redrawCounter)
+        window->redrawCounter = extraFrames;
+}
+
+void platform::wake(Window *window) {
+#ifdef PUGL_UPDATE_IN_THREAD
+    // picked up by the update thread, without waiting for the lock
+    window->wakePending.store(true);
+#else
+    // the host drives the win32 message loop, and draws on this thread
+    if (!window->isRealized || !window->isVisible) return;
+    puglObscureView(window->puglView);
+#endif
+}
+
+platform::FrameStats platform::getFrameStats(const Window *window) {
+    return window->frameStats;
 }
\ No newline at end of file
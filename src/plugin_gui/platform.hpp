@@ -1,4 +1,6 @@
 #pragma once
+#include <cstdint>
+#include <atomic>
 #include <pugl/pugl.h>
 #include <imgui/imgui.h>
 
@@ -143,7 +145,6 @@ namespace platform {
 
             Realize,
             Unrealize,
-            Idle,
         } type;
         
         union {
@@ -160,7 +161,9 @@ namespace platform {
     typedef void (*EventHandler)(Event event, Window *platform);
     typedef void (*DrawHandler)(Window *platform);
 
-    void setup();
+    // the font atlas is shared by the imgui contexts of all windows, and
+    // must outlive them
+    void setup(ImFontAtlas *fonts);
     void shutdown();
 
     Window* createWindow(int width, int height, const char *name, EventHandler event, DrawHandler draw);
@@ -176,11 +179,31 @@ namespace platform {
     bool setTitle(Window *window, const char *title);
     bool setParent(Window *window, void *parentHandle);
     bool setTransientParent(Window *window, void *parentHandle);
+    // extra frames are only drawn for as long as they keep changing the
+    // draw data. must be called from an event or draw handler.
     void requestRedraw(Window *window, int extraFrames = 0);
 
+    // redraw the window from outside of its handlers, such as from the
+    // main thread when the plugin sent events. does nothing while hidden.
+    //
+    // woken windows are drawn by the ui scheduler, which gives priority to
+    // the focused window and limits how often and how many of the others
+    // are drawn per update.
+    void wake(Window *window);
+
+    // draw times of a window, for diagnostics
+    struct FrameStats {
+        double lastMs;
+        double averageMs;
+        uint64_t frameCount;
+    };
+
+    FrameStats getFrameStats(const Window *window);
+
     struct Window {
         PuglView *puglView;
         bool isRealized;
+        bool isVisible;
 
         int width;
         int height;
@@ -190,7 +213,19 @@ namespace platform {
         ImGuiContext *imguiCtx;
         gfx::WindowData *gfxData;
 
+        // font texture of the shared atlas in the graphics context of this
+        // window, set on the atlas before every frame
+        ImTextureID fontTexture;
+
         int redrawCounter;
+        uint64_t drawDataHash;
         void *userdata;
+
+        // set by wake, cleared once the scheduler invalidates the window
+        std::atomic_bool wakePending;
+
+        // seconds, from the clock of the scheduler
+        double lastDrawTime;
+        FrameStats frameStats;
     };
 }
\ No newline at end of file
@@ -21,22 +21,47 @@
 #define CPARAM(local_idx) instr_global_id(INSTR_MODULE_CONTROL, INSTR_CPARAM_##local_idx)
 #define PARAM(module, local_idx) instr_global_id(INSTR_MODULE_##module, local_idx)
 
+#ifdef PLUGIN_VST3
+// decoded once for every editor. each window still needs a texture of its
+// own, as their graphics contexts do not share resources.
+static struct {
+    uint8_t *pixels;
+    int width;
+    int height;
+} vstLogoImage;
+#endif
+
+void PluginController::loadSharedImages() {
+    #ifdef PLUGIN_VST3
+    int channels;
+    vstLogoImage.pixels = stbi_load_from_memory(resources::vst_logo, resources::vst_logo_len, &vstLogoImage.width, &vstLogoImage.height, &channels, 4);
+    #endif
+}
+
+void PluginController::freeSharedImages() {
+    #ifdef PLUGIN_VST3
+    if (vstLogoImage.pixels)
+        stbi_image_free(vstLogoImage.pixels);
+
+    vstLogoImage.pixels = nullptr;
+    #endif
+}
+
 void PluginController::graphicsInit() {
+    // new imgui context
+    styleApplied = false;
+
     #ifdef PLUGIN_VST3
-    int width, height, channels;
-    uint8_t *imageData = stbi_load_from_memory(resources::vst_logo, resources::vst_logo_len, &width, &height, &channels, 4);
-    if (imageData == nullptr) {
+    if (vstLogoImage.pixels == nullptr) {
         vstLogo.texture = nullptr;
         vstLogo.width = 0;
         vstLogo.height = 0;
         return;
     }
 
-    vstLogo.texture = gfx::createTexture(imageData, width, height);
-    vstLogo.width = width;
-    vstLogo.height = height;
-
-    stbi_image_free(imageData);
+    vstLogo.texture = gfx::createTexture(vstLogoImage.pixels, vstLogoImage.width, vstLogoImage.height);
+    vstLogo.width = vstLogoImage.width;
+    vstLogo.height = vstLogoImage.height;
     #endif
 }
 
@@ -55,40 +80,150 @@ PluginController::PluginController(const clap_plugin_t *plugin, const clap_host_
 {
     showAbout = false;
     useCustomColors = false;
+    styleApplied = false;
     showPanDelay = false;
     currentPage = PAGE_MAIN;
-    inst_type = bpbxsyn_synth_type(instr_get_synth(instrument));
+    snapshot = instr_snapshot_new();
+    instr_read_snapshot(instrument, snapshot);
+    inst_type = instr_snapshot_type(snapshot);
+    presetBank = nullptr;
+    loadPreset = nullptr;
+    synthArena = nullptr;
+    pluginEventOverflows = 0;
+    wakePending.store(false);
+    outbox.reserve(GUI_EVENT_QUEUE_SIZE);
 
     // initialize copy of plugin state
     sync();
 }
 
+PluginController::~PluginController() {
+    instr_snapshot_free(snapshot);
+}
+
+void PluginController::setPresets(const preset_bank_s *bank, load_preset_f loadPreset) {
+    this->presetBank = loadPreset ? bank : nullptr;
+    this->loadPreset = loadPreset;
+    presetCategories.clear();
+
+    if (!presetBank) return;
+
+    // split the category order into the runs of each category
+    const uint32_t count = preset_bank_count(presetBank);
+    for (uint32_t i = 0; i < count; ++i) {
+        preset_info_s info;
+        preset_bank_info(presetBank, preset_bank_by_category(presetBank, i), &info);
+
+        if (presetCategories.empty() || strcmp(presetCategories.back().name, info.category)) {
+            presetCategories.push_back({ info.category, i, 0 });
+        }
+
+        presetCategories.back().count++;
+    }
+}
+
+void PluginController::presetMenuItems(uint32_t (*order)(const preset_bank_s*, uint32_t),
+                                       uint32_t first, uint32_t count)
+{
+    // banks can be large, so only submit the items that are visible
+    ImGuiListClipper clipper;
+    clipper.Begin((int)count);
+
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+            const uint32_t index = order(presetBank, first + (uint32_t)i);
+
+            preset_info_s info;
+            preset_bank_info(presetBank, index, &info);
+
+            ImGui::PushID((int)index);
+            if (ImGui::MenuItem(info.name))
+                loadPreset(index, pluginUserdata);
+            ImGui::PopID();
+        }
+    }
+}
+
+void PluginController::drawPresetsMenu() {
+    if (!presetBank || preset_bank_count(presetBank) == 0) {
+        ImGui::MenuItem("No presets", nullptr, false, false);
+        return;
+    }
+
+    // presets made for the synth type in use
+    uint32_t first;
+    uint32_t count = preset_bank_type_range(presetBank, inst_type, &first);
+    if (ImGui::BeginMenu("Current Synth", count > 0)) {
+        presetMenuItems(preset_bank_by_type, first, count);
+        ImGui::EndMenu();
+    }
+
+    ImGui::Separator();
+
+    for (const PresetCategory &category : presetCategories) {
+        const char *name = category.name[0] ? category.name : "Uncategorized";
+
+        ImGui::PushID(category.name);
+        if (ImGui::BeginMenu(name)) {
+            presetMenuItems(preset_bank_by_category, category.first, category.count);
+            ImGui::EndMenu();
+        }
+        ImGui::PopID();
+    }
+}
+
 void PluginController::sync() {
-    bpbxsyn_synth_s *synth = instr_get_synth(instrument);
-    inst_type = bpbxsyn_synth_type(synth);
+    // the synth may be replaced by the audio thread at any time, so the
+    // state is read from the snapshot it publishes
+    instr_read_snapshot(instrument, snapshot);
+
+    // pending values of synth params of the old type would land on the
+    // params of the new one. the others are at least as new as the
+    // snapshot, and are applied after it.
+    const bpbxsyn_synth_type_e type = instr_snapshot_type(snapshot);
+    if (type != inst_type)
+        paramShadow.discard();
+    inst_type = type;
     
-    uint32_t param_count = instr_params_count(instrument);
-    params.reserve(param_count * 2.0);
+    uint32_t param_count = instr_snapshot_params_count(snapshot);
+    params.markAllDirty();
 
-    for (int i = 0; i < param_count; i++) {
-        instr_param_id id = instr_get_param_id(instrument, i, NULL);
+    for (uint32_t i = 0; i < param_count; i++) {
+        bool is_inactive;
+        double param_value;
+        instr_param_id id = instr_snapshot_param(snapshot, i, &is_inactive, &param_value);
         if (id == INSTR_INVALID_ID) {
-            log_error("could not initialize parameter #%i because get_info failed", i);
+            log_error("could not initialize parameter #%u because get_info failed", i);
             continue;
         }
 
-        double param_value;
-        if (!instr_get_param(instrument, id, &param_value)) {
-            log_error("could not initialize parameter #%i because get_value failed", i);
-        }
+        // synth params of other types are left out, and the ones of the
+        // current type are stored without their type tag
+        if (is_inactive) continue;
 
-        params[id] = param_value;
+        params.set(instr_untyped_param_id(id), param_value);
     }
 
+    uint32_t envelope_count;
+    const bpbxsyn_envelope_s *snapshotEnvelopes = instr_snapshot_envelopes(snapshot, &envelope_count);
+
     envelopes.clear();
     envelopes.reserve(BPBXSYN_MAX_ENVELOPE_COUNT);
-    envelopes.resize(bpbxsyn_synth_envelope_count(synth));
-    memcpy(envelopes.data(), bpbxsyn_synth_get_envelope(synth, 0), sizeof(bpbxsyn_envelope_s) * envelopes.size());
+    envelopes.assign(snapshotEnvelopes, snapshotEnvelopes + envelope_count);
+}
+
+void PluginController::notifyPluginEvent() {
+    if (!wakePending.exchange(true) && host->request_callback)
+        host->request_callback(host);
+}
+
+bool PluginController::takeWake() {
+    return wakePending.exchange(false);
+}
+
+void PluginController::pluginParamChange(instr_param_id id, double value) {
+    paramShadow.store(id, value);
+    notifyPluginEvent();
 }
 
 bool PluginController::updateParams() {
@@ -97,11 +232,6 @@ bool PluginController::updateParams() {
 
     while (plugin_to_gui.dequeue(item)) {
         switch (item.type) {
-            case GUI_EVENT_PARAM_CHANGE:
-                params[item.param_value.param_id] = item.param_value.value;
-                didWork = true;
-                break;
-            
             case GUI_EVENT_RESYNC:
                 sync();
                 didWork = true;
@@ -112,6 +242,19 @@ bool PluginController::updateParams() {
         }
     }
 
+    // events were lost, so the copy of the plugin state can't be trusted
+    const size_t overflows = plugin_to_gui.overflow_count();
+    if (overflows != pluginEventOverflows) {
+        pluginEventOverflows = overflows;
+        log_debug("plugin event queue overflowed, resyncing");
+        sync();
+        didWork = true;
+    }
+
+    // param values go through the shadow rather than the queue
+    if (paramShadow.apply(params))
+        didWork = true;
+
     return didWork;
 }
 
@@ -178,10 +321,36 @@ void PluginController::vertSliderParameter(uint32_t paramId, const char *id, ImV
     paramControls(paramId);
 }
 
-void PluginController::queueCheck() {
+void PluginController::sendEvent(const gui_event_queue_item_s &item) {
+    if (item.type == GUI_EVENT_PARAM_CHANGE) {
+        for (size_t i = outbox.size(); i-- > 0;) {
+            gui_event_queue_item_s &queued = outbox[i];
+            if (queued.type != GUI_EVENT_PARAM_CHANGE) break;
+
+            if (queued.param_value.param_id == item.param_value.param_id) {
+                queued.param_value.value = item.param_value.value;
+                return;
+            }
+        }
+    }
+
+    outbox.push_back(item);
+}
+
+bool PluginController::flushEvents() {
+    if (outbox.empty()) return true;
+
+    size_t sent = 0;
+    while (sent < outbox.size() && gui_to_plugin.enqueue(outbox[sent]))
+        sent++;
+
+    outbox.erase(outbox.begin(), outbox.begin() + sent);
+
     // request process in case plugin is sleeping
-    if (host->request_process)
+    if (sent > 0 && host->request_process)
         host->request_process(host);
+
+    return outbox.empty();
 }
 
 void PluginController::paramGestureBegin(uint32_t param_id) {
@@ -189,12 +358,7 @@ void PluginController::paramGestureBegin(uint32_t param_id) {
     item.type = GUI_EVENT_PARAM_GESTURE_BEGIN;
     item.gesture.param_id = param_id;
 
-    gui_to_plugin.enqueue(item);
-    queueCheck();
-
-#ifndef _NDEBUG
-    log_debug("paramGestureBegin %i", param_id);
-#endif
+    sendEvent(item);
 }
 
 void PluginController::paramChange(uint32_t param_id, double value) {
@@ -203,10 +367,9 @@ void PluginController::paramChange(uint32_t param_id, double value) {
     item.param_value.param_id = param_id;
     item.param_value.value = value;
 
-    gui_to_plugin.enqueue(item);
-    queueCheck();
+    sendEvent(item);
 
-    params[param_id] = value;
+    params.set(param_id, value);
 }
 
 void PluginController::paramGestureEnd(uint32_t param_id) {
@@ -214,12 +377,7 @@ void PluginController::paramGestureEnd(uint32_t param_id) {
     item.type = GUI_EVENT_PARAM_GESTURE_END;
     item.gesture.param_id = param_id;
 
-    gui_to_plugin.enqueue(item);
-    queueCheck();
-
-#ifndef _NDEBUG
-    log_debug("paramGestureEnd %i", param_id);
-#endif
+    sendEvent(item);
 }
 
 void PluginController::event(platform::Event ev, platform::Window *window) {
@@ -227,7 +385,7 @@ void PluginController::event(platform::Event ev, platform::Window *window) {
         platform::requestRedraw(window);
 }
 
-void PluginController::drawAbout(ImGuiWindowFlags winFlags) {
+void PluginController::drawAbout(ImGuiWindowFlags winFlags, platform::Window *window) {
     ImGui::Begin("about", NULL, winFlags);
     ImGui::TextWrapped("Version: " PLUGIN_VERSION);
 
@@ -243,6 +401,26 @@ void PluginController::drawAbout(ImGuiWindowFlags winFlags) {
     ImGui::Bullet();
     ImGui::TextLinkOpenURL("Dear ImGui", "https://github.com/ocornut/imgui");
 
+    #ifdef PLUGIN_ALLOC_STATS
+    if (synthArena) {
+        synth_arena_stats_s stats;
+        synth_arena_get_stats(synthArena, &stats);
+
+        ImGui::NewLine();
+        ImGui::Text("Synth memory:");
+        ImGui::BulletText("%zu bytes in use (%zu peak)", stats.current_bytes, stats.peak_bytes);
+        ImGui::BulletText("%zu bytes reserved", stats.reserved_bytes);
+        ImGui::BulletText("%llu allocations", (unsigned long long)stats.alloc_count);
+    }
+    #endif
+
+    #ifndef NDEBUG
+    platform::FrameStats frameStats = platform::getFrameStats(window);
+    ImGui::NewLine();
+    ImGui::Text("Frame time: %.2f ms (%.2f ms avg)", frameStats.lastMs, frameStats.averageMs);
+    ImGui::Text("Queue overflows: %zu out, %zu in", gui_to_plugin.overflow_count(), plugin_to_gui.overflow_count());
+    #endif
+
     // show vst3-compatible logo
     #ifdef PLUGIN_VST3
     ImGui::NewLine();
@@ -796,7 +974,7 @@ void PluginController::drawEnvelopes() {
 
             gui_event_queue_item_s queue_item {};
             queue_item.type = GUI_EVENT_ADD_ENVELOPE;
-            gui_to_plugin.enqueue(queue_item);
+            sendEvent(queue_item);
         }
     }
 
@@ -897,7 +1075,7 @@ void PluginController::drawEnvelopes() {
             gui_event_queue_item_s queue_item {};
             queue_item.type = GUI_EVENT_REMOVE_ENVELOPE;
             queue_item.envelope_removal.index = envIndex;
-            gui_to_plugin.enqueue(queue_item);
+            sendEvent(queue_item);
 
             envelopes.erase(envelopes.begin() + envIndex);
             envIndex--;
@@ -914,11 +1092,17 @@ void PluginController::drawEnvelopes() {
             queue_item.type = GUI_EVENT_MODIFY_ENVELOPE;
             queue_item.modify_envelope.index = envIndex;
             queue_item.modify_envelope.envelope = env;
-            gui_to_plugin.enqueue(queue_item);
+            sendEvent(queue_item);
         }
     }
 }
 
+// geometry built from an unrounded origin is only the same at the same
+// subpixel offset
+static ImVec2 fractionalPart(ImVec2 v) {
+    return ImVec2(v.x - floorf(v.x), v.y - floorf(v.y));
+}
+
 static void drawDashedHLine(
     ImDrawList *drawList, float startX, float endX, float y,
     float segmentWidth, float spacing,
@@ -965,76 +1149,85 @@ void PluginController::drawFadeWidget(const char *id, ImVec2 size) {
     ImU32 barColor = ImGui::GetColorU32(ImGuiCol_ButtonHovered);
     ImU32 graphColor = ImGui::GetColorU32(ImGuiCol_Header);
 
-    // draw "graph"
-    {
-        // fade in triangle
-        if (fadeInVal > 0) {
-            drawList->AddTriangleFilled(
+    GeometryKey key;
+    key.add(size).add(fractionalPart(ui_origin)).add(barColor).add(graphColor).add(fadeInVal).add(fadeOutVal);
+
+    if (!fadeGeometry.replay(drawList, ui_origin, key.value())) {
+        fadeGeometry.begin(drawList, ui_origin, key.value());
+
+        // draw "graph"
+        {
+            // fade in triangle
+            if (fadeInVal > 0) {
+                drawList->AddTriangleFilled(
+                    ImVec2(fadeInX, ui_origin.y),
+                    ImVec2(fadeInX, ui_end.y),
+                    ImVec2(ui_origin.x, ui_end.y),
+                    graphColor
+                );
+            }
+
+            // the rect inbetween fade in and fade out
+            drawList->AddRectFilled(
                 ImVec2(fadeInX, ui_origin.y),
-                ImVec2(fadeInX, ui_end.y),
-                ImVec2(ui_origin.x, ui_end.y),
+                ImVec2(min(fadeOutX, fadeOutRestX), ui_end.y),
                 graphColor
             );
+
+            // fade out triangle
+            if (fadeOutVal > 0) {
+                drawList->AddTriangleFilled(
+                    ImVec2(fadeOutRestX, ui_origin.y),
+                    ImVec2(fadeOutX, ui_end.y),
+                    ImVec2(fadeOutRestX, ui_end.y),
+                    graphColor
+                );
+            } else if (fadeOutVal < 0) {
+                drawList->AddTriangleFilled(
+                    ImVec2(fadeOutX, ui_origin.y),
+                    ImVec2(fadeOutRestX, ui_end.y),
+                    ImVec2(fadeOutX, ui_end.y),
+                    graphColor
+                );
+            }
         }
 
-        // the rect inbetween fade in and fade out
+        // draw fade in bar
         drawList->AddRectFilled(
             ImVec2(fadeInX, ui_origin.y),
-            ImVec2(min(fadeOutX, fadeOutRestX), ui_end.y),
-            graphColor
+            ImVec2(fadeInX + 2.f, ui_end.y),
+            barColor
         );
 
-        // fade out triangle
-        if (fadeOutVal > 0) {
-            drawList->AddTriangleFilled(
-                ImVec2(fadeOutRestX, ui_origin.y),
-                ImVec2(fadeOutX, ui_end.y),
-                ImVec2(fadeOutRestX, ui_end.y),
-                graphColor
-            );
-        } else if (fadeOutVal < 0) {
-            drawList->AddTriangleFilled(
-                ImVec2(fadeOutX, ui_origin.y),
-                ImVec2(fadeOutRestX, ui_end.y),
-                ImVec2(fadeOutX, ui_end.y),
-                graphColor
-            );
+        // draw dashed line for fade out rest bar
+        float dashHeight = 4.f;
+        float dashSpaceHeight = 3.f;
+        int i = 0;
+        for (float y = ui_origin.y; y < ui_end.y;) {
+            if (i++ % 2 == 0) {
+                float endY = clamp(y + dashHeight, ui_origin.y, ui_end.y);
+                drawList->AddRectFilled(
+                    ImVec2(fadeOutRestX - 1.f, y),
+                    ImVec2(fadeOutRestX, endY),
+                    barColor
+                );
+
+                y += dashHeight;
+            } else {
+                y += dashSpaceHeight;
+            }
         }
-    }
 
-    // draw fade in bar
-    drawList->AddRectFilled(
-        ImVec2(fadeInX, ui_origin.y),
-        ImVec2(fadeInX + 2.f, ui_end.y),
-        barColor
-    );
-
-    // draw dashed line for fade out rest bar
-    float dashHeight = 4.f;
-    float dashSpaceHeight = 3.f;
-    int i = 0;
-    for (float y = ui_origin.y; y < ui_end.y;) {
-        if (i++ % 2 == 0) {
-            float endY = clamp(y + dashHeight, ui_origin.y, ui_end.y);
-            drawList->AddRectFilled(
-                ImVec2(fadeOutRestX - 1.f, y),
-                ImVec2(fadeOutRestX, endY),
-                barColor
-            );
+        // draw fade out bar
+        drawList->AddRectFilled(
+            ImVec2(fadeOutX - 2.f, ui_origin.y),
+            ImVec2(fadeOutX, ui_end.y),
+            barColor
+        );
 
-            y += dashHeight;
-        } else {
-            y += dashSpaceHeight;
-        }
+        fadeGeometry.end();
     }
 
-    // draw fade out bar
-    drawList->AddRectFilled(
-        ImVec2(fadeOutX - 2.f, ui_origin.y),
-        ImVec2(fadeOutX, ui_end.y),
-        barColor
-    );
-
     // ui controls
     ImGui::InvisibleButton(id, size);
 
@@ -1137,6 +1330,58 @@ void PluginController::filterInsertPole(FilterType filter, int control_idx, bpbx
     paramChange(baseEnum + control_idx * 3 + 2, gain);
 }
 
+// the curve is only computed again when a param of the filter changed,
+// which while dragging a pole is only the filter being edited
+const float* PluginController::filterCurve(FilterType filter, instr_param_id baseParam) {
+    FilterCurve &curve = filterCurves[filter];
+
+    GeometryKey key;
+    for (int i = 0; i < BPBXSYN_FILTER_GROUP_COUNT * 3; i++)
+        key.add(params[baseParam + i]);
+
+    if (curve.valid && curve.key == key.value())
+        return curve.gain;
+
+    // frequencies of the points do not change
+    static double pointHz[FILTER_CURVE_POINTS];
+    static bool pointHzInitialized = false;
+    if (!pointHzInitialized) {
+        for (int i = 0; i < FILTER_CURVE_POINTS; i++)
+            pointHz[i] = bpbxsyn_freq_setting_to_hz((double)i / 2.0);
+
+        pointHzInitialized = true;
+    }
+
+    // squared magnitude of the response, accumulated one stage at a time so
+    // that the products run over contiguous arrays
+    const double ref_sample_rate = 48000;
+    double magSq[FILTER_CURVE_POINTS];
+    std::fill(magSq, magSq + FILTER_CURVE_POINTS, 1.0);
+
+    for (int ctl = 0; ctl < BPBXSYN_FILTER_GROUP_COUNT; ctl++) {
+        const bpbxsyn_filter_type_e type = (bpbxsyn_filter_type_e)params[baseParam + FILTER_PARAM_TYPE(ctl)];
+        if (type == BPBXSYN_FILTER_TYPE_OFF) continue;
+
+        const double freq = params[baseParam + FILTER_PARAM_FREQ(ctl)];
+        const double gain = params[baseParam + FILTER_PARAM_GAIN(ctl)];
+
+        for (int i = 0; i < FILTER_CURVE_POINTS; i++) {
+            bpbxsyn_complex_s cmp;
+            bpbxsyn_analyze_freq_response(type, freq, gain, pointHz[i], ref_sample_rate, &cmp);
+            magSq[i] *= cmp.real * cmp.real + cmp.imag * cmp.imag;
+        }
+    }
+
+    for (int i = 0; i < FILTER_CURVE_POINTS; i++) {
+        double gain_setting = bpbxsyn_linear_gain_to_setting(sqrt(magSq[i]));
+        curve.gain[i] = clamp((float)(gain_setting / BPBXSYN_FILTER_GAIN_MAX));
+    }
+
+    curve.key = key.value();
+    curve.valid = true;
+    return curve.gain;
+}
+
 void PluginController::drawEqWidget(FilterType filter, const char *id, ImVec2 size) {
     ImDrawList *drawList = ImGui::GetWindowDrawList();
     ImVec2 ui_origin = ImGui::GetCursorScreenPos();
@@ -1422,42 +1667,38 @@ void PluginController::drawEqWidget(FilterType filter, const char *id, ImVec2 si
 
     // now, do the drawing
     // draw frequency response graph
-    const double ref_sample_rate = 48000;
-    float last_y;
-    float last_x;
-    for (int i = 0; i < BPBXSYN_FILTER_FREQ_RANGE * 2; i++) {
-        double freqIndex = (double)i / 2.0;
-        double hz = bpbxsyn_freq_setting_to_hz(freqIndex);
-
-        double linear_gain = 1.0;
-        for (int ctl = 0; ctl < BPBXSYN_FILTER_GROUP_COUNT; ctl++) {
-            bpbxsyn_complex_s cmp;
-            bpbxsyn_analyze_freq_response(
-                (bpbxsyn_filter_type_e)params[baseEnum + FILTER_PARAM_TYPE(ctl)],
-                params[baseEnum + FILTER_PARAM_FREQ(ctl)],
-                params[baseEnum + FILTER_PARAM_GAIN(ctl)],
-                hz, ref_sample_rate, &cmp);
-            
-            linear_gain *= sqrt(cmp.real * cmp.real + cmp.imag * cmp.imag);
-        }
-
-        double gain_setting = bpbxsyn_linear_gain_to_setting(linear_gain);
-        float gain_y_normalized = (gain_setting / BPBXSYN_FILTER_GAIN_MAX);
-        if (gain_y_normalized < 0.0) gain_y_normalized = 0.0;
-        if (gain_y_normalized > 1.0) gain_y_normalized = 1.0;
-        
-        float y = (ui_origin.y - ui_end.y) * gain_y_normalized + ui_end.y;
-        float x = floor((ui_end.x - ui_origin.x) * ((float)freqIndex / BPBXSYN_FILTER_FREQ_MAX) + ui_origin.x);
+    // the curve only depends on the params of the filter
+    GeometryKey curveKey;
+    curveKey.add(size).add(fractionalPart(ui_origin)).add(graph_color);
+    for (int i = 0; i < BPBXSYN_FILTER_GROUP_COUNT * 3; i++)
+        curveKey.add(params[baseEnum + i]);
+
+    GeometryCache &curveGeometry = eqCurveGeometry[filter];
+    if (!curveGeometry.replay(drawList, ui_origin, curveKey.value())) {
+        curveGeometry.begin(drawList, ui_origin, curveKey.value());
+
+        const float *curve = filterCurve(filter, baseEnum);
+        float last_y;
+        float last_x;
+        for (int i = 0; i < FILTER_CURVE_POINTS; i++) {
+            float freqIndex = (float)i / 2.0f;
+            float gain_y_normalized = curve[i];
+
+            float y = (ui_origin.y - ui_end.y) * gain_y_normalized + ui_end.y;
+            float x = floor((ui_end.x - ui_origin.x) * (freqIndex / BPBXSYN_FILTER_FREQ_MAX) + ui_origin.x);
+
+            if (i > 0 && (fabs(y - ui_end.y) >= 2 || fabs(last_y - ui_end.y) >= 2)) {
+                drawList->AddQuadFilled(
+                    ImVec2(x, y), ImVec2(x, ui_end.y),
+                    ImVec2(last_x, ui_end.y), ImVec2(last_x, last_y),
+                    graph_color);
+            }
 
-        if (i > 0 && (fabs(y - ui_end.y) >= 2 || fabs(last_y - ui_end.y) >= 2)) {
-            drawList->AddQuadFilled(
-                ImVec2(x, y), ImVec2(x, ui_end.y),
-                ImVec2(last_x, ui_end.y), ImVec2(last_x, last_y),
-                graph_color);
+            last_x = x;
+            last_y = y;
         }
 
-        last_x = x;
-        last_y = y;
+        curveGeometry.end();
     }
      
     // draw the poles
@@ -1592,6 +1833,16 @@ void PluginController::drawHarmonicsEditor(const char *id, uint32_t paramId, ImV
 
     ImU32 fifthGuideColor = ImGui::GetColorU32(ImGuiCol_FrameBg);
 
+    GeometryKey key;
+    key.add(size).add(controlColor).add(octaveGuideColor).add(fifthGuideColor);
+    for (int i = 0; i < BPBXSYN_HARMONICS_CONTROL_COUNT; i++)
+        key.add(params[paramId + i]);
+
+    if (harmonicsGeometry.replay(drawList, ui_origin, key.value()))
+        return;
+
+    harmonicsGeometry.begin(drawList, ui_origin, key.value());
+
     // draw the guides
     static const int octaves[] = {1, 2, 4, 8, 16};
     static const int fifths[] = {3, 6, 12, 24};
@@ -1639,6 +1890,8 @@ void PluginController::drawHarmonicsEditor(const char *id, uint32_t paramId, ImV
                 controlColor);
         }
     }
+
+    harmonicsGeometry.end();
 }
 
 void PluginController::drawSpectrumEditor(const char *id, uint32_t baseParamId,
@@ -1695,6 +1948,23 @@ void PluginController::drawSpectrumEditor(const char *id, uint32_t baseParamId,
     // outside of the widget bounds
     drawList->PushClipRect(ui_origin, ui_end, true);
 
+    ImU32 octave_guide_color = ImGui::GetColorU32(ImGuiCol_Button);
+    ImU32 fifth_guide_color = ImGui::GetColorU32(ImGuiCol_FrameBg);
+    ImU32 fill_color = ImGui::GetColorU32(ImGuiCol_Header);
+    ImU32 outline_color = ImGui::GetColorU32(ImGuiCol_ButtonHovered);
+
+    GeometryKey key;
+    key.add(size).add(octave_guide_color).add(fifth_guide_color).add(fill_color).add(outline_color);
+    for (uint32_t i = 0; i < BPBXSYN_SPECTRUM_CONTROL_COUNT; ++i)
+        key.add(params[baseParamId + i]);
+
+    if (spectrumGeometry.replay(drawList, ui_origin, key.value())) {
+        drawList->PopClipRect();
+        return;
+    }
+
+    spectrumGeometry.begin(drawList, ui_origin, key.value());
+
     float draw_heights[draw_height_count];
     draw_heights[0] = 0.f;
 
@@ -1710,9 +1980,6 @@ void PluginController::drawSpectrumEditor(const char *id, uint32_t baseParamId,
 
     float height = ui_end.y - ui_origin.y;
 
-    ImU32 octave_guide_color = ImGui::GetColorU32(ImGuiCol_Button);
-    ImU32 fifth_guide_color = ImGui::GetColorU32(ImGuiCol_FrameBg);
-
     constexpr int octaves[] = { 0, 7, 14, 21, 28 };
     constexpr int fifths[] = { 4, 11, 18, 25 };
 
@@ -1730,7 +1997,6 @@ void PluginController::drawSpectrumEditor(const char *id, uint32_t baseParamId,
     }
 
     // draw fill
-    ImU32 fill_color = ImGui::GetColorU32(ImGuiCol_Header);
     for (int i = 1; i < draw_height_count; ++i) {
         // empty spot
         if (draw_heights[i-1] == 0.f && draw_heights[i] == 0.f)
@@ -1765,7 +2031,6 @@ void PluginController::drawSpectrumEditor(const char *id, uint32_t baseParamId,
     
     // draw outline
     bool is_path_active = false;
-    ImU32 outline_color = ImGui::GetColorU32(ImGuiCol_ButtonHovered);
     for (int i = 1; i < draw_height_count; ++i) {
         // empty spot
         if (draw_heights[i-1] == 0.f && draw_heights[i] == 0.f) {
@@ -1808,6 +2073,7 @@ void PluginController::drawSpectrumEditor(const char *id, uint32_t baseParamId,
             outline_color);
     }
 
+    spectrumGeometry.end();
     drawList->PopClipRect();
 }
 
@@ -1970,7 +2236,7 @@ void PluginController::draw(platform::Window *window) {
             // if (ImGui::BeginMenu("."))
             {
                 if (ImGui::BeginMenu("Presets")) {
-                    ImGui::MenuItem("Test");
+                    drawPresetsMenu();
                     ImGui::EndMenu();
                 }
 
@@ -2044,7 +2310,7 @@ void PluginController::draw(platform::Window *window) {
 
         // about window ui
         if (showAbout) {
-            drawAbout(winFlags);
+            drawAbout(winFlags, window);
 
         // instrument ui
         } else {
@@ -2190,6 +2456,13 @@ void PluginController::draw(platform::Window *window) {
             }
         }
     }
+
+    // everything drawn this frame has seen the changes
+    params.clearDirty();
+
+    // try again next frame if the plugin has not caught up yet
+    if (!flushEvents())
+        platform::requestRedraw(window);
 }
 
 // https://stackoverflow.com/questions/3018313/algorithm-to-convert-rgb-to-hsv-and-hsv-to-rgb-in-range-0-255-for-both
@@ -2305,6 +2578,18 @@ Color Color::fromHsv(const Hsv &hsv) {
 }
 
 void PluginController::updateColors() {
+    // the style is kept by the imgui context, so it only has to be built
+    // again when the colors change
+    if (styleApplied && appliedUseCustomColors == useCustomColors &&
+        (!useCustomColors || (appliedCustomColor.r == customColor.r &&
+                              appliedCustomColor.g == customColor.g &&
+                              appliedCustomColor.b == customColor.b)))
+        return;
+
+    styleApplied = true;
+    appliedUseCustomColors = useCustomColors;
+    appliedCustomColor = customColor;
+
     ImGui::StyleColorsDark();
 
     if (useCustomColors) {
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <imgui.h>
+#include <atomic>
 #include <vector>
-#include <unordered_map>
 #include "include/plugin_gui.h"
 #include "platform.hpp"
 #include "util.hpp"
 #include "gfx.hpp"
+#include "param_store.hpp"
+#include "geometry_cache.hpp"
 
 constexpr int GUI_EVENT_QUEUE_MASK = GUI_EVENT_QUEUE_SIZE-1;
 
@@ -27,26 +29,61 @@ private:
     const clap_plugin_t *const plugin;
     const clap_host_t *const host;
     instrument_s *const instrument;
+    instr_snapshot_s *snapshot;
     Page currentPage;
 
     bool showAbout;
     bpbxsyn_synth_type_e inst_type;
-    std::unordered_map<clap_id, double> params;
+    ParamStore params;
+    ParamShadow paramShadow;
     
     float uiRightCol;
     void sameLineRightCol();
 
     std::vector<bpbxsyn_envelope_s> envelopes;
 
+    // first and count are positions in the category order of the bank
+    struct PresetCategory {
+        const char *name;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    const preset_bank_s *presetBank;
+    load_preset_f loadPreset;
+    std::vector<PresetCategory> presetCategories;
+
+    void drawPresetsMenu();
+    void presetMenuItems(uint32_t (*order)(const preset_bank_s*, uint32_t),
+                         uint32_t first, uint32_t count);
+
+    // returns true if any param or other state changed
     bool updateParams();
     void updateColors(); // update style based on custom colors
 
-    void queueCheck();
+    // colors the current style was built from
+    bool styleApplied;
+    bool appliedUseCustomColors;
+    Color appliedCustomColor;
+
+    // events for the plugin are collected here over a frame. a param change
+    // replaces the value of an unsent change to the same param, unless an
+    // ordered event (gesture, envelope edit) was sent in between. events
+    // that do not fit in gui_to_plugin are kept until the next flush.
+    std::vector<gui_event_queue_item_s> outbox;
+    void sendEvent(const gui_event_queue_item_s &item);
+
+    // returns false if some events could not be sent yet
+    bool flushEvents();
+
+    // overflow count of plugin_to_gui as of the last update
+    size_t pluginEventOverflows;
+
     void paramControls(uint32_t paramId);
     void sliderParameter(uint32_t paramId, const char *id, float v_min, float v_max, const char *fmt = "%.3f", bool normalized = false);
     void vertSliderParameter(uint32_t paramId, const char *id, ImVec2 size, float v_min, float v_max, const char *fmt = "%.3f", bool normalized = false);
 
-    void drawAbout(ImGuiWindowFlags winFlags);
+    void drawAbout(ImGuiWindowFlags winFlags, platform::Window *window);
     void drawFmGui();
     void drawChipGui1();
     void drawChipGui2();
@@ -56,6 +93,18 @@ private:
     void drawNoiseGui2();
     void drawPwmGui();
 
+    // frequency response of a filter at every half step of its frequency
+    // setting, as gain normalized to the height of the graph
+    static constexpr int FILTER_CURVE_POINTS = BPBXSYN_FILTER_FREQ_RANGE * 2;
+
+    struct FilterCurve {
+        bool valid = false;
+        uint64_t key; // of the filter params
+        float gain[FILTER_CURVE_POINTS];
+    } filterCurves[2];
+
+    const float* filterCurve(FilterType filter, instr_param_id baseParam);
+
     void drawFadeWidget(const char *id, ImVec2 size);
     void drawEqWidget(FilterType filter, const char *id, ImVec2 size);
     void drawEnvelopes();
@@ -100,6 +149,12 @@ private:
         bool activeGestures[BPBXSYN_SPECTRUM_CONTROL_COUNT] = {0};
     } spectrumEditorState;
 
+    // retained geometry of the custom widgets
+    GeometryCache harmonicsGeometry;
+    GeometryCache spectrumGeometry;
+    GeometryCache fadeGeometry;
+    GeometryCache eqCurveGeometry[2];
+
 #ifdef PLUGIN_VST3
     struct {
         gfx::Texture *texture;
@@ -110,13 +165,34 @@ private:
 public:
     show_context_menu_f popupContextMenu;
     void *pluginUserdata;
+    const synth_arena_s *synthArena;
 
     PluginController(const clap_plugin_t *plugin, const clap_host_t *host, instrument_s *instrument);
+    ~PluginController();
+    void setPresets(const preset_bank_s *bank, load_preset_f loadPreset);
+
+    // decode the images used by every editor, while any is open
+    static void loadSharedImages();
+    static void freeSharedImages();
 
     void graphicsInit();
     void graphicsClose();
 
+    // reread the state of the instrument. only called from the gui thread,
+    // or before the window exists.
     void sync();
+
+    // called after writing to plugin_to_gui or the param shadow, from any
+    // thread. asks the host
+    // for a main thread callback, in which the plugin calls gui_wake.
+    void notifyPluginEvent();
+
+    // returns true once for every batch of plugin events
+    bool takeWake();
+
+    // called from the audio thread when a param changed. id is untyped.
+    void pluginParamChange(instr_param_id id, double value);
+
     void event(platform::Event ev, platform::Window *window);
     void draw(platform::Window *window);
     
@@ -125,4 +201,7 @@ public:
 
     EventQueue<gui_event_queue_item_s, GUI_EVENT_QUEUE_SIZE> gui_to_plugin;
     EventQueue<gui_event_queue_item_s, GUI_EVENT_QUEUE_SIZE> plugin_to_gui;
+
+private:
+    std::atomic_bool wakePending;
 }; // class PluginController
\ No newline at end of file
@@ -66,12 +66,16 @@ inline constexpr Color operator/(const Color &col, float mul) {
     return Color(col.r / mul, col.g / mul, col.b / mul);
 }
 
+// bounded single-producer, single-consumer queue. holds up to SIZE - 1
+// items; enqueue fails and counts the overflow when it is full, rather than
+// overwriting items that were not read yet.
 template <typename T, size_t SIZE>
 struct EventQueue {
 private:
     T *data;
     std::atomic_size_t write_ptr;
     std::atomic_size_t read_ptr;
+    std::atomic_size_t overflows;
 
     static constexpr size_t MASK = SIZE - 1;
 
@@ -81,27 +85,37 @@ public:
     EventQueue() noexcept : data(new T[SIZE]) {
         write_ptr.store(0);
         read_ptr.store(0);
+        overflows.store(0);
     }
     
     EventQueue(EventQueue&) = delete;
     EventQueue operator=(EventQueue&) = delete;
     ~EventQueue() noexcept { delete[] data; }
 
-    void enqueue(const T &item) {
-        uint32_t ptr = write_ptr.load();
-        data[ptr] = item;
-        ptr = (ptr + 1) & MASK;
-        write_ptr.store(ptr);
+    // producer only. returns false if the queue is full.
+    bool enqueue(const T &item) {
+        size_t write = write_ptr.load(std::memory_order_relaxed);
+        size_t next = (write + 1) & MASK;
+
+        if (next == read_ptr.load(std::memory_order_acquire)) {
+            overflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        data[write] = item;
+        write_ptr.store(next, std::memory_order_release);
+        return true;
     }
 
+    // consumer only
     bool dequeue(T &item) {
-        size_t read = read_ptr.load();
-        size_t write = write_ptr.load();
+        size_t read = read_ptr.load(std::memory_order_relaxed);
+        size_t write = write_ptr.load(std::memory_order_acquire);
         if (read == write) return false;
 
         item = data[read];
         read = (read + 1) & MASK;
-        read_ptr.store(read);
+        read_ptr.store(read, std::memory_order_release);
 
         return true;
     }
@@ -110,10 +124,11 @@ public:
         size_t read = read_ptr.load();
         size_t write = write_ptr.load();
 
-        if (write >= read) {
-            return write - read;
-        } else {
-            return SIZE - read + write;
-        }
+        return (write - read) & MASK;
+    }
+
+    // number of items that were refused because the queue was full
+    size_t overflow_count() const {
+        return overflows.load(std::memory_order_relaxed);
     }
 }; // struct EventQueue
\ No newline at end of file
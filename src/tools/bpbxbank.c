@@ -0,0 +1,119 @@
+// packs saved states of the single-instrument plugin into a preset bank.
+//
+// usage: bpbxbank <output> (<name> <category> <state file>)...
+//
+// a state file holds what the plugin writes through clap_plugin_state:
+// the save revision and synth version, followed by the instrument state.
+// the category may be an empty string. every state must share the same
+// save revision, as a bank stores only one.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <plugin/include/preset_bank.h>
+
+// save revision and synth version
+#define STATE_HEADER_SIZE 16
+
+static uint8_t* read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    uint8_t *data = NULL;
+    size_t capacity = 0;
+    *size = 0;
+
+    for (;;) {
+        if (*size == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            uint8_t *new_data = realloc(data, capacity);
+            if (!new_data) goto error;
+            data = new_data;
+        }
+
+        const size_t read = fread(data + *size, 1, capacity - *size, file);
+        *size += read;
+        if (read == 0) break;
+    }
+
+    if (ferror(file)) goto error;
+    fclose(file);
+    return data;
+
+    error:
+        fclose(file);
+        free(data);
+        return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || (argc - 2) % 3 != 0) {
+        fprintf(stderr,
+                "usage: %s <output> (<name> <category> <state file>)...\n",
+                argv[0]);
+        return 1;
+    }
+
+    const uint32_t count = (uint32_t)(argc - 2) / 3;
+    preset_bank_entry_s *presets = calloc(count + 1, sizeof(*presets));
+    uint8_t **files = calloc(count + 1, sizeof(*files));
+    int ret = 1;
+    if (!presets || !files) goto cleanup;
+
+    uint32_t save_version = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const char *path = argv[2 + i * 3 + 2];
+
+        size_t size;
+        files[i] = read_file(path, &size);
+        if (!files[i]) {
+            fprintf(stderr, "%s: could not read file\n", path);
+            goto cleanup;
+        }
+
+        // the instrument state starts with its synth type
+        if (size <= STATE_HEADER_SIZE) {
+            fprintf(stderr, "%s: not a plugin state\n", path);
+            goto cleanup;
+        }
+
+        const uint8_t *p = files[i];
+        const uint32_t version = (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+            ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+
+        if (i == 0) {
+            save_version = version;
+        } else if (version != save_version) {
+            fprintf(stderr, "%s: save revision %u differs from %u\n",
+                    path, version, save_version);
+            goto cleanup;
+        }
+
+        presets[i] = (preset_bank_entry_s) {
+            .name = argv[2 + i * 3],
+            .category = argv[2 + i * 3 + 1],
+            .type = (bpbxsyn_synth_type_e)p[STATE_HEADER_SIZE],
+            .data = p + STATE_HEADER_SIZE,
+            .size = size - STATE_HEADER_SIZE
+        };
+    }
+
+    if (!preset_bank_write(argv[1], presets, count, save_version)) {
+        fprintf(stderr,
+                "%s: could not write bank. preset names must be unique.\n",
+                argv[1]);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+    cleanup:
+        if (files) {
+            for (uint32_t i = 0; i < count; ++i)
+                free(files[i]);
+        }
+
+        free(files);
+        free(presets);
+        return ret;
+}